@@ -0,0 +1,180 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <exception>
+
+#include "incrementalSearch.hpp"
+
+// Flag to cancel a search from any thread, copies refer to the same flag
+class CancellationToken
+{
+public:
+    CancellationToken()
+        : m_isCancelled(std::make_shared<std::atomic<bool>>(false))
+    {}
+
+    void cancel() const      { m_isCancelled->store(true, std::memory_order_relaxed); }
+    bool isCancelled() const { return m_isCancelled->load(std::memory_order_relaxed); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> m_isCancelled;
+};
+
+// Search on a background thread, so the caller (e.g. UI thread) is never blocked by a query.
+//
+// Tiers are delivered as soon as they are found, see IncrementalSearch::searchProgressive(): starts-with results
+// don't wait for the corrections lookup. A keystroke makes the running query stale, so every search() cancels
+// the previous one: it stops at the next poll, before a tier or between chunks of the corrections lookup.
+// A query which is not started yet is dropped right away.
+//
+// Callbacks are called on the worker thread. IncrementalSearch must outlive AsyncSearch.
+class AsyncSearch
+{
+public:
+    typedef IncrementalSearch::Result             Result;
+    typedef IncrementalSearch::Tier               Tier;
+    typedef std::chrono::steady_clock::time_point Deadline;
+
+    enum Status
+    {
+        eCOMPLETED,
+        eCANCELLED,             // by the token, by the next search(), by cancel() or by destruction
+        eDEADLINE_EXCEEDED,     // tiers delivered before the deadline are all there is
+    };
+
+    // 'results' are all results found so far in their final order, they are valid during the call only
+    typedef std::function<void(Tier tier, const Result* results, size_t count)> Callback;
+
+    explicit AsyncSearch(const IncrementalSearch& search)
+        : m_search(search)
+        , m_worker([this]() { run(); })
+    {}
+
+    ~AsyncSearch()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_isStopping = true;
+            cancelLocked();
+        }
+
+        m_wakeUp.notify_one();
+        m_worker.join();
+    }
+
+    // The future is ready once the search is finished: after the last delivered tier, or right away if it's dropped.
+    // An exception thrown by 'onTier' stops the search and is rethrown by the future
+    std::future<Status> search(std::string query, size_t maxCount, Callback onTier,
+                               CancellationToken token = CancellationToken(), Deadline deadline = Deadline::max())
+    {
+        auto request = std::make_shared<Request>();
+        request->m_query    = std::move(query);
+        request->m_maxCount = maxCount;
+        request->m_onTier   = std::move(onTier);
+        request->m_token    = std::move(token);
+        request->m_deadline = deadline;
+
+        std::future<Status> status = request->m_status.get_future();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            cancelLocked();
+            m_pending = std::move(request);
+        }
+
+        m_wakeUp.notify_one();
+        return status;
+    }
+
+    // cancels the running and the pending searches, e.g. when the query is cleared
+    void cancel()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        cancelLocked();
+    }
+
+private:
+    struct Request
+    {
+        std::string          m_query;
+        size_t               m_maxCount = 0;
+        Callback             m_onTier;
+        CancellationToken    m_token;
+        Deadline             m_deadline;
+        std::atomic<bool>    m_isSuperseded { false };
+        std::promise<Status> m_status;
+    };
+
+    const IncrementalSearch& m_search;
+
+    std::mutex               m_mutex;
+    std::condition_variable  m_wakeUp;
+    std::shared_ptr<Request> m_pending;         // the next one to run
+    std::shared_ptr<Request> m_running;
+    bool                     m_isStopping = false;
+
+    std::thread              m_worker;          // the last member: it's started once the rest are constructed
+
+    AsyncSearch(const AsyncSearch&)            = delete;
+    AsyncSearch& operator=(const AsyncSearch&) = delete;
+
+    // under m_mutex
+    void cancelLocked()
+    {
+        if (m_running != nullptr)
+            m_running->m_isSuperseded = true;
+
+        if (m_pending != nullptr)
+        {
+            m_pending->m_status.set_value(eCANCELLED);
+            m_pending = nullptr;
+        }
+    }
+
+    void run()
+    {
+        for (;;)
+        {
+            std::shared_ptr<Request> request;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wakeUp.wait(lock, [this]() { return m_isStopping || m_pending != nullptr; });
+                if (m_isStopping)
+                    return;
+
+                request   = std::move(m_pending);
+                m_pending = nullptr;
+                m_running = request;
+            }
+
+            try
+            {
+                request->m_status.set_value(execute(*request));
+            }
+            catch (...)
+            {
+                request->m_status.set_exception(std::current_exception());
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = nullptr;
+        }
+    }
+
+    Status execute(const Request& request) const
+    {
+        auto isCancelled = [&request]() { return request.m_isSuperseded || request.m_token.isCancelled(); };
+        auto isStopped   = [&request, &isCancelled]() { return isCancelled() || std::chrono::steady_clock::now() >= request.m_deadline; };
+
+        if (m_search.searchProgressive(request.m_query, request.m_maxCount, isStopped, request.m_onTier))
+            return eCOMPLETED;
+
+        return isCancelled() ? eCANCELLED : eDEADLINE_EXCEEDED;
+    }
+};
@@ -0,0 +1,296 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "snapshot.hpp"
+#include "utf8.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BATCH_DISTANCE_X86_SIMD
+#endif
+
+// kernel must be inlined into ISA-specific functions, otherwise it's compiled for the baseline ISA
+#if defined __GNUC__
+#define BATCH_DISTANCE_INLINE __attribute__((always_inline)) inline
+#else
+#define BATCH_DISTANCE_INLINE inline
+#endif
+
+// Computes distances between one query and a batch of equal-length words at once: the batch is stored as structure
+// of arrays (k_lanes chars of the column 0, then k_lanes chars of the column 1, etc), so DP matrices of all batch words
+// are filled simultaneously in SIMD lanes, one 16-bit cell per lane.
+//
+// Distances are exactly the same as SpellCheck::getSmartDistance(), including incremental backtrace tie-breaking.
+// SSE4.2 (8 lanes) or AVX2 (16 lanes) kernel is chosen at runtime, scalar kernel is a fallback for other CPUs and compilers.
+class BatchDistance
+{
+public:
+    static const size_t k_lanes     = 16;       // words per batch
+    static const size_t k_maxLength = 0xFFF0;   // longer words and queries don't fit into 16-bit cells
+
+    enum class Isa
+    {
+        eSCALAR,
+        eSSE42,
+        eAVX2,
+    };
+
+    struct Batch
+    {
+        uint32_t m_length;              // length of every word in the batch
+        uint32_t m_count;               // words in the batch, the rest of lanes is padding
+        size_t   m_chars;               // offset of SoA chars
+        std::array<uint32_t, k_lanes> m_words;    // indices of words in the original vocabulary
+    };
+
+    BatchDistance() = default;
+
+    // 'words' are grouped by length, the order of words within length is preserved. Words longer than k_maxLength are skipped,
+    // so are non-ASCII ones: they are compared by codepoints, see SpellCheck::getUtf8Distance().
+    template <typename Words>
+    explicit BatchDistance(const Words& words)
+    {
+        std::vector<uint32_t> order;
+        order.reserve(words.size());
+        for (size_t i = 0; i < words.size(); ++i)
+            if (words[i].size() <= k_maxLength && utf8::isAscii(std::string_view(words[i].data(), words[i].size())))
+                order.push_back(static_cast<uint32_t>(i));
+
+        std::stable_sort(order.begin(), order.end(), [&words](uint32_t left, uint32_t right) { return words[left].size() < words[right].size(); });
+
+        std::vector<Char>  chars;
+        std::vector<Batch> batches;
+
+        for (size_t first = 0; first < order.size(); )
+        {
+            size_t length = words[order[first]].size();
+            size_t last   = first;
+            while (last < order.size() && last - first < k_lanes && words[order[last]].size() == length)
+                ++last;
+
+            Batch batch = { static_cast<uint32_t>(length), static_cast<uint32_t>(last - first), chars.size(), {} };
+            chars.resize(chars.size() + length * k_lanes, 0);
+
+            // padding lanes are copies of the first word, so they never prevent early exit of the whole batch
+            for (size_t lane = 0; lane < k_lanes; ++lane)
+            {
+                const auto& word = words[order[first + (lane < batch.m_count ? lane : 0)]];
+                batch.m_words[lane] = order[first + (lane < batch.m_count ? lane : 0)];
+
+                for (size_t j = 0; j < length; ++j)
+                    chars[batch.m_chars + j * k_lanes + lane] = static_cast<unsigned char>(word[j]);
+            }
+
+            batches.push_back(batch);
+            first = last;
+        }
+
+        m_chars   = std::move(chars);
+        m_batches = std::move(batches);
+    }
+
+    explicit BatchDistance(SnapshotReader& reader)
+        : m_chars(reader.read<Char>())
+        , m_batches(reader.read<Batch>())
+    {}
+
+    void save(SnapshotWriter& writer) const
+    {
+        writer.write(m_chars);
+        writer.write(m_batches);
+    }
+
+    bool   empty() const           { return m_batches.empty(); }
+    size_t size() const            { return m_batches.size(); }
+    const Batch& operator[](size_t batch) const { return m_batches[batch]; }
+
+    static Isa getBestIsa()
+    {
+#if defined BATCH_DISTANCE_X86_SIMD
+        static const Isa s_best = __builtin_cpu_supports("avx2")   ? Isa::eAVX2
+                                : __builtin_cpu_supports("sse4.2") ? Isa::eSSE42
+                                                                   : Isa::eSCALAR;
+        return s_best;
+#else
+        return Isa::eSCALAR;
+#endif
+    }
+
+    // Fills 'distances' of all batch words to 'query', see SpellCheck::getSmartDistance() for parameters meaning.
+    // 'isIncrementalMatch' tells whether trailing insertions are ignored, it's the same for all words of equal length.
+    // Query must not be longer than k_maxLength.
+    void getDistances(const Batch& batch, const char* query, size_t querySize, bool isIncrementalMatch, unsigned maxDistance,
+                      unsigned (&distances)[k_lanes], Isa isa = getBestIsa()) const
+    {
+        Query params = { &m_chars[batch.m_chars], batch.m_length, query, querySize, isIncrementalMatch, maxDistance };
+
+        switch (isa)
+        {
+#if defined BATCH_DISTANCE_X86_SIMD
+        case Isa::eAVX2:  return getDistancesAvx2(params, distances);
+        case Isa::eSSE42: return getDistancesSse42(params, distances);
+#endif
+        default:          return getDistancesScalar(params, distances, batch.m_count);
+        }
+    }
+
+private:
+    typedef uint16_t Char;
+
+    MappedArray<Char>  m_chars;
+    MappedArray<Batch> m_batches;
+
+    struct Query
+    {
+        const Char* m_chars;
+        size_t      m_length;
+        const char* m_query;
+        size_t      m_querySize;
+        bool        m_isIncrementalMatch;
+        unsigned    m_maxDistance;
+    };
+
+    // Kernel is written in terms of operators, which are valid both for scalar cell and GCC vector of cells.
+    // Helper functions returning vectors are avoided intentionally: they would be compiled for the baseline ISA.
+#if defined BATCH_DISTANCE_X86_SIMD
+    typedef uint16_t Cell8  __attribute__((vector_size(16)));
+    typedef uint16_t Cell16 __attribute__((vector_size(32)));
+
+    __attribute__((target("avx2")))
+    static void getDistancesAvx2(const Query& query, unsigned (&distances)[k_lanes])
+    {
+        kernel<Cell16, 16>(query, 0, distances);
+    }
+
+    __attribute__((target("sse4.2")))
+    static void getDistancesSse42(const Query& query, unsigned (&distances)[k_lanes])
+    {
+        kernel<Cell8, 8>(query, 0, distances);
+        kernel<Cell8, 8>(query, 8, distances);
+    }
+#endif
+
+    static void getDistancesScalar(const Query& query, unsigned (&distances)[k_lanes], size_t count)
+    {
+        for (size_t lane = 0; lane < count; ++lane)
+            kernel<uint16_t, 1>(query, lane, distances);
+    }
+
+    template <typename Cell>
+    static BATCH_DISTANCE_INLINE uint16_t getLane(const Cell& cell, size_t lane)
+    {
+        return reinterpret_cast<const uint16_t*>(&cell)[lane];
+    }
+
+    // vector + variable scalar is not allowed, so broadcasting is a loop the compiler recognizes
+    template <typename Cell, size_t Lanes>
+    static BATCH_DISTANCE_INLINE void setAll(Cell& cell, size_t value)
+    {
+        for (size_t lane = 0; lane < Lanes; ++lane)
+            reinterpret_cast<uint16_t*>(&cell)[lane] = static_cast<uint16_t>(value);
+    }
+
+    // the same DP as SpellCheck::optimalStringAlignementDistance(), row per query char, column per word char, cell per lane.
+    // Only three rows are kept: transposition looks back at (i-2, j-2).
+    // It's forced inline in order to be compiled for the ISA of the caller.
+    template <typename Cell, size_t Lanes>
+    static BATCH_DISTANCE_INLINE void kernel(const Query& query, size_t firstLane, unsigned (&distances)[k_lanes])
+    {
+        const size_t width  = query.m_length + 1;
+        const size_t height = query.m_querySize + 1;
+        const Char*  chars  = query.m_chars + firstLane;
+        const Cell   zero   = Cell();
+        const Cell   one    = zero + uint16_t(1);
+        const Cell   noTransposition = zero + uint16_t(0xFFFF);
+
+        // rows are aligned manually: without -mavx GCC aligns 32-byte vectors by 16 bytes only, e.g. in std::vector
+        thread_local std::vector<unsigned char> s_rows;
+        if (s_rows.size() < 3 * width * sizeof(Cell) + sizeof(Cell))
+            s_rows.resize(3 * width * sizeof(Cell) + sizeof(Cell));
+
+        const uintptr_t rowsAddress = reinterpret_cast<uintptr_t>(s_rows.data());
+        Cell* thisRow  = reinterpret_cast<Cell*>((rowsAddress + sizeof(Cell) - 1) / sizeof(Cell) * sizeof(Cell));
+        Cell* prevRow  = thisRow + width;
+        Cell* prevRow2 = thisRow + 2 * width;
+
+        for (size_t j = 0; j < width; ++j)
+            setAll<Cell, Lanes>(thisRow[j], j);
+
+        Cell incremental = zero;    // distance without trailing insertions, valid for the last row only
+
+        for (size_t i = 1; i < height; ++i)
+        {
+            std::swap(prevRow2, prevRow);
+            std::swap(prevRow, thisRow);
+
+            const bool isLastRow = i == height - 1;
+
+            Cell targetChar, prevTargetChar;
+            setAll<Cell, Lanes>(targetChar, static_cast<unsigned char>(query.m_query[i - 1]));
+            setAll<Cell, Lanes>(prevTargetChar, i > 1 ? static_cast<unsigned char>(query.m_query[i - 2]) : 0);
+
+            setAll<Cell, Lanes>(thisRow[0], i);
+            Cell rowMin = thisRow[0];
+            incremental = thisRow[0];           // deletion, stops the chain of insertions
+
+            Cell prevSourceChar = zero;
+            for (size_t j = 1; j < width; ++j)
+            {
+                Cell sourceChar;
+                memcpy(&sourceChar, chars + (j - 1) * k_lanes, sizeof(Cell));
+
+                const auto isMatch      = sourceChar == targetChar;
+                const Cell insertion    = thisRow[j - 1] + one;
+                const Cell substitution = prevRow[j - 1] + one;
+                const Cell deletion     = prevRow[j] + one;
+
+                Cell transposition = noTransposition;
+                if (i > 1 && j > 1)
+                    transposition = ((sourceChar == prevTargetChar) & (prevSourceChar == targetChar)) ? Cell(prevRow2[j - 2] + one) : noTransposition;
+
+                Cell best = transposition < insertion ? transposition : insertion;
+                best      = substitution < best ? substitution : best;
+                best      = deletion < best ? deletion : best;
+
+                thisRow[j] = isMatch ? prevRow[j - 1] : best;
+                rowMin     = thisRow[j] < rowMin ? thisRow[j] : rowMin;
+
+                if (isLastRow && query.m_isIncrementalMatch)
+                {
+                    // the same tie-breaking as Alternative::propose(): transposition, insertion, substitution, deletion
+                    const auto isInsertion = (isMatch == 0) & (insertion < transposition) & (insertion <= substitution) & (insertion <= deletion);
+                    incremental = isInsertion ? incremental : thisRow[j];
+                }
+
+                prevSourceChar = sourceChar;
+            }
+
+            // row minimums never decrease, see SpellCheck::bandedDistance()
+            if (query.m_maxDistance < 0xFFFF && isAllGreater<Cell, Lanes>(rowMin, query.m_maxDistance))
+            {
+                for (size_t lane = 0; lane < Lanes; ++lane)
+                    distances[firstLane + lane] = query.m_maxDistance + 1;
+                return;
+            }
+        }
+
+        const Cell& result = query.m_isIncrementalMatch ? incremental : thisRow[width - 1];
+        for (size_t lane = 0; lane < Lanes; ++lane)
+            distances[firstLane + lane] = getLane(result, lane);
+    }
+
+    template <typename Cell, size_t Lanes>
+    static BATCH_DISTANCE_INLINE bool isAllGreater(const Cell& cell, unsigned value)
+    {
+        for (size_t lane = 0; lane < Lanes; ++lane)
+            if (getLane(cell, lane) <= value)
+                return false;
+
+        return true;
+    }
+};
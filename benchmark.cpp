@@ -0,0 +1,813 @@
+#include "incrementalSearch.hpp"
+#include "documentCheck.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <numeric>
+
+// Benchmark suite: latency distribution of distance kernels, correction lookup, search tiers, keystroke replay,
+// scaling with corpus size, parallel build and document spell check. Every case is warmed up, then timed sample by sample. p50, p99 and max latency
+// of an operation are printed and written as JSON, so results of different builds can be compared.
+//
+// Usage: ./bench [--quick] [--out results.json] [--traces typing.txt] [--filter substring]
+//  --quick   ten times fewer samples and smaller corpora, for a smoke run
+//  --out     JSON file of results, stdout gets only the table then
+//  --traces  recorded typing: one trace per line, backspace is 0x08 or 0x7F. Traces are generated from wikipedia otherwise
+//  --filter  run only cases whose "group/name" contains the substring
+
+typedef std::chrono::steady_clock Clock;
+
+struct Settings
+{
+    bool        m_quick = false;
+    std::string m_out;
+    std::string m_traces;
+    std::string m_filter;
+};
+
+// latency of one operation in nanoseconds, and case-specific numbers like build time or memory usage
+struct CaseResult
+{
+    std::string                                 m_group;
+    std::string                                 m_name;
+    size_t                                      m_samples      = 0;
+    size_t                                      m_opsPerSample = 1;
+    double                                      m_mean         = 0;
+    double                                      m_p50          = 0;
+    double                                      m_p99          = 0;
+    double                                      m_max          = 0;
+    std::vector<std::pair<std::string, double>> m_metrics;
+};
+
+class Benchmark
+{
+public:
+    explicit Benchmark(const Settings& settings) : m_settings(settings) {}
+
+    bool isQuick() const { return m_settings.m_quick; }
+
+    bool isEnabled(const std::string& group, const std::string& name) const
+    {
+        return (group + "/" + name).find(m_settings.m_filter) != std::string::npos;
+    }
+
+    // Calls 'operation(sample)' for warm-up samples, then for 'samples' timed ones. One call does 'opsPerSample' operations,
+    // so its time is divided by it. Returns nullptr if the case is filtered out
+    template <typename Operation>
+    CaseResult* run(const std::string& group, const std::string& name, size_t samples, size_t opsPerSample, Operation operation)
+    {
+        if (!isEnabled(group, name))
+            return nullptr;
+
+        if (isQuick())
+            samples = std::max<size_t>(1, samples / 10);
+
+        for (size_t i = 0; i < std::max<size_t>(1, samples / 10); ++i)
+            operation(i);
+
+        std::vector<double> latencies(samples);
+        for (size_t i = 0; i < samples; ++i)
+        {
+            auto start = Clock::now();
+            operation(i);
+            latencies[i] = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / opsPerSample;
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+
+        CaseResult result;
+        result.m_group        = group;
+        result.m_name         = name;
+        result.m_samples      = samples;
+        result.m_opsPerSample = opsPerSample;
+        result.m_mean         = std::accumulate(latencies.begin(), latencies.end(), 0.0) / samples;
+        result.m_p50          = getPercentile(latencies, 0.50);
+        result.m_p99          = getPercentile(latencies, 0.99);
+        result.m_max          = latencies.back();
+
+        print(result);
+        m_results.push_back(std::move(result));
+        return &m_results.back();
+    }
+
+    // results are written as JSON to --out file or to stdout
+    void report() const
+    {
+        std::ostringstream json;
+        json << "{\n  \"isa\": \"" << getIsaName() << "\",\n  \"quick\": " << (isQuick() ? "true" : "false") << ",\n  \"unit\": \"ns\",\n  \"cases\": [";
+
+        for (size_t i = 0; i < m_results.size(); ++i)
+        {
+            const CaseResult& result = m_results[i];
+            json << (i == 0 ? "\n" : ",\n") << std::fixed << std::setprecision(1)
+                 << "    { \"group\": \"" << result.m_group << "\", \"name\": \"" << result.m_name << "\""
+                 << ", \"samples\": " << result.m_samples << ", \"ops_per_sample\": " << result.m_opsPerSample
+                 << ", \"mean\": " << result.m_mean << ", \"p50\": " << result.m_p50 << ", \"p99\": " << result.m_p99 << ", \"max\": " << result.m_max
+                 << ", \"metrics\": {";
+
+            for (size_t m = 0; m < result.m_metrics.size(); ++m)
+                json << (m == 0 ? " " : ", ") << "\"" << result.m_metrics[m].first << "\": " << result.m_metrics[m].second;
+
+            json << (result.m_metrics.empty() ? "} }" : " } }");
+        }
+
+        json << "\n  ]\n}\n";
+
+        if (m_settings.m_out.empty())
+            std::cout << json.str();
+        else
+            std::ofstream(m_settings.m_out) << json.str();
+    }
+
+    static const char* getIsaName()
+    {
+        static const char* isaNames[] = { "scalar", "SSE4.2", "AVX2" };
+        return isaNames[static_cast<int>(BatchDistance::getBestIsa())];
+    }
+
+private:
+    Settings                m_settings;
+    std::deque<CaseResult>  m_results;      // deque, so returned pointers stay valid
+
+    // nearest-rank percentile of sorted values
+    static double getPercentile(const std::vector<double>& sorted, double percentile)
+    {
+        size_t rank = static_cast<size_t>(std::ceil(percentile * sorted.size()));
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+
+    // the table goes to stderr if JSON is printed to stdout
+    void print(const CaseResult& result) const
+    {
+        std::ostream& out = m_settings.m_out.empty() ? std::cerr : std::cout;
+        out << std::left << std::setw(44) << (result.m_group + "/" + result.m_name) << std::right << std::fixed << std::setprecision(0)
+            << " p50 " << std::setw(10) << result.m_p50 << "ns  p99 " << std::setw(10) << result.m_p99
+            << "ns  max " << std::setw(10) << result.m_max << "ns  (" << result.m_samples << " samples)" << std::endl;
+    }
+};
+
+std::vector<std::string> loadWikipedia()
+{
+    std::ifstream articles = std::ifstream("../wikipedia.txt");
+    std::vector<std::string> wikipedia;
+    wikipedia.reserve(10000);
+    while (articles)
+    {
+        std::string line;
+        std::getline(articles, line);
+
+        if (!line.empty())
+            wikipedia.emplace_back(std::move(line));
+    }
+
+    return wikipedia;
+}
+
+// one or two random substitutions of random vocabulary words
+std::vector<std::string> getMisprints(const TokenArena& vocabulary, size_t count, std::mt19937& random)
+{
+    std::vector<std::string> misprints;
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::string word(vocabulary[std::uniform_int_distribution<TokenArena::Id>(0, static_cast<TokenArena::Id>(vocabulary.size() - 1))(random)]);
+        for (size_t edit = i % 2; edit < 2 && !word.empty(); ++edit)
+            word[std::uniform_int_distribution<size_t>(0, word.size() - 1)(random)] = 'a' + std::uniform_int_distribution<int>(0, 25)(random);
+
+        misprints.push_back(word);
+    }
+
+    return misprints;
+}
+
+// Wikipedia captions 'factor' times. Copies have misprints in about a third of words, so vocabulary grows with the corpus too
+std::vector<std::string> getScaledCorpus(const std::vector<std::string>& wikipedia, size_t factor, std::mt19937& random)
+{
+    std::vector<std::string> corpus(wikipedia);
+    corpus.reserve(wikipedia.size() * factor);
+    for (size_t copy = 1; copy < factor; ++copy)
+    {
+        for (std::string caption : wikipedia)
+        {
+            for (size_t begin = 0; begin < caption.size(); )
+            {
+                size_t end = std::min(caption.find(' ', begin), caption.size());
+                if (end - begin > 3 && std::uniform_int_distribution<int>(0, 2)(random) == 0)
+                    caption[begin + std::uniform_int_distribution<size_t>(0, end - begin - 1)(random)] = 'a' + std::uniform_int_distribution<int>(0, 25)(random);
+
+                begin = end + 1;
+            }
+
+            corpus.push_back(std::move(caption));
+        }
+    }
+
+    return corpus;
+}
+
+static const char k_backspace = 0x08;
+
+// Typing of wikipedia captions: up to 24 chars of each, with occasional misprints which are erased and retyped
+std::vector<std::string> generateTraces(const std::vector<std::string>& wikipedia, size_t count, std::mt19937& random)
+{
+    std::vector<std::string> traces;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const std::string& caption = wikipedia[std::uniform_int_distribution<size_t>(0, wikipedia.size() - 1)(random)];
+
+        std::string trace;
+        for (size_t c = 0; c < std::min<size_t>(caption.size(), 24); ++c)
+        {
+            if (std::uniform_int_distribution<int>(0, 9)(random) == 0)
+            {
+                trace += static_cast<char>('a' + std::uniform_int_distribution<int>(0, 25)(random));
+                trace += k_backspace;
+            }
+
+            trace += caption[c];
+        }
+
+        traces.push_back(trace);
+    }
+
+    return traces;
+}
+
+std::vector<std::string> loadTraces(const std::string& path)
+{
+    std::ifstream file(path);
+    std::vector<std::string> traces;
+    for (std::string line; std::getline(file, line); )
+        if (!line.empty())
+            traces.push_back(line);
+
+    return traces;
+}
+
+bool isBackspace(char key)
+{
+    return key == k_backspace || key == 0x7F;
+}
+
+void benchmarkKernels(Benchmark& benchmark)
+{
+    static const std::string words[] =
+    {
+        "abcdefghig",         "1_abcdefghig",         "2_abcdefghig",         "3_abcdefghig",         "4_defghig",
+        "bace",               "1_bace",               "2_bace",               "3_bace",               "4_e",
+        "abace",              "1_abace",              "2_abace",              "3_abace",              "4_ce",
+        "qwertyui",           "1_qwertyui",           "2_qwertyui",           "3_qwertyui",           "4_rtyui",
+        "zxcvbnm",            "1_zxcvbnm",            "2_zxcvbnm",            "3_zxcvbnm",            "4_vbnm",
+        "poiuytrewq",         "1_poiuytrewq",         "2_poiuytrewq",         "3_poiuytrewq",         "4_uytrewq",
+        "qazwsx",             "1_qazwsx",             "2_qazwsx",             "3_qazwsx",             "4_wsx",
+        "qazwsxedc",          "1_qazwsxedc",          "2_qazwsxedc",          "3_qazwsxedc",          "4_wsxedc",
+        "",                   "1_",                   "2_",                   "3_",                   "4_",
+        "abcdefghiabcdefghi", "1_abcdefghiabcdefghi", "2_abcdefghiabcdefghi", "3_abcdefghiabcdefghi", "4_defghiabcdefghi",
+        "defgh",              "1_defgh",              "2_defgh",              "3_defgh",              "4_gh",
+        "___defghi",          "1____defghi",          "2____defghi",          "3____defghi",          "4_defghi",
+        "_b_d_f_h_g",         "1__b_d_f_h_g",         "2__b_d_f_h_g",         "3__b_d_f_h_g",         "4_d_f_h_g",
+        "a_c_e_g_i_",         "1_a_c_e_g_i_",         "2_a_c_e_g_i_",         "3_a_c_e_g_i_",         "4__e_g_i_",
+        "acegi",              "1_acegi",              "2_acegi",              "3_acegi",              "4_gi",
+        "bacdfeghgi",         "1_bacdfeghgi",         "2_bacdfeghgi",         "3_bacdfeghgi",         "4_dfeghgi",
+        "gihgfedcba",         "1_gihgfedcba",         "2_gihgfedcba",         "3_gihgfedcba",         "4_gfedcba",
+    };
+
+    static const size_t k_wordsCount = std::size(words);
+    static const size_t k_samples    = 20000;
+
+    // a sample is the distance from one word to all of them
+    volatile unsigned doNotOptimize = 0;
+    for (bool isIncremental : { false, true })
+    {
+        std::string suffix = isIncremental ? "_incremental" : "";
+
+        benchmark.run("kernel", "osa" + suffix, k_samples, k_wordsCount, [&](size_t sample)
+        {
+            const std::string& query = words[sample % k_wordsCount];
+            for (const std::string& word : words)
+                doNotOptimize += SpellCheck::getSmartDistance(word, query, isIncremental);
+        });
+
+        benchmark.run("kernel", "osa_bounded" + suffix, k_samples, k_wordsCount, [&](size_t sample)
+        {
+            const std::string& query = words[sample % k_wordsCount];
+            for (const std::string& word : words)
+                doNotOptimize += SpellCheck::getSmartDistance(word, query, isIncremental, 2);
+        });
+
+        // the reference incremental kernel, full matrix and backtrace
+        if (isIncremental)
+        {
+            benchmark.run("kernel", "osa_backtrace_incremental", k_samples, k_wordsCount, [&](size_t sample)
+            {
+                const std::string& query = words[sample % k_wordsCount];
+                for (const std::string& word : words)
+                    doNotOptimize += SpellCheck::isIncrementalMatch(word.size(), query.size(), true) ? SpellCheck::backtraceIncrementalDistance(word, query)
+                                                                                                       : SpellCheck::getSmartDistance(word, query, true);
+            });
+        }
+
+        // the BK-tree metric
+        if (!isIncremental)
+        {
+            benchmark.run("kernel", "damerau_levenshtein", k_samples, k_wordsCount, [&](size_t sample)
+            {
+                const std::string& query = words[sample % k_wordsCount];
+                for (const std::string& word : words)
+                    doNotOptimize += SpellCheck::damerauLevenshteinDistance(word, query);
+            });
+        }
+
+        // the same distances by batches of equal-length words in SIMD lanes
+        std::vector<std::string> vocabulary(std::begin(words), std::end(words));
+        BatchDistance batches { vocabulary };
+        benchmark.run("kernel", "batch" + suffix, k_samples, k_wordsCount, [&](size_t sample)
+        {
+            const std::string& query = words[sample % k_wordsCount];
+            unsigned distances[BatchDistance::k_lanes];
+            for (size_t b = 0; b < batches.size(); ++b)
+            {
+                const BatchDistance::Batch& batch = batches[b];
+                batches.getDistances(batch, query.data(), query.size(), SpellCheck::isIncrementalMatch(batch.m_length, query.size(), isIncremental), SpellCheck::k_noLimit, distances);
+                doNotOptimize += distances[0];
+            }
+        });
+    }
+
+    // caption-sized strings of three words: full matrices don't fit into a small buffer, the workspace is reused instead
+    std::vector<std::string> longWords;
+    for (size_t i = 0; i < k_wordsCount; ++i)
+        longWords.push_back(words[i] + words[(i * 7 + 3) % k_wordsCount] + words[(i * 13 + 5) % k_wordsCount]);
+
+    benchmark.run("kernel", "damerau_levenshtein_long", k_samples / 10, k_wordsCount, [&](size_t sample)
+    {
+        const std::string& query = longWords[sample % k_wordsCount];
+        for (const std::string& word : longWords)
+            doNotOptimize += SpellCheck::damerauLevenshteinDistance(word, query);
+    });
+
+    benchmark.run("kernel", "osa_backtrace_long", k_samples / 10, k_wordsCount, [&](size_t sample)
+    {
+        const std::string& query = longWords[sample % k_wordsCount];
+        for (const std::string& word : longWords)
+            doNotOptimize += SpellCheck::backtraceIncrementalDistance(word, query);
+    });
+}
+
+void benchmarkCorrections(Benchmark& benchmark, const std::vector<std::string>& wikipedia)
+{
+    struct Engine
+    {
+        const char*         m_name;
+        SpellCheck::Options m_options;
+    };
+
+    std::vector<Engine> engines(5);
+    engines[0].m_name = "scan";
+    engines[1].m_name = "scan_no_prefilter";
+    engines[1].m_options.m_prefilters = Prefilter::eNONE;
+    engines[2].m_name = "bk_tree";
+    engines[2].m_options.m_bkTree = true;
+    engines[3].m_name = "deletion_index";
+    engines[3].m_options.m_deletionDistance = 2;
+    engines[4].m_name = "frequency_order";
+    engines[4].m_options.m_frequencyOrder = true;
+
+    for (const Engine& engine : engines)
+    {
+        if (!benchmark.isEnabled("corrections", engine.m_name))
+            continue;
+
+        auto start = Clock::now();
+        SpellCheck speller { wikipedia, &tolower, engine.m_options };
+        double buildTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        std::mt19937 random(1);
+        std::vector<std::string> queries = getMisprints(speller.getVocabulary(), 1000, random);
+        SpellCheck::TopCorrections<5> corrections;
+
+        std::string name = engine.m_name;
+        if (CaseResult* result = benchmark.run("corrections", name, 2000, 1, [&](size_t sample) { speller.getCorrections(queries[sample % queries.size()], corrections); }))
+            result->m_metrics = { { "build_ms", buildTime }, { "vocabulary", static_cast<double>(speller.getVocabulary().size()) } };
+
+        // incremental lookup always scans, indexes don't change it
+        if (engine.m_options.m_deletionDistance != 0)
+            benchmark.run("corrections", name + "_near", 2000, 1, [&](size_t sample) { speller.getNearCorrections(queries[sample % queries.size()], corrections); });
+        else if (!engine.m_options.m_bkTree)
+            benchmark.run("corrections", name + "_incremental", 2000, 1, [&](size_t sample) { speller.getCorrections(queries[sample % queries.size()], corrections, true); });
+
+        // misprints of words drawn by their frequency, as typos of a text are, stop the scan early
+        if (engine.m_options.m_frequencyOrder)
+        {
+            const TokenArena&  vocabulary = speller.getVocabulary();
+            std::vector<float> weights;
+            for (TokenArena::Id token = 0; token < vocabulary.size(); ++token)
+                weights.push_back(static_cast<float>(speller.getFrequency(token)));
+
+            std::discrete_distribution<TokenArena::Id> frequent(weights.begin(), weights.end());
+            std::vector<std::string> common;
+            for (size_t i = 0; i < 1000; ++i)
+            {
+                std::string word(vocabulary[frequent(random)]);
+                word[std::uniform_int_distribution<size_t>(0, word.size() - 1)(random)] = 'a' + std::uniform_int_distribution<int>(0, 25)(random);
+                common.push_back(word);
+            }
+
+            // the best suggestion is found once a token within distance 1 is found
+            SpellCheck::TopCorrections<1> best;
+            benchmark.run("corrections", name + "_likely", 2000, 1, [&](size_t sample) { speller.getLikelyCorrections(queries[sample % queries.size()], corrections); });
+            benchmark.run("corrections", name + "_common_best", 2000, 1, [&](size_t sample) { speller.getCorrections(common[sample % common.size()], best); });
+            benchmark.run("corrections", name + "_common_best_likely", 2000, 1, [&](size_t sample) { speller.getLikelyCorrections(common[sample % common.size()], best); });
+        }
+    }
+}
+
+// queries, which are answered by the given tier of search: prefix of a caption, a part of a caption or a misprinted word
+struct TierQueries
+{
+    std::vector<std::string> m_startsWith;
+    std::vector<std::string> m_contains;
+    std::vector<std::string> m_corrected;
+
+    TierQueries(const std::vector<std::string>& captions, const SpellCheck& speller, size_t count, std::mt19937& random)
+    {
+        while (m_startsWith.size() < count)
+        {
+            const std::string& caption = captions[std::uniform_int_distribution<size_t>(0, captions.size() - 1)(random)];
+            if (caption.size() < 12)
+                continue;
+
+            m_startsWith.push_back(caption.substr(0, std::uniform_int_distribution<size_t>(3, 8)(random)));
+            m_contains.push_back(caption.substr(std::uniform_int_distribution<size_t>(3, caption.size() - 8)(random), 5));
+        }
+
+        for (const std::string& misprint : getMisprints(speller.getVocabulary(), count * 2, random))
+            if (misprint.size() >= 5)
+                m_corrected.push_back(misprint);
+    }
+};
+
+void benchmarkSearch(Benchmark& benchmark, const IncrementalSearch& search, const std::vector<std::string>& captions)
+{
+    std::mt19937 random(2);
+    TierQueries queries(captions, search.getSpellCheck(), 500, random);
+
+    IncrementalSearch::Result results[10];
+    std::pair<const char*, const std::vector<std::string>*> tiers[] =
+    {
+        { "starts_with", &queries.m_startsWith },
+        { "contains",    &queries.m_contains },
+        { "corrected",   &queries.m_corrected },
+    };
+
+    for (const auto& tier : tiers)
+    {
+        const std::vector<std::string>& tierQueries = *tier.second;
+        benchmark.run("search", tier.first, 1000, 1, [&](size_t sample) { search.search(tierQueries[sample % tierQueries.size()], results, 10); });
+    }
+
+    // progressive search of misprints: time until starts-with results are shown, then the whole search
+    bool isFirstDelivered = false;
+    auto isStopped = [&isFirstDelivered]() { return isFirstDelivered; };
+    auto onTier    = [&isFirstDelivered](IncrementalSearch::Tier, const IncrementalSearch::Result*, size_t) { isFirstDelivered = true; };
+    benchmark.run("search", "progressive_first_tier", 1000, 1, [&](size_t sample)
+    {
+        isFirstDelivered = false;
+        search.searchProgressive(queries.m_corrected[sample % queries.m_corrected.size()], 10, isStopped, onTier);
+    });
+
+    benchmark.run("search", "progressive_corrected", 1000, 1, [&](size_t sample)
+    {
+        search.searchProgressive(queries.m_corrected[sample % queries.m_corrected.size()], 10, []() { return false; }, [](IncrementalSearch::Tier, const IncrementalSearch::Result*, size_t) {});
+    });
+}
+
+// Every keystroke of every trace is a sample: session reuses the state of the previous query, stateless search starts anew,
+// and 'cached' search serves backspaces from its query cache and narrows typed chars to candidates of the previous query
+void benchmarkReplay(Benchmark& benchmark, const IncrementalSearch& search, const IncrementalSearch& cached, const std::vector<std::string>& traces)
+{
+    size_t keystrokes = 0;
+    for (const std::string& trace : traces)
+        keystrokes += trace.size();
+
+    if (keystrokes == 0)
+        return;
+
+    IncrementalSearch::Result results[10];
+
+    size_t trace = 0;
+    size_t key   = 0;
+    IncrementalSearch::SearchSession session = search.startSession();
+    std::string query;
+
+    auto nextKey = [&]()
+    {
+        while (key == traces[trace].size())
+        {
+            trace = (trace + 1) % traces.size();
+            key   = 0;
+            session.setQuery(std::string());
+            query.clear();
+        }
+
+        return traces[trace][key++];
+    };
+
+    benchmark.run("replay", "session", keystrokes, 1, [&](size_t)
+    {
+        char c = nextKey();
+        if (isBackspace(c))
+            session.pop();
+        else
+            session.push(c);
+
+        session.search(results, 10);
+    });
+
+    for (const IncrementalSearch* stateless : { &search, &cached })
+    {
+        trace = 0;
+        key   = 0;
+        benchmark.run("replay", stateless == &search ? "stateless" : "cached", keystrokes, 1, [&](size_t)
+        {
+            char c = nextKey();
+            if (isBackspace(c))
+                query.resize(query.empty() ? 0 : query.size() - 1);
+            else
+                query += c;
+
+            stateless->search(query, results, 10);
+        });
+    }
+}
+
+void benchmarkScaling(Benchmark& benchmark, const std::vector<std::string>& wikipedia)
+{
+    std::vector<size_t> factors = benchmark.isQuick() ? std::vector<size_t> { 1, 4 } : std::vector<size_t> { 1, 4, 16 };
+    for (size_t factor : factors)
+    {
+        std::string suffix = "_x" + std::to_string(factor);
+        if (!benchmark.isEnabled("scaling", "corrections" + suffix) && !benchmark.isEnabled("scaling", "search" + suffix))
+            continue;
+
+        std::mt19937 random(3);
+        std::vector<std::string> corpus = getScaledCorpus(wikipedia, factor, random);
+
+        auto start = Clock::now();
+        IncrementalSearch search(corpus);
+        double buildTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        std::vector<std::pair<std::string, double>> metrics =
+        {
+            { "build_ms",   buildTime },
+            { "captions",   static_cast<double>(corpus.size()) },
+            { "vocabulary", static_cast<double>(search.getSpellCheck().getVocabulary().size()) },
+        };
+
+        std::vector<std::string> queries = getMisprints(search.getSpellCheck().getVocabulary(), 500, random);
+        SpellCheck::TopCorrections<5> corrections;
+        if (CaseResult* result = benchmark.run("scaling", "corrections" + suffix, 500, 1, [&](size_t sample) { search.getSpellCheck().getCorrections(queries[sample % queries.size()], corrections); }))
+            result->m_metrics = metrics;
+
+        IncrementalSearch::Result results[10];
+        if (CaseResult* result = benchmark.run("scaling", "search" + suffix, 500, 1, [&](size_t sample) { search.search(queries[sample % queries.size()], results, 10); }))
+            result->m_metrics = metrics;
+    }
+}
+
+// Wall-clock time of the whole IncrementalSearch build by SpellCheck::Options::m_buildThreads, a sample is one build
+// of the scaled corpus. Speedup is relative to the serial build, it can't exceed the count of hardware threads
+void benchmarkBuild(Benchmark& benchmark, const std::vector<std::string>& wikipedia)
+{
+    std::mt19937 random(6);
+    std::vector<std::string> corpus = getScaledCorpus(wikipedia, benchmark.isQuick() ? 1 : 4, random);
+
+    unsigned              hardware = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> counts   = { 1, 2, 4, 8 };
+    if (std::find(counts.begin(), counts.end(), hardware) == counts.end())
+        counts.push_back(hardware);
+
+    double serial = 0;
+    for (unsigned threads : counts)
+    {
+        IncrementalSearch::Options options;
+        options.m_buildThreads = threads;
+
+        CaseResult* result = benchmark.run("build", "threads_" + std::to_string(threads), 10, 1, [&](size_t) { IncrementalSearch search(corpus, options); });
+        if (result == nullptr)
+            continue;
+
+        serial = threads == 1 ? result->m_p50 : serial;
+        result->m_metrics = { { "threads", threads }, { "hardware_threads", hardware }, { "captions", static_cast<double>(corpus.size()) } };
+        if (serial != 0)
+            result->m_metrics.push_back({ "speedup", serial / result->m_p50 });
+    }
+}
+
+// Spell check of wikipedia text repeated several times, an operation is a word. Misprinted documents have a misprint
+// per 100 words, drawn from a small set as in logs. Throughput is reported as words per second
+void benchmarkDocument(Benchmark& benchmark, const std::vector<std::string>& wikipedia)
+{
+    SpellCheck speller(wikipedia, &tolower);
+
+    std::mt19937 random(5);
+    std::vector<std::string> misprints = getMisprints(speller.getVocabulary(), 200, random);
+
+    size_t      copies = benchmark.isQuick() ? 2 : 10;
+    std::string clean;
+    std::string misprinted;
+    for (size_t copy = 0; copy < copies; ++copy)
+    {
+        for (const std::string& caption : wikipedia)
+        {
+            clean += caption;
+            clean += '\n';
+
+            for (size_t begin = 0; begin < caption.size(); )
+            {
+                size_t end = std::min(caption.find(' ', begin), caption.size());
+                bool   isMisprint = std::uniform_int_distribution<int>(0, 99)(random) == 0;
+                misprinted += isMisprint ? misprints[std::uniform_int_distribution<size_t>(0, misprints.size() - 1)(random)] : caption.substr(begin, end - begin);
+                misprinted += end == caption.size() ? '\n' : ' ';
+                begin = end + 1;
+            }
+        }
+    }
+
+    DocumentCheck::Options serialOptions;
+    serialOptions.m_threads = 1;
+
+    DocumentCheck parallel(speller);
+    DocumentCheck serial(speller, serialOptions);
+
+    std::pair<const char*, const std::string*> documents[] = { { "clean", &clean }, { "misprints", &misprinted } };
+    for (const auto& document : documents)
+    {
+        size_t documentWords = parallel.check(*document.second, [](const DocumentCheck::Misspelling&) {}, &tolower).m_words;
+
+        std::pair<std::string, const DocumentCheck*> checkers[] = { { document.first, &parallel }, { std::string(document.first) + "_serial", &serial } };
+        for (const auto& checker : checkers)
+        {
+            CaseResult* result = benchmark.run("document", checker.first, 10, documentWords, [&](size_t)
+            {
+                checker.second->check(*document.second, [](const DocumentCheck::Misspelling&) {}, &tolower);
+            });
+
+            if (result != nullptr)
+                result->m_metrics = { { "words", static_cast<double>(documentWords) }, { "words_per_second", 1e9 / result->m_p50 } };
+        }
+    }
+}
+
+// Text normalization: tokenization and case folding of every caption, an operation is a caption. Accented text has every
+// 'e' replaced by U+00E9, so most SIMD blocks take the codepoint path. Scalar cases are the char by char isalnum()/tolower() loop
+void benchmarkText(Benchmark& benchmark, const std::vector<std::string>& wikipedia)
+{
+    std::vector<std::string> accented = wikipedia;
+    for (std::string& caption : accented)
+        for (size_t position = caption.find('e'); position != std::string::npos; position = caption.find('e', position + 2))
+            caption.replace(position, 1, "\xC3\xA9");
+
+    size_t bytes = 0;
+    for (const std::string& caption : wikipedia)
+        bytes += caption.size();
+
+    auto setMetrics = [bytes](CaseResult* result, size_t captions)
+    {
+        if (result != nullptr)
+            result->m_metrics = { { "megabytes_per_second", static_cast<double>(bytes) / captions * 1e3 / result->m_p50 } };
+    };
+
+    std::vector<std::string> tokens;
+    std::string              lowercase;
+    std::string              token;
+    const size_t             captions = wikipedia.size();
+
+    setMetrics(benchmark.run("text", "tokenize", 20, captions, [&](size_t)
+    {
+        for (const std::string& caption : wikipedia)
+        {
+            tokens.clear();
+            SpellCheck::tokenize(caption, tokens, utf8::Lowercase());
+        }
+    }), captions);
+
+    setMetrics(benchmark.run("text", "tokenize_scalar", 20, captions, [&](size_t)
+    {
+        for (const std::string& caption : wikipedia)
+        {
+            tokens.clear();
+            for (size_t i = 0; i <= caption.size(); ++i)
+            {
+                if (i < caption.size() && isalnum(static_cast<unsigned char>(caption[i])))
+                    token += static_cast<char>(tolower(caption[i]));
+                else if (!token.empty())
+                {
+                    tokens.push_back(token);
+                    token.clear();
+                }
+            }
+        }
+    }), captions);
+
+    setMetrics(benchmark.run("text", "tokenize_accented", 20, captions, [&](size_t)
+    {
+        for (const std::string& caption : accented)
+        {
+            tokens.clear();
+            SpellCheck::tokenize(caption, tokens, utf8::Lowercase());
+        }
+    }), captions);
+
+    setMetrics(benchmark.run("text", "lowercase", 20, captions, [&](size_t)
+    {
+        for (const std::string& caption : wikipedia)
+        {
+            lowercase.assign(caption);
+            utf8::lowercase(lowercase);
+        }
+    }), captions);
+
+    setMetrics(benchmark.run("text", "lowercase_scalar", 20, captions, [&](size_t)
+    {
+        for (const std::string& caption : wikipedia)
+        {
+            lowercase.assign(caption);
+            std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+        }
+    }), captions);
+
+    setMetrics(benchmark.run("text", "lowercase_accented", 20, captions, [&](size_t)
+    {
+        for (const std::string& caption : accented)
+        {
+            lowercase.assign(caption);
+            utf8::lowercase(lowercase);
+        }
+    }), captions);
+
+    // vocabulary build is mostly tokenization and deduplication
+    benchmark.run("text", "vocabulary", 5, 1, [&](size_t) { SpellCheck speller(wikipedia, utf8::Lowercase()); });
+    benchmark.run("text", "vocabulary_tolower", 5, 1, [&](size_t) { SpellCheck speller(wikipedia, &tolower); });
+}
+
+int main(int argc, char* argv[])
+{
+    Settings settings;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        bool        hasValue = i + 1 < argc;
+
+        if (option == "--quick")
+            settings.m_quick = true;
+        else if (option == "--out" && hasValue)
+            settings.m_out = argv[++i];
+        else if (option == "--traces" && hasValue)
+            settings.m_traces = argv[++i];
+        else if (option == "--filter" && hasValue)
+            settings.m_filter = argv[++i];
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--quick] [--out results.json] [--traces typing.txt] [--filter substring]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<std::string> wikipedia = loadWikipedia();
+    if (wikipedia.empty())
+    {
+        std::cerr << "../wikipedia.txt is not found" << std::endl;
+        return 1;
+    }
+
+    Benchmark benchmark(settings);
+    benchmarkKernels(benchmark);
+    benchmarkText(benchmark, wikipedia);
+    benchmarkCorrections(benchmark, wikipedia);
+
+    // the trie doesn't affect stateless search, sessions of the replay keep DP rows with it
+    IncrementalSearch::Options searchOptions;
+    searchOptions.m_trie = true;
+    IncrementalSearch search(wikipedia, searchOptions);
+    benchmarkSearch(benchmark, search, wikipedia);
+
+    std::mt19937 random(4);
+    std::vector<std::string> traces = settings.m_traces.empty() ? generateTraces(wikipedia, 200, random) : loadTraces(settings.m_traces);
+    IncrementalSearch::Options cacheOptions;
+    cacheOptions.m_queryCacheSize = 64;
+    IncrementalSearch cached(wikipedia, cacheOptions);
+    benchmarkReplay(benchmark, search, cached, traces);
+
+    benchmarkScaling(benchmark, wikipedia);
+    benchmarkBuild(benchmark, wikipedia);
+    benchmarkDocument(benchmark, wikipedia);
+
+    benchmark.report();
+    return 0;
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <vector>
+#include <limits>
+#include <cstdint>
+
+#include "snapshot.hpp"
+
+// Burkhard-Keller tree: an index over items of a metric space.
+// Every child is keyed by its distance to the parent, so the triangle inequality allows to skip
+// subtrees which can't contain items closer than a given radius: |distance(query, parent) - edge| <= distance(query, item)
+//
+// Items are just indices (e.g. positions in a vocabulary), the caller owns actual data and provides the metric.
+// Metric must satisfy the triangle inequality, otherwise lookup may miss items.
+class BkTree
+{
+public:
+    typedef uint32_t Item;
+
+    static const unsigned k_infinite = std::numeric_limits<unsigned>::max();
+
+    BkTree() = default;
+
+    explicit BkTree(SnapshotReader& reader)
+        : m_nodes(reader.read<Node>())
+    {}
+
+    void save(SnapshotWriter& writer) const
+    {
+        writer.write(m_nodes);
+    }
+
+    bool   empty() const { return m_nodes.empty(); }
+    size_t size() const  { return m_nodes.size(); }
+
+    // Metric: unsigned(Item, Item)
+    template <typename Metric>
+    void insert(Item item, Metric metric)
+    {
+        std::vector<Node>& nodes = m_nodes.mutate();
+        if (nodes.empty())
+        {
+            nodes.push_back(Node { item, 0, k_none, k_none });
+            return;
+        }
+
+        uint32_t current = 0;
+        for (;;)
+        {
+            unsigned distance = metric(nodes[current].m_item, item);
+            if (distance == 0)
+                return;     // duplicate
+
+            uint32_t child = nodes[current].m_firstChild;
+            while (child != k_none && nodes[child].m_edge != distance)
+                child = nodes[child].m_nextSibling;
+
+            if (child == k_none)
+            {
+                uint32_t added = static_cast<uint32_t>(nodes.size());
+                nodes.push_back(Node { item, distance, k_none, nodes[current].m_firstChild });
+                nodes[current].m_firstChild = added;
+                return;
+            }
+
+            current = child;
+        }
+    }
+
+    // DistanceTo: unsigned(Item) - distance from query to item, must be consistent with the tree metric.
+    // Visitor:    unsigned(Item, unsigned distance) - called for every item within the radius, returns the new radius.
+    // Initial radius is 'k_infinite', Visitor may shrink it as soon as it has enough results (e.g. in top-k search).
+    template <typename DistanceTo, typename Visitor>
+    void search(DistanceTo distanceTo, Visitor visit, unsigned radius = k_infinite) const
+    {
+        if (m_nodes.empty())
+            return;
+
+        std::vector<Pending> pending;
+        pending.push_back(Pending { 0, 0 });
+
+        while (!pending.empty())
+        {
+            Pending next = pending.back();
+            pending.pop_back();
+
+            if (next.m_lowerBound > radius)
+                continue;   // radius has been shrunk since the node was queued
+
+            const Node& node = m_nodes[next.m_node];
+            unsigned distance = distanceTo(node.m_item);
+            if (distance <= radius)
+                radius = visit(node.m_item, distance);
+
+            for (uint32_t child = node.m_firstChild; child != k_none; child = m_nodes[child].m_nextSibling)
+            {
+                unsigned edge = m_nodes[child].m_edge;
+                unsigned lowerBound = edge > distance ? edge - distance : distance - edge;
+                if (lowerBound <= radius)
+                    pending.push_back(Pending { child, lowerBound });
+            }
+        }
+    }
+
+private:
+    static const uint32_t k_none = std::numeric_limits<uint32_t>::max();
+
+    struct Node
+    {
+        Item     m_item;
+        unsigned m_edge;         // distance to parent
+        uint32_t m_firstChild;
+        uint32_t m_nextSibling;
+    };
+
+    struct Pending
+    {
+        uint32_t m_node;
+        unsigned m_lowerBound;
+    };
+
+    MappedArray<Node> m_nodes;
+};
@@ -0,0 +1,160 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+#include "snapshot.hpp"
+#include "stringHash.hpp"
+
+// Symmetric deletion index (SymSpell): every variant of every token with up to 'maxDistance' chars deleted is hashed
+// into a table. Two words within OSA distance 'maxDistance' share a variant: every substitution, insertion or transposition
+// is undone by deleting at most one char of each word. So a lookup hashes variants of the query and gets all tokens
+// which may be that close without scanning the vocabulary. Candidates still have to be verified: variants are shared
+// by farther words too, and only 32 bits of a hash are stored.
+// It costs a lot of memory: a word of length L has about L^maxDistance / maxDistance! variants, 8 bytes per variant.
+class DeletionIndex
+{
+public:
+    typedef uint32_t Token;
+
+    static constexpr unsigned k_maxDistance = 2;
+
+    DeletionIndex() = default;
+
+    // tokens are numbered in order of 'tokens', 'maxDistance' is 1 or 2
+    template <typename Tokens>
+    DeletionIndex(const Tokens& tokens, unsigned maxDistance)
+        : m_maxDistance(maxDistance)
+    {
+        assert(maxDistance >= 1 && maxDistance <= k_maxDistance);
+
+        // table is sized for the upper bound of variants count, duplicate variants of a token are stored once
+        size_t maxVariants = 0;
+        for (size_t i = 0; i < tokens.size(); ++i)
+            maxVariants += getMaxVariantsCount(tokens[i].size(), maxDistance);
+
+        size_t bucketCount = 1;
+        while (bucketCount * 2 < maxVariants)
+            bucketCount *= 2;
+
+        // buckets are filled by counting sort: count variants per bucket, then place them
+        std::vector<uint32_t> offsets(bucketCount + 1, 0);
+        std::vector<uint64_t> hashes;
+        for (size_t i = 0; i < tokens.size(); ++i)
+        {
+            getVariantHashes(tokens[i], maxDistance, hashes);
+            for (uint64_t hash : hashes)
+                ++offsets[(hash & (bucketCount - 1)) + 1];
+        }
+
+        for (size_t bucket = 0; bucket < bucketCount; ++bucket)
+            offsets[bucket + 1] += offsets[bucket];
+
+        assert(offsets.back() < UINT32_MAX && "entry offsets are 32-bit");
+
+        std::vector<Entry>    entries(offsets.back());
+        std::vector<uint32_t> positions(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < tokens.size(); ++i)
+        {
+            getVariantHashes(tokens[i], maxDistance, hashes);
+            for (uint64_t hash : hashes)
+                entries[positions[hash & (bucketCount - 1)]++] = Entry { static_cast<uint32_t>(hash >> 32), static_cast<Token>(i) };
+        }
+
+        m_offsets = std::move(offsets);
+        m_entries = std::move(entries);
+    }
+
+    explicit DeletionIndex(SnapshotReader& reader)
+        : m_maxDistance(reader.readValue<unsigned>())
+        , m_offsets(reader.read<uint32_t>())
+        , m_entries(reader.read<Entry>())
+    {}
+
+    void save(SnapshotWriter& writer) const
+    {
+        writer.writeValue(m_maxDistance);
+        writer.write(m_offsets);
+        writer.write(m_entries);
+    }
+
+    bool     empty() const          { return m_offsets.empty(); }
+    unsigned getMaxDistance() const { return m_maxDistance; }
+
+    size_t getMemoryUsage() const
+    {
+        return m_offsets.size() * sizeof(uint32_t) + m_entries.size() * sizeof(Entry);
+    }
+
+    // Calls 'visit(token)' for every token which may be within getMaxDistance() of 'word', including all tokens which are.
+    // The same token may be visited several times
+    template <typename Visitor>
+    void forEachCandidate(std::string_view word, Visitor visit) const
+    {
+        thread_local std::vector<uint64_t> s_hashes;
+        getVariantHashes(word, m_maxDistance, s_hashes);
+
+        size_t mask = m_offsets.size() - 2;
+        for (uint64_t hash : s_hashes)
+        {
+            size_t   bucket      = hash & mask;
+            uint32_t fingerprint = static_cast<uint32_t>(hash >> 32);
+
+            for (const Entry* entry = m_entries.data() + m_offsets[bucket]; entry != m_entries.data() + m_offsets[bucket + 1]; ++entry)
+                if (entry->m_fingerprint == fingerprint)
+                    visit(entry->m_token);
+        }
+    }
+
+private:
+    struct Entry
+    {
+        uint32_t m_fingerprint;     // high half of the variant hash, the low one selects the bucket
+        Token    m_token;
+    };
+
+    unsigned                 m_maxDistance = 0;
+    MappedArray<uint32_t>    m_offsets;      // entries of bucket B are [m_offsets[B], m_offsets[B + 1])
+    MappedArray<Entry>       m_entries;
+
+    static size_t getMaxVariantsCount(size_t size, unsigned maxDistance)
+    {
+        size_t count = 1 + size;
+        if (maxDistance > 1 && size > 1)
+            count += size * (size - 1) / 2;
+
+        return count;
+    }
+
+    // unique hashes of 'word' and of its variants with up to 'maxDistance' deleted chars
+    static void getVariantHashes(std::string_view word, unsigned maxDistance, std::vector<uint64_t>& hashes)
+    {
+        thread_local std::string s_variant;
+        s_variant.assign(word.data(), word.size());
+
+        hashes.clear();
+        addVariantHashes(s_variant, 0, maxDistance, hashes);
+
+        std::sort(hashes.begin(), hashes.end());
+        hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    }
+
+    // deletions at 'first' position and farther, so every set of deleted positions is generated once
+    static void addVariantHashes(std::string& variant, size_t first, unsigned deletions, std::vector<uint64_t>& hashes)
+    {
+        hashes.push_back(getStringHash(variant));
+        if (deletions == 0)
+            return;
+
+        for (size_t i = first; i < variant.size(); ++i)
+        {
+            char deleted = variant[i];
+            variant.erase(i, 1);
+            addVariantHashes(variant, i, deletions - 1, hashes);
+            variant.insert(variant.begin() + i, deleted);
+        }
+    }
+};
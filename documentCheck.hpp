@@ -0,0 +1,230 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+#include <istream>
+#include <unordered_map>
+#include <optional>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+
+#include "spellCheck.hpp"
+#include "stringHash.hpp"
+
+// Spell check of whole documents and logs: unknown words of a text and their corrections, in document order.
+//
+// Text is processed by batches of about Options::m_batchSize bytes, which end at token boundaries. A batch is tokenized
+// by the rules of SpellCheck::tokenize(), known words are skipped by a probe of the vocabulary hash table, and repeated
+// unknown words of the batch are looked up once: unique ones are spread over worker threads. Most words of a document
+// are known, so the scan costs about the tokenization and a hash probe per word.
+class DocumentCheck
+{
+public:
+    struct Options
+    {
+        // corrections per unknown word
+        unsigned m_maxCorrections;
+
+        // threads for corrections lookup of unknown words: 1 is serial, 0 is hardware concurrency
+        unsigned m_threads;
+
+        // bytes of text per batch, a stream is read by such blocks. Misspellings of a batch are reported once all of them are looked up
+        size_t m_batchSize;
+
+        Options() : m_maxCorrections(5), m_threads(0), m_batchSize(1 << 20) {}
+    };
+
+    // unknown word of the document
+    struct Misspelling
+    {
+        size_t                         m_offset;        // of the word in the document, bytes
+        std::string_view               m_word;          // case converted, valid during the callback only
+        const SpellCheck::Corrections& m_corrections;   // may be empty
+    };
+
+    struct Stats
+    {
+        size_t m_words        = 0;
+        size_t m_misspellings = 0;      // unknown words
+        size_t m_lookups      = 0;      // corrections lookups, i.e. unique unknown words of every batch
+    };
+
+    // 'speller' must outlive DocumentCheck
+    explicit DocumentCheck(const SpellCheck& speller, const Options& options = Options())
+        : m_speller(speller)
+        , m_options(options)
+    {
+        const TokenArena& vocabulary = speller.getVocabulary();
+
+        // open addressing with linear probing, at most half of slots are used
+        size_t slotCount = 2;
+        while (slotCount < vocabulary.size() * 2)
+            slotCount *= 2;
+
+        m_slots.assign(slotCount, Slot { 0, TokenArena::k_none });
+        for (TokenArena::Id token = 0; token < vocabulary.size(); ++token)
+        {
+            uint64_t hash = getStringHash(vocabulary[token]);
+            size_t   slot = hash & (slotCount - 1);
+            while (m_slots[slot].m_token != TokenArena::k_none)
+                slot = (slot + 1) & (slotCount - 1);
+
+            m_slots[slot] = Slot { static_cast<uint32_t>(hash >> 32), token };
+        }
+    }
+
+    // 'onMisspelling(const Misspelling&)' is called on the calling thread in document order.
+    // 'changeCase' must be the one vocabulary of the speller was built with
+    template <typename Callback, typename CaseConvertor = SpellCheck::NoCaseConversion>
+    Stats check(std::string_view text, Callback onMisspelling, CaseConvertor changeCase = CaseConvertor()) const
+    {
+        Stats stats;
+        Batch batch;
+        for (size_t begin = 0; begin < text.size(); )
+        {
+            // a token is never split between batches
+            size_t end = std::min(text.size(), begin + m_options.m_batchSize);
+            while (end < text.size() && !utf8::isSeparator(text[end]))
+                ++end;
+
+            checkBatch(text.substr(begin, end - begin), begin, batch, stats, onMisspelling, changeCase);
+            begin = end;
+        }
+
+        return stats;
+    }
+
+    // the same, 'input' is read by blocks of Options::m_batchSize
+    template <typename Callback, typename CaseConvertor = SpellCheck::NoCaseConversion>
+    Stats check(std::istream& input, Callback onMisspelling, CaseConvertor changeCase = CaseConvertor()) const
+    {
+        Stats       stats;
+        Batch       batch;
+        std::string buffer;
+        size_t      size   = 0;     // of buffer data
+        size_t      offset = 0;     // of buffer in the document
+
+        for (bool isEnd = false; !isEnd; )
+        {
+            // a token which doesn't fit into the block makes the buffer larger
+            buffer.resize(std::max(buffer.size(), size + m_options.m_batchSize));
+            input.read(&buffer[size], static_cast<std::streamsize>(m_options.m_batchSize));
+            size += static_cast<size_t>(input.gcount());
+            isEnd = !input;
+
+            // the last token or UTF-8 sequence may continue in the next block
+            size_t end = size;
+            while (!isEnd && end != 0 && !utf8::isSeparator(buffer[end - 1]))
+                --end;
+
+            checkBatch(std::string_view(buffer.data(), end), offset, batch, stats, onMisspelling, changeCase);
+
+            std::copy(buffer.begin() + end, buffer.begin() + size, buffer.begin());
+            size   -= end;
+            offset += end;
+        }
+
+        return stats;
+    }
+
+    // the same for the memory-mapped file, nothing if it's missing or empty
+    template <typename Callback, typename CaseConvertor = SpellCheck::NoCaseConversion>
+    std::optional<Stats> checkFile(const std::string& path, Callback onMisspelling, CaseConvertor changeCase = CaseConvertor()) const
+    {
+        MappedFile file(path);
+        if (!file.isGood())
+            return std::nullopt;
+
+        return check(std::string_view(file.data(), file.size()), onMisspelling, changeCase);
+    }
+
+    bool isKnown(std::string_view word) const
+    {
+        const TokenArena& vocabulary = m_speller.getVocabulary();
+
+        uint64_t hash        = getStringHash(word);
+        uint32_t fingerprint = static_cast<uint32_t>(hash >> 32);
+        size_t   mask        = m_slots.size() - 1;
+
+        for (size_t slot = hash & mask; m_slots[slot].m_token != TokenArena::k_none; slot = (slot + 1) & mask)
+            if (m_slots[slot].m_fingerprint == fingerprint && vocabulary[m_slots[slot].m_token] == word)
+                return true;
+
+        return false;
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t       m_fingerprint;   // high half of the word hash
+        TokenArena::Id m_token;         // k_none in an empty slot
+    };
+
+    // state of a batch, buffers are reused by the next one
+    struct Batch
+    {
+        std::string                                     m_word;             // case converted token
+        std::string                                     m_unknownChars;     // of unique unknown words
+        std::vector<std::string_view>                   m_unknown;          // unique unknown words, views of m_unknownChars
+        std::unordered_map<std::string_view, uint32_t>  m_unknownIds;       // positions in m_unknown
+        std::vector<std::pair<size_t, uint32_t>>        m_occurrences;      // document offset and position in m_unknown
+        std::vector<SpellCheck::Corrections>            m_corrections;      // of m_unknown
+    };
+
+    const SpellCheck& m_speller;
+    Options           m_options;
+    std::vector<Slot> m_slots;      // vocabulary hash table, power of two size
+
+    template <typename Callback, typename CaseConvertor>
+    void checkBatch(std::string_view text, size_t offset, Batch& batch, Stats& stats, Callback& onMisspelling, CaseConvertor& changeCase) const
+    {
+        batch.m_unknownChars.clear();
+        batch.m_unknownChars.reserve(text.size());      // views of m_unknownChars stay valid: words are never longer than text
+        batch.m_unknown.clear();
+        batch.m_unknownIds.clear();
+        batch.m_occurrences.clear();
+
+        utf8::forEachToken(text, [&](size_t begin, size_t end)
+        {
+            batch.m_word.assign(text.data() + begin, end - begin);
+            SpellCheck::applyCase(batch.m_word, changeCase);
+
+            ++stats.m_words;
+            if (isKnown(batch.m_word))
+                return;
+
+            ++stats.m_misspellings;
+            auto found = batch.m_unknownIds.find(batch.m_word);
+            if (found == batch.m_unknownIds.end())
+            {
+                size_t start = batch.m_unknownChars.size();
+                batch.m_unknownChars += batch.m_word;
+
+                std::string_view word(batch.m_unknownChars.data() + start, batch.m_word.size());
+                found = batch.m_unknownIds.emplace(word, static_cast<uint32_t>(batch.m_unknown.size())).first;
+                batch.m_unknown.push_back(word);
+            }
+
+            batch.m_occurrences.emplace_back(offset + begin, found->second);
+        });
+
+        // unique words are taken by threads one by one, because lookup time varies a lot
+        size_t unknownCount = batch.m_unknown.size();
+        size_t threadCount  = m_options.m_threads != 0 ? m_options.m_threads : std::max(1u, std::thread::hardware_concurrency());
+        stats.m_lookups += unknownCount;
+
+        batch.m_corrections.resize(unknownCount);
+        std::atomic<size_t> next(0);
+        AsyncExecutor()(std::min(threadCount, unknownCount), [this, &batch, &next, unknownCount](size_t)
+        {
+            for (size_t i = next++; i < unknownCount; i = next++)
+                batch.m_corrections[i] = m_speller.getCorrections(batch.m_unknown[i], m_options.m_maxCorrections);
+        });
+
+        for (const std::pair<size_t, uint32_t>& occurrence : batch.m_occurrences)
+            onMisspelling(Misspelling { occurrence.first, batch.m_unknown[occurrence.second], batch.m_corrections[occurrence.second] });
+    }
+};
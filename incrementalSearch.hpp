@@ -1,10 +1,18 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <string_view>
 #include <algorithm>
-#include <cctype>
+#include <memory>
+#include <optional>
 
 #include "spellCheck.hpp"
+#include "trigramIndex.hpp"
+#include "postingLists.hpp"
+#include "stringTable.hpp"
+#include "snapshot.hpp"
+#include "queryCache.hpp"
+#include "utf8.hpp"
 
 
 class IncrementalSearch
@@ -12,108 +20,748 @@ class IncrementalSearch
 public:
     typedef std::vector<std::string> Strings;
 
+    // Search result without copying: position of the item in the original text and a view of it.
+    // View refers to IncrementalSearch, so it's valid while IncrementalSearch is alive
+    struct Result
+    {
+        size_t           m_index;
+        std::string_view m_text;
+    };
+
+    // Results are items starting with the query, then containing it, then containing its best corrections
+    enum Tier
+    {
+        eSTARTS_WITH,
+        eCONTAINS,
+        eCORRECTED,
+        eTIERS_COUNT
+    };
+
+    // spell checking options and own indexes
+    struct Options : SpellCheck::Options
+    {
+        // Build trigram index over lowercase text, so "contains" lookup verifies only candidate items instead of all of them.
+        // It takes about 4 bytes per text char
+        bool m_substringIndex;
+
+        // Build posting lists of items per vocabulary token and trigram index over vocabulary, so lookup of items
+        // containing corrections verifies only items which have tokens containing corrections
+        bool m_correctionIndex;
+
+        // Keep results of this many recent queries, 0 is no cache. Repeated queries (e.g. after backspace) are served
+        // from the cache, and a query extending a cached one checks only items containing that one, see QueryCache
+        size_t m_queryCacheSize;
+
+        Options(const SpellCheck::Options& spellCheckOptions = SpellCheck::Options())
+            : SpellCheck::Options(spellCheckOptions)
+            , m_substringIndex(true)
+            , m_correctionIndex(true)
+            , m_queryCacheSize(0)
+        {}
+    };
+
+    // Items are UTF-8, queries and items are lowercased by utf8::lowercase()
     template <typename StringsArray>
-    explicit IncrementalSearch(const StringsArray& text)
-        : m_spellCheck(text, &tolower)
+    explicit IncrementalSearch(const StringsArray& text, const Options& options = Options())
+        : m_spellCheck(text, utf8::Lowercase(), options)
     {
-        m_text.reserve(std::size(text));
+        // items are copied and lowercased by shards, see SpellCheck::Options::m_buildThreads
+        size_t  textSize   = std::size(text);
+        size_t  shardCount = parallelBuild::getShardCount(options.m_buildThreads, textSize);
+        Strings items(textSize);
+        Strings itemsLowercase(textSize);
 
-        std::string item;
-        for (const auto& textItem : text)
+        AsyncExecutor()(shardCount, [&](size_t shard)
         {
-            item = textItem;
-            m_text.push_back(item);
+            size_t first = parallelBuild::getShardBegin(textSize, shardCount, shard);
+            size_t last  = parallelBuild::getShardBegin(textSize, shardCount, shard + 1);
+
+            for (auto textItem = std::next(std::begin(text), first); first != last; ++textItem, ++first)
+            {
+                items[first] = *textItem;
+                itemsLowercase[first] = toLowercase(items[first]);
+            }
+        });
+
+        m_text          = StringTable(items);
+        m_textLowercase = StringTable(itemsLowercase);
+
+        if (options.m_substringIndex)
+            m_substringIndex = TrigramIndex(m_textLowercase, options.m_buildThreads);
+
+        if (options.m_correctionIndex)
+            buildCorrectionIndex(options.m_buildThreads);
 
-            std::transform(item.begin(), item.end(), item.begin(), [](char c) { return tolower(c); });
-            m_textLowercase.push_back(item);
+        if (options.m_queryCacheSize != 0)
+            m_cache = std::make_unique<QueryCache>(options.m_queryCacheSize);
+    }
+
+    Strings search(std::string substring, size_t maxCount = 10) const
+    {
+        queryStats::Scope scope;
+        if (m_cache != nullptr)
+        {
+            std::vector<Result> results(maxCount);
+            results.resize(search(substring, results.data(), maxCount));
+            return toStrings(results);
         }
+
+        substring = toLowercase(std::move(substring));
+
+        queryStats::Timer timer;
+        SpellCheck::Corrections corrections = getCorrections(substring);
+        timer.next(&QueryStats::m_correctionsNanoseconds);
+
+        return toStrings(findResults(substring, corrections, maxCount));
     }
 
-    Strings search(std::string substring, size_t maxCount = 10)
+    // Allocation-free search: the same results as search() are written into caller-owned 'results' of 'maxCount' items,
+    // the count of results is returned. Heap is not touched once thread-local buffers have grown to the query size.
+    size_t search(std::string_view substring, Result* results, size_t maxCount) const
     {
-        Strings resultsStart;
-        Strings resultsContain;
-        Strings resultsCorrected;
+        queryStats::Scope scope;
 
-        std::transform(substring.begin(), substring.end(), substring.begin(), [](char c) { return tolower(c); });
+        thread_local std::string s_lowercase;
+        s_lowercase.assign(substring.data(), substring.size());
+        utf8::lowercase(s_lowercase);
 
-        resultsStart.reserve(maxCount);
-        resultsContain.reserve(maxCount);
-        resultsCorrected.reserve(maxCount);
+        if (m_cache != nullptr)
+            return searchCached(s_lowercase, results, maxCount);
 
-        auto     corrections  = getCorrections(substring);
-        unsigned minMisprints = corrections.empty() ? 0 : corrections.front().m_distance;
-        auto firstBad = std::find_if(corrections.begin(), corrections.end(), [minMisprints](const SpellCheck::Correction& c) { return c.m_distance > minMisprints; });
-        corrections.resize(std::distance(corrections.begin(), firstBad));
+        queryStats::Timer timer;
+        SpellCheck::TopCorrections<k_maxCorrections> corrections;
+        m_spellCheck.getCorrections(s_lowercase, corrections, true);
+        timer.next(&QueryStats::m_correctionsNanoseconds);
+
+        return findResults(s_lowercase, corrections, results, maxCount);
+    }
+
+    // The same, 'stats' of this query are returned too. They are zero unless INCREMENTAL_SEARCH_STATS is defined, see queryStats.hpp
+    size_t search(std::string_view substring, Result* results, size_t maxCount, QueryStats& stats) const
+    {
+        queryStats::Scope scope;
+        size_t count = search(substring, results, maxCount);
+        stats = scope.get();
+        return count;
+    }
+
+    // Progressive search: the same results as search(), but every tier is delivered as soon as it's found, so the cheap ones
+    // don't wait for the corrections lookup. 'onTier(tier, results, count)' is called for eSTARTS_WITH, eCONTAINS and eCORRECTED
+    // in turn with all results found so far, in their final order. Once results are full, next tiers are not searched at all.
+    // 'isStopped()' is polled before every tier and between chunks of the corrections lookup: the search is abandoned then
+    // and false is returned. See AsyncSearch
+    template <typename StopCondition, typename Callback>
+    bool searchProgressive(std::string_view substring, size_t maxCount, const StopCondition& isStopped, Callback onTier) const
+    {
+        queryStats::Scope scope;
+
+        std::string             lowercase = toLowercase(std::string(substring));
+        std::vector<Result>     results(maxCount);
+        SpellCheck::Corrections corrections;    // none until the last tier
+        size_t                  count = 0;
 
-        for (size_t i = 0; i < m_textLowercase.size() && resultsStart.size() < maxCount; ++i)
+        for (Tier tier : { eSTARTS_WITH, eCONTAINS, eCORRECTED })
         {
-            const std::string& lowercaseText = m_textLowercase[i];
-            if (isStartsWith(lowercaseText, substring))
-            {
-                resultsStart.push_back(m_text[i]);
-            }
-            else if (resultsContain.size() < maxCount && isContains(lowercaseText, substring))
-            {
-                resultsContain.push_back(m_text[i]);
-            }
-            else if (resultsContain.size() < maxCount && resultsCorrected.size() < maxCount)
+            if (isStopped())
+                return false;
+
+            // items of next tiers are appended, so full results are final
+            if (count < maxCount)
             {
-                for (const SpellCheck::Correction& correction : corrections)
+                if (tier == eCORRECTED)
                 {
-                    const std::string& corrected = *correction.m_word;
-                    if (isContains(lowercaseText, corrected))
-                    {
-                        resultsCorrected.push_back(m_text[i]);
-                        break;
-                    }
+                    queryStats::Timer timer;
+                    corrections = m_spellCheck.getCorrectionsParallel(lowercase, k_maxCorrections, true, k_correctionChunks, StoppableExecutor<StopCondition> { isStopped });
+                    timer.next(&QueryStats::m_correctionsNanoseconds);
+
+                    // corrections of skipped chunks are missing
+                    if (isStopped())
+                        return false;
                 }
-            }
-        }
 
-        Strings results;
-        results.reserve(resultsStart.size() + resultsContain.size() + resultsCorrected.size());
-        std::copy(resultsStart.begin(), resultsStart.end(), std::back_inserter(results));
-        std::copy(resultsContain.begin(), resultsContain.end(), std::back_inserter(results));
-        std::copy(resultsCorrected.begin(), resultsCorrected.end(), std::back_inserter(results));
+                FoundResults state;
+                findResults(lowercase, corrections, results.data(), maxCount, state, AllItems(), nullptr, tier);
+                count = state.m_tierEnds[eCORRECTED];
+            }
 
-        if (results.size() > maxCount)
-            results.resize(maxCount);
+            onTier(tier, results.data(), count);
+        }
 
-        return results;
+        return true;
     }
 
-    SpellCheck::Corrections getCorrections(const std::string& word)
+    SpellCheck::Corrections getCorrections(const std::string& word) const
     {
-        static const unsigned MAX_COUNT = 5;
-        return m_spellCheck.getCorrections(word, MAX_COUNT, true);
+        return m_spellCheck.getCorrections(word, k_maxCorrections, true);
     }
 
+    // Keystroke-by-keystroke search: reuses spell checking DP state of the previous query, so the cost
+    // of the correction lookup doesn't grow with query length. Results are the same as search(getQuery()).
+    // The state is kept with SpellCheck::Options::m_trie only, otherwise every keystroke is a stateless lookup.
+    // A keystroke computes a row over the whole trie, so stateless search() with prefilters is usually faster, see the replay benchmark.
+    // Session refers to IncrementalSearch, so it must not outlive (or be moved from) IncrementalSearch.
+    class SearchSession
+    {
+    public:
+        explicit SearchSession(const IncrementalSearch& search)
+            : m_search(&search)
+            , m_corrections(search.m_spellCheck)
+        {}
+
+        const std::string& getQuery() const { return m_corrections.getQuery(); }
+
+        void pop()                              { m_corrections.pop(); }
+        void setQuery(const std::string& query) { m_corrections.setQuery(toLowercase(query)); }
+
+        // a char may be a part of UTF-8 sequence, which is folded once it's complete: the lead byte may change then
+        void push(char c)
+        {
+            m_folded.assign(getQuery());
+            m_folded += c;
+            utf8::lowercase(m_folded);
+            m_corrections.setQuery(m_folded);
+        }
+
+        Strings search(size_t maxCount = 10) const
+        {
+            queryStats::Scope scope;
+            queryStats::Timer timer;
+            SpellCheck::Corrections corrections = getCorrections();
+            timer.next(&QueryStats::m_correctionsNanoseconds);
+
+            return m_search->toStrings(m_search->findResults(getQuery(), corrections, maxCount));
+        }
+
+        // see IncrementalSearch::search(std::string_view, Result*, size_t)
+        size_t search(Result* results, size_t maxCount) const
+        {
+            queryStats::Scope scope;
+            queryStats::Timer timer;
+            SpellCheck::TopCorrections<k_maxCorrections> corrections;
+            m_corrections.getCorrections(corrections, true);
+            timer.next(&QueryStats::m_correctionsNanoseconds);
+
+            return m_search->findResults(getQuery(), corrections, results, maxCount);
+        }
+
+        SpellCheck::Corrections getCorrections() const
+        {
+            return m_corrections.getCorrections(k_maxCorrections, true);
+        }
+
+    private:
+        const IncrementalSearch* m_search;
+        SpellCheck::Session      m_corrections;
+        std::string              m_folded;          // buffer of push()
+    };
+
+    SearchSession startSession() const { return SearchSession(*this); }
+
     const SpellCheck& getSpellCheck() const { return m_spellCheck; }
 
+    // Write text and all indexes into the snapshot file, see loadSnapshot()
+    bool saveSnapshot(const std::string& path) const
+    {
+        SnapshotWriter writer(path);
+        m_text.save(writer);
+        m_textLowercase.save(writer);
+        m_spellCheck.save(writer);
+        m_substringIndex.save(writer);
+        m_tokenIndex.save(writer);
+        m_tokenItems.save(writer);
+
+        return writer.isGood();
+    }
+
+    // Search over the memory-mapped snapshot: nothing is parsed or rebuilt, arrays are used right from the mapped pages,
+    // so startup doesn't depend on the text size and pages are shared between processes which load the same snapshot.
+    // Returns nothing if the file is missing or it's not a snapshot of this version.
+    // Query cache is not a part of the snapshot, see Options::m_queryCacheSize
+    static std::optional<IncrementalSearch> loadSnapshot(const std::string& path, size_t queryCacheSize = 0)
+    {
+        auto file = std::make_shared<const MappedFile>(path);
+        SnapshotReader reader(file->data(), file->size());
+
+        IncrementalSearch search(reader, file);
+        if (!reader.isGood() || !reader.isAtEnd())
+            return std::nullopt;
+
+        if (queryCacheSize != 0)
+            search.m_cache = std::make_unique<QueryCache>(queryCacheSize);
+
+        return std::optional<IncrementalSearch>(std::move(search));
+    }
+
     IncrementalSearch(IncrementalSearch&& right)
-        : m_text(std::move(right.m_text))
+        : m_snapshot(std::move(right.m_snapshot))
+        , m_text(std::move(right.m_text))
         , m_textLowercase(std::move(right.m_textLowercase))
         , m_spellCheck(std::move(right.m_spellCheck))
+        , m_substringIndex(std::move(right.m_substringIndex))
+        , m_tokenIndex(std::move(right.m_tokenIndex))
+        , m_tokenItems(std::move(right.m_tokenItems))
+        , m_cache(std::move(right.m_cache))
     {}
 
 private:
-    Strings    m_text;
-    Strings    m_textLowercase;
-    SpellCheck m_spellCheck;
+    friend class LiveSearch;    // searches over several IncrementalSearch instances at once
+
+    static const unsigned k_maxCorrections = 5;
+
+    // searchProgressive() may be stopped between chunks of the vocabulary scan
+    static const unsigned k_correctionChunks = 16;
+
+    // runs chunks one by one on the calling thread, the rest of them are skipped once 'm_isStopped()'
+    template <typename StopCondition>
+    struct StoppableExecutor
+    {
+        const StopCondition& m_isStopped;
+
+        template <typename Task>
+        void operator()(size_t taskCount, const Task& task) const
+        {
+            for (size_t i = 0; i < taskCount && !m_isStopped(); ++i)
+                task(i);
+        }
+    };
+
+    std::shared_ptr<const MappedFile> m_snapshot;      // memory of the rest members, if they are loaded from snapshot
+
+    StringTable  m_text;
+    StringTable  m_textLowercase;
+    SpellCheck   m_spellCheck;
+    TrigramIndex m_substringIndex;
+    TrigramIndex m_tokenIndex;          // over vocabulary
+    PostingLists m_tokenItems;          // items per vocabulary token
+
+    std::unique_ptr<QueryCache> m_cache;    // optional, see Options::m_queryCacheSize
+
+    // too large candidate sets are not cached: short queries match most of items, and their extensions are narrowed by trigrams anyway
+    static const size_t k_maxCachedCandidatesShare = 8;
+
+    // members are read in order of saveSnapshot()
+    IncrementalSearch(SnapshotReader& reader, std::shared_ptr<const MappedFile> snapshot)
+        : m_snapshot(std::move(snapshot))
+        , m_text(reader)
+        , m_textLowercase(reader)
+        , m_spellCheck(reader)
+        , m_substringIndex(reader)
+        , m_tokenIndex(reader)
+        , m_tokenItems(reader)
+    {}
 
     IncrementalSearch(const IncrementalSearch&)            = delete;
     IncrementalSearch& operator=(const IncrementalSearch&) = delete;
 
-    bool isStartsWith(const std::string& string, const std::string& substr)
+    void buildCorrectionIndex(unsigned threads)
+    {
+        const TokenArena& vocabulary = m_spellCheck.getVocabulary();
+        m_tokenIndex = TrigramIndex(vocabulary, threads);
+
+        // items are tokenized the same way as SpellCheck vocabulary, so every token is found
+        typedef std::vector<std::pair<PostingLists::Key, PostingLists::Item>> Pairs;
+
+        size_t shardCount = parallelBuild::getShardCount(threads, m_textLowercase.size());
+        std::vector<Pairs> shards(shardCount);
+        AsyncExecutor()(shardCount, [this, &vocabulary, &shards, shardCount](size_t shard)
+        {
+            std::vector<std::string> tokens;
+            size_t last = parallelBuild::getShardBegin(m_textLowercase.size(), shardCount, shard + 1);
+            for (size_t i = parallelBuild::getShardBegin(m_textLowercase.size(), shardCount, shard); i < last; ++i)
+            {
+                tokens.clear();
+                SpellCheck::tokenize(m_textLowercase[i], tokens);
+
+                for (const std::string& token : tokens)
+                {
+                    TokenArena::Id found = vocabulary.find(token);
+                    assert(found != TokenArena::k_none);
+                    shards[shard].emplace_back(found, static_cast<PostingLists::Item>(i));
+                }
+            }
+        });
+
+        Pairs pairs = std::move(shards[0]);
+        for (size_t shard = 1; shard < shardCount; ++shard)
+            pairs.insert(pairs.end(), shards[shard].begin(), shards[shard].end());
+
+        m_tokenItems = PostingLists(pairs, vocabulary.size(), threads);
+    }
+
+    static std::string toLowercase(std::string text)
+    {
+        utf8::lowercase(text);
+        return text;
+    }
+
+    template <typename Corrections>
+    std::vector<Result> findResults(std::string_view substring, const Corrections& corrections, size_t maxCount) const
+    {
+        std::vector<Result> results(maxCount);
+        results.resize(findResults(substring, corrections, results.data(), maxCount));
+        return results;
+    }
+
+    // 'substring' is lowercase, 'corrections' are for 'substring' and sorted by distance.
+    // Results are items starting with 'substring', then containing it, then containing its best corrections.
+    // Every tier is limited by 'maxCount' and so is the whole list.
+    template <typename Corrections>
+    size_t findResults(std::string_view substring, const Corrections& corrections, Result* results, size_t maxCount) const
+    {
+        FoundResults state;
+        findResults(substring, corrections, results, maxCount, state, AllItems());
+        return state.m_tierEnds[eCORRECTED];
+    }
+
+    // results found so far, items of the next findResults() call are appended as if they follow already searched ones
+    struct FoundResults
+    {
+        size_t m_found[eTIERS_COUNT]    = {};   // including ones which don't fit into results
+        size_t m_tierEnds[eTIERS_COUNT] = {};   // tiers are stored in place, in the final order
+    };
+
+    // Items filter: isSkipped(i) items are not searched, getIndex(i) is reported as Result::m_index
+    struct AllItems
+    {
+        bool   isSkipped(size_t) const     { return false; }
+        size_t getIndex(size_t item) const { return item; }
+    };
+
+    // 'containing', if any, are all items containing 'substring' in ascending order, e.g. ones from QueryCache.
+    // Tiers past 'lastTier' are not searched
+    template <typename Corrections, typename Items>
+    void findResults(std::string_view substring, const Corrections& corrections, Result* results, size_t maxCount, FoundResults& state, const Items& items,
+                     const std::vector<QueryCache::Item>* containing = nullptr, Tier lastTier = eCORRECTED) const
+    {
+        unsigned minMisprints = corrections.empty() ? 0 : corrections.front().m_distance;
+
+        size_t (&found)[eTIERS_COUNT]    = state.m_found;
+        size_t (&tierEnds)[eTIERS_COUNT] = state.m_tierEnds;
+
+        auto isCorrectedNeeded = [&found, maxCount, lastTier]() { return lastTier == eCORRECTED && found[eCONTAINS] < maxCount && found[eCORRECTED] < maxCount; };
+
+        // 'mayContain' and 'mayBeCorrected' are false if the item is known to not contain 'substring' or corrections
+        auto addItem = [&](size_t i, bool mayContain, bool mayBeCorrected)
+        {
+            if (items.isSkipped(i))
+                return;
+
+            std::string_view lowercaseText = m_textLowercase[i];
+            Tier tier = eTIERS_COUNT;
+
+            // every check is timed, when stats are enabled
+            queryStats::Timer timer;
+            if (mayContain && isStartsWith(lowercaseText, substring))
+                tier = eSTARTS_WITH;
+
+            timer.next(&QueryStats::m_startsWithNanoseconds);
+            if (tier == eTIERS_COUNT && mayContain && lastTier != eSTARTS_WITH && found[eCONTAINS] < maxCount && isContains(lowercaseText, substring))
+                tier = eCONTAINS;
+
+            timer.next(&QueryStats::m_containsNanoseconds);
+            if (tier == eTIERS_COUNT && mayBeCorrected && isCorrectedNeeded() && isContainsCorrection(lowercaseText, corrections, minMisprints))
+                tier = eCORRECTED;
+
+            timer.next(&QueryStats::m_correctedNanoseconds);
+
+            if (tier != eTIERS_COUNT)
+            {
+                ++found[tier];
+                insertResult(results, maxCount, tierEnds, tier, Result { items.getIndex(i), m_text[i] });
+            }
+        };
+
+        queryStats::Timer timer;
+        CorrectedCandidates corrected = findCorrectedCandidates(corrections, minMisprints, isCorrectedNeeded());
+        timer.next(&QueryStats::m_correctedNanoseconds);
+
+        if (containing == nullptr && !m_substringIndex.isSupported(substring))
+        {
+            for (size_t i = 0; i < m_textLowercase.size() && found[eSTARTS_WITH] < maxCount; ++i)
+                addItem(i, true, corrected.skipTo(i));
+
+            return;
+        }
+
+        // only candidates may contain 'substring', other items are checked for corrections while it's needed
+        auto addCorrectedUntil = [&](size_t end)
+        {
+            for (; !corrected.isEnd() && *corrected < end && isCorrectedNeeded(); corrected.next())
+                addItem(*corrected, false, true);
+        };
+
+        auto addCandidate = [&](TrigramIndex::Item item)
+        {
+            addCorrectedUntil(item);
+
+            bool isCorrectedCandidate = corrected.skipTo(item);
+            addItem(item, true, isCorrectedCandidate);
+            if (isCorrectedCandidate)
+                corrected.next();
+
+            return found[eSTARTS_WITH] < maxCount;
+        };
+
+        if (containing != nullptr)
+        {
+            for (QueryCache::Item item : *containing)
+                if (!addCandidate(item))
+                    break;
+        }
+        else
+            m_substringIndex.forEachCandidate(substring, addCandidate);
+
+        if (found[eSTARTS_WITH] < maxCount)
+            addCorrectedUntil(m_textLowercase.size());
+    }
+
+    // search() through the query cache: a repeated query is served from it, an extended one checks only items containing its prefix
+    size_t searchCached(const std::string& query, Result* results, size_t maxCount) const
+    {
+        QueryCache::EntryPtr cached = m_cache->find(query);
+        if (cached != nullptr && cached->m_maxCount == maxCount)
+        {
+            for (size_t i = 0; i < cached->m_results.size(); ++i)
+                results[i] = Result { cached->m_results[i], m_text[cached->m_results[i]] };
+
+            return cached->m_results.size();
+        }
+
+        queryStats::Timer timer;
+        SpellCheck::TopCorrections<k_maxCorrections> corrections;
+        m_spellCheck.getCorrections(query, corrections, true);
+        timer.next(&QueryStats::m_correctionsNanoseconds);
+
+        auto entry = std::make_shared<QueryCache::Entry>();
+        entry->m_query    = query;
+        entry->m_maxCount = maxCount;
+
+        // results for another count of the same query have the same candidates
+        if (cached != nullptr && cached->m_hasCandidates)
+        {
+            entry->m_hasCandidates = true;
+            entry->m_candidates    = cached->m_candidates;
+        }
+        else
+        {
+            entry->m_hasCandidates = findContaining(query, m_cache->findPrefix(query), entry->m_candidates);
+        }
+
+        FoundResults state;
+        findResults(query, corrections, results, maxCount, state, AllItems(), entry->m_hasCandidates ? &entry->m_candidates : nullptr);
+
+        size_t count = state.m_tierEnds[eCORRECTED];
+        for (size_t i = 0; i < count; ++i)
+            entry->m_results.push_back(static_cast<QueryCache::Item>(results[i].m_index));
+
+        m_cache->insert(std::move(entry));
+        return count;
+    }
+
+    // All items containing 'query': ones of 'prefix' candidates or of trigram index candidates which really contain it.
+    // False if they can't be found without the full scan or if there are too many of them to keep
+    bool findContaining(std::string_view query, const QueryCache::EntryPtr& prefix, std::vector<QueryCache::Item>& items) const
+    {
+        auto addIfContains = [this, query, &items](QueryCache::Item item)
+        {
+            if (isContains(m_textLowercase[item], query))
+                items.push_back(item);
+
+            return true;
+        };
+
+        if (prefix != nullptr)
+            std::for_each(prefix->m_candidates.begin(), prefix->m_candidates.end(), addIfContains);
+        else if (m_substringIndex.isSupported(query))
+            m_substringIndex.forEachCandidate(query, addIfContains);
+        else
+            return false;
+
+        if (items.size() > m_textLowercase.size() / k_maxCachedCandidatesShare)
+        {
+            std::vector<QueryCache::Item>().swap(items);
+            return false;
+        }
+
+        return true;
+    }
+
+    // Ascending items which may contain corrections: either all items, or a merge of posting lists of tokens containing corrections.
+    // The merge heap is borrowed from the caller thread, see findCorrectedCandidates()
+    class CorrectedCandidates
+    {
+    public:
+        // all items [0, size)
+        explicit CorrectedCandidates(size_t size)
+            : m_heap(nullptr)
+            , m_item(0)
+            , m_size(size)
+        {}
+
+        // merge of 'heap' cursors
+        explicit CorrectedCandidates(std::vector<PostingLists::Cursor>& heap)
+            : m_heap(&heap)
+            , m_item(0)
+            , m_size(0)
+        {
+            std::make_heap(m_heap->begin(), m_heap->end(), &isGreater);
+        }
+
+        bool isEnd() const
+        {
+            return m_heap != nullptr ? m_heap->empty() : m_item >= m_size;
+        }
+
+        size_t operator*() const
+        {
+            return m_heap != nullptr ? *m_heap->front() : m_item;
+        }
+
+        void next()
+        {
+            if (m_heap == nullptr)
+            {
+                ++m_item;
+                return;
+            }
+
+            // the same item may be in lists of several tokens
+            PostingLists::Item current = *m_heap->front();
+            while (!m_heap->empty() && *m_heap->front() == current)
+            {
+                std::pop_heap(m_heap->begin(), m_heap->end(), &isGreater);
+                m_heap->back().next();
+
+                if (m_heap->back().isEnd())
+                    m_heap->pop_back();
+                else
+                    std::push_heap(m_heap->begin(), m_heap->end(), &isGreater);
+            }
+        }
+
+        // skip items less than 'item' and tell whether 'item' is a candidate
+        bool skipTo(size_t item)
+        {
+            if (m_heap == nullptr)
+                m_item = std::max(m_item, item);
+
+            while (!isEnd() && **this < item)
+                next();
+
+            return !isEnd() && **this == item;
+        }
+
+    private:
+        std::vector<PostingLists::Cursor>* m_heap;
+        size_t                             m_item;
+        size_t                             m_size;
+
+        static bool isGreater(const PostingLists::Cursor& left, const PostingLists::Cursor& right) { return *left > *right; }
+    };
+
+    // Items containing a correction are items having a token which contains the correction: corrections are vocabulary tokens,
+    // so they can't span several tokens of an item. Merge of too many posting lists is not worth it, all items are scanned then
+    template <typename Corrections>
+    CorrectedCandidates findCorrectedCandidates(const Corrections& corrections, unsigned minMisprints, bool isNeeded) const
+    {
+        if (!isNeeded || corrections.empty())
+            return CorrectedCandidates(0);
+
+        if (m_tokenItems.empty())
+            return CorrectedCandidates(m_textLowercase.size());
+
+        const TokenArena& vocabulary = m_spellCheck.getVocabulary();
+
+        thread_local std::vector<TrigramIndex::Item> s_tokens;
+        s_tokens.clear();
+
+        for (const SpellCheck::Correction& correction : corrections)
+        {
+            if (correction.m_distance > minMisprints)
+                break;
+
+            std::string_view corrected = correction.m_word;
+            if (!m_tokenIndex.isSupported(corrected))
+                return CorrectedCandidates(m_textLowercase.size());
+
+            m_tokenIndex.forEachCandidate(corrected, [&](TrigramIndex::Item token)
+            {
+                if (isContains(vocabulary[token], corrected))
+                    s_tokens.push_back(token);
+
+                return true;
+            });
+        }
+
+        std::sort(s_tokens.begin(), s_tokens.end());
+        s_tokens.erase(std::unique(s_tokens.begin(), s_tokens.end()), s_tokens.end());
+
+        size_t postingsCount = 0;
+        for (TrigramIndex::Item token : s_tokens)
+            postingsCount += m_tokenItems.getSize(token);
+
+        if (postingsCount > m_textLowercase.size())
+            return CorrectedCandidates(m_textLowercase.size());
+
+        thread_local std::vector<PostingLists::Cursor> s_heap;
+        s_heap.clear();
+        for (TrigramIndex::Item token : s_tokens)
+            if (m_tokenItems.getSize(token) != 0)
+                s_heap.push_back(m_tokenItems.getItems(token));
+
+        return CorrectedCandidates(s_heap);
+    }
+
+    // whether 'lowercaseText' contains any of corrections with 'minMisprints' distance
+    template <typename Corrections>
+    static bool isContainsCorrection(std::string_view lowercaseText, const Corrections& corrections, unsigned minMisprints)
+    {
+        for (const SpellCheck::Correction& correction : corrections)
+        {
+            if (correction.m_distance > minMisprints)
+                break;
+
+            if (isContains(lowercaseText, correction.m_word))
+                return true;
+        }
+
+        return false;
+    }
+
+    // append to the end of 'tier', items of next tiers are shifted and ones past 'maxCount' are dropped
+    static void insertResult(Result* results, size_t maxCount, size_t (&tierEnds)[eTIERS_COUNT], Tier tier, const Result& result)
+    {
+        size_t position = tierEnds[tier];
+        if (position >= maxCount)
+            return;
+
+        size_t last = std::min(tierEnds[eCORRECTED], maxCount - 1);
+        std::copy_backward(results + position, results + last, results + last + 1);
+        results[position] = result;
+
+        for (size_t next = tier; next < eTIERS_COUNT; ++next)
+            tierEnds[next] = std::min(tierEnds[next] + 1, maxCount);
+    }
+
+    static Strings toStrings(const std::vector<Result>& results)
+    {
+        Strings strings;
+        strings.reserve(results.size());
+        for (const Result& result : results)
+            strings.emplace_back(result.m_text);
+
+        return strings;
+    }
+
+    static bool isStartsWith(std::string_view string, std::string_view substr)
     {
         return string.length() >= substr.length() 
             && 0 == strncmp(string.data(), substr.data(), substr.length());
     }
 
-    bool isContains(const std::string& string, const std::string& substr)
+    static bool isContains(std::string_view string, std::string_view substr)
     {
-        return std::string::npos != string.find(substr);
+        return std::string_view::npos != string.find(substr);
     }
 };
 
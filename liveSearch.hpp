@@ -0,0 +1,331 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
+
+#include "incrementalSearch.hpp"
+
+// IncrementalSearch over captions which are inserted and erased while readers are searching.
+//
+// Captions are split into an immutable base and a small delta of changes: IncrementalSearch over inserted captions
+// and sorted lists of erased base items and base tokens which are no longer used by any caption. A write copies only
+// the delta, builds it anew and publishes the next Version by atomic shared_ptr swap, so it costs O(delta) rather than
+// O(text). Delta is searched by scanning, it has no indexes beyond the vocabulary, see getDeltaOptions().
+// Readers never wait for a write: a Version is immutable and stays valid for as long as they hold it. Note that
+// std::atomic_load() of shared_ptr isn't lock-free in common standard libraries (libstdc++ guards it by a pool of
+// mutexes), so getVersion() takes a short lock over the pointer copy, shared with publishing of the next Version.
+// Once the delta grows to Options::m_maxDeltaSize, base is rebuilt from all captions by the writer.
+//
+// Results are the same as of IncrementalSearch built from the live captions: base ones in their order, then inserted ones.
+class LiveSearch
+{
+public:
+    typedef IncrementalSearch::Strings Strings;
+    typedef IncrementalSearch::Result  Result;
+
+    // SpellCheck::Options::m_frequencyOrder is not supported and is cleared: corrections of base and delta are merged
+    // by word, and frequencies of a word are split between them, so neither side's order is the one of live captions
+    struct Options : IncrementalSearch::Options
+    {
+        // rebuild base once the count of inserted and erased captions exceeds it
+        size_t m_maxDeltaSize;
+
+        Options(const IncrementalSearch::Options& searchOptions = IncrementalSearch::Options())
+            : IncrementalSearch::Options(searchOptions)
+            , m_maxDeltaSize(1024)
+        {}
+    };
+
+    // Consistent state of captions at some point in time
+    class Version
+    {
+    public:
+        // live captions count
+        size_t size() const { return m_base->m_text.size() - m_erased.size() + m_inserted.size(); }
+
+        Strings getCaptions() const
+        {
+            Strings captions;
+            captions.reserve(size());
+            for (size_t i = 0; i < m_base->m_text.size(); ++i)
+                if (!isErased(i))
+                    captions.emplace_back(m_base->m_text[i]);
+
+            captions.insert(captions.end(), m_inserted.begin(), m_inserted.end());
+            return captions;
+        }
+
+        Strings search(std::string substring, size_t maxCount = 10) const
+        {
+            std::vector<Result> results(maxCount);
+            results.resize(search(substring, results.data(), maxCount));
+            return IncrementalSearch::toStrings(results);
+        }
+
+        // See IncrementalSearch::search(). Result::m_index is the position among getCaptions(),
+        // Result::m_text refers to this Version
+        size_t search(std::string_view substring, Result* results, size_t maxCount) const
+        {
+            queryStats::Scope scope;
+
+            thread_local std::string s_lowercase;
+            s_lowercase.assign(substring.data(), substring.size());
+            utf8::lowercase(s_lowercase);
+
+            queryStats::Timer timer;
+            Corrections corrections;
+            getCorrections(s_lowercase, corrections);
+            timer.next(&QueryStats::m_correctionsNanoseconds);
+
+            IncrementalSearch::FoundResults state;
+            m_base->findResults(s_lowercase, corrections, results, maxCount, state, BaseItems { m_erased });
+            if (m_delta != nullptr)
+                m_delta->findResults(s_lowercase, corrections, results, maxCount, state, DeltaItems { m_base->m_text.size() - m_erased.size() });
+
+            return state.m_tierEnds[IncrementalSearch::eCORRECTED];
+        }
+
+        // Corrections refer to this Version. They are from different vocabularies of base and inserted captions,
+        // so Correction::m_token is TokenArena::k_none
+        SpellCheck::Corrections getCorrections(const std::string& word) const
+        {
+            Corrections corrections;
+            getCorrections(word, corrections);
+            return SpellCheck::Corrections(corrections.begin(), corrections.end());
+        }
+
+    private:
+        friend class LiveSearch;
+
+        typedef SpellCheck::TopCorrections<IncrementalSearch::k_maxCorrections> TopCorrections;
+
+        std::shared_ptr<const IncrementalSearch> m_base;
+        std::vector<uint32_t>                    m_erased;       // sorted base items
+        std::vector<TokenArena::Id>              m_deadTokens;   // sorted base tokens, all items of which are erased
+        Strings                                  m_inserted;
+        std::shared_ptr<const IncrementalSearch> m_delta;        // over m_inserted, if any
+
+        // base and delta corrections merged by (distance, word), as if they were from a single vocabulary
+        struct Corrections
+        {
+            std::array<SpellCheck::Correction, IncrementalSearch::k_maxCorrections> m_items;
+            size_t                                                                  m_size = 0;
+
+            bool                          empty() const { return m_size == 0; }
+            const SpellCheck::Correction& front() const { return m_items[0]; }
+            const SpellCheck::Correction* begin() const { return m_items.data(); }
+            const SpellCheck::Correction* end() const   { return m_items.data() + m_size; }
+        };
+
+        // drops corrections to dead tokens
+        struct LiveTokensCollector
+        {
+            TopCorrections&                    m_corrections;
+            const std::vector<TokenArena::Id>& m_deadTokens;
+
+            unsigned getWorstDistance() const { return m_corrections.getWorstDistance(); }
+
+            void add(const SpellCheck::Correction& correction)
+            {
+                if (!std::binary_search(m_deadTokens.begin(), m_deadTokens.end(), correction.m_token))
+                    m_corrections.add(correction);
+            }
+        };
+
+        struct BaseItems
+        {
+            const std::vector<uint32_t>& m_erased;
+
+            bool isSkipped(size_t item) const
+            {
+                return std::binary_search(m_erased.begin(), m_erased.end(), item);
+            }
+
+            size_t getIndex(size_t item) const
+            {
+                return item - (std::lower_bound(m_erased.begin(), m_erased.end(), item) - m_erased.begin());
+            }
+        };
+
+        struct DeltaItems
+        {
+            size_t m_baseSize;      // live base captions
+
+            bool   isSkipped(size_t) const     { return false; }
+            size_t getIndex(size_t item) const { return m_baseSize + item; }
+        };
+
+        bool isErased(size_t item) const { return std::binary_search(m_erased.begin(), m_erased.end(), item); }
+
+        void getCorrections(const std::string& word, Corrections& corrections) const
+        {
+            TopCorrections base;
+            LiveTokensCollector collector { base, m_deadTokens };
+            m_base->m_spellCheck.collectCorrections(word, true, collector);
+
+            TopCorrections delta;
+            if (m_delta != nullptr)
+                m_delta->m_spellCheck.getCorrections(word, delta, true);
+
+            // the same word may be in both vocabularies, its distance is the same then
+            const SpellCheck::Correction* left  = base.begin();
+            const SpellCheck::Correction* right = delta.begin();
+            while (corrections.m_size < corrections.m_items.size() && (left != base.end() || right != delta.end()))
+            {
+                bool isLeft = right == delta.end()
+                           || (left != base.end() && (left->m_distance != right->m_distance ? left->m_distance < right->m_distance : left->m_word <= right->m_word));
+
+                const SpellCheck::Correction& next = isLeft ? *left++ : *right++;
+                if (corrections.m_size != 0 && corrections.m_items[corrections.m_size - 1].m_word == next.m_word)
+                    continue;
+
+                corrections.m_items[corrections.m_size++] = SpellCheck::Correction { next.m_distance, next.m_word, TokenArena::k_none };
+            }
+        }
+    };
+
+    template <typename StringsArray>
+    explicit LiveSearch(const StringsArray& text, const Options& options = Options())
+        : m_options(options)
+    {
+        m_options.m_frequencyOrder = false;
+        m_deltaOptions             = getDeltaOptions(m_options);
+        rebuild(Strings(std::begin(text), std::end(text)));
+    }
+
+    // The current Version, it's not affected by later writes
+    std::shared_ptr<const Version> getVersion() const { return std::atomic_load(&m_version); }
+
+    // results are copied, so they don't depend on the Version
+    Strings search(std::string substring, size_t maxCount = 10) const { return getVersion()->search(std::move(substring), maxCount); }
+
+    // Writers are serialized, readers may search concurrently
+
+    void insert(const std::string& caption)
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+
+        auto next = std::make_shared<Version>(*m_version);
+        next->m_inserted.push_back(caption);
+        publish(next);
+    }
+
+    // erase the first live caption equal to 'caption', if any
+    bool erase(const std::string& caption)
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+
+        auto next = std::make_shared<Version>(*m_version);
+
+        auto found = m_baseItems.find(caption);
+        if (found != m_baseItems.end())
+        {
+            uint32_t item = found->second.front();
+            found->second.erase(found->second.begin());
+            if (found->second.empty())
+                m_baseItems.erase(found);
+
+            next->m_erased.insert(std::upper_bound(next->m_erased.begin(), next->m_erased.end(), item), item);
+
+            for (TokenArena::Id token : getTokens(*next->m_base, item))
+                if (--m_tokenItemCounts[token] == 0)
+                    next->m_deadTokens.insert(std::upper_bound(next->m_deadTokens.begin(), next->m_deadTokens.end(), token), token);
+        }
+        else
+        {
+            auto inserted = std::find(next->m_inserted.begin(), next->m_inserted.end(), caption);
+            if (inserted == next->m_inserted.end())
+                return false;
+
+            next->m_inserted.erase(inserted);
+        }
+
+        publish(next);
+        return true;
+    }
+
+    // rebuild base from all live captions
+    void compact()
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        rebuild(m_version->getCaptions());
+    }
+
+private:
+    Options                        m_options;
+    IncrementalSearch::Options     m_deltaOptions;
+    std::shared_ptr<const Version> m_version;       // accessed atomically
+
+    // writer state
+    std::mutex                                                  m_writeMutex;
+    std::unordered_map<std::string_view, std::vector<uint32_t>> m_baseItems;        // live base items by caption, views of base
+    std::vector<uint32_t>                                       m_tokenItemCounts;  // live base items per base token
+
+    // delta of 'next' is built from its inserted captions
+    void publish(const std::shared_ptr<Version>& next)
+    {
+        if (next->m_inserted.size() + next->m_erased.size() > m_options.m_maxDeltaSize)
+            return rebuild(next->getCaptions());
+
+        next->m_delta = next->m_inserted.empty() ? nullptr : std::make_shared<const IncrementalSearch>(next->m_inserted, m_deltaOptions);
+        std::atomic_store(&m_version, std::shared_ptr<const Version>(next));
+    }
+
+    void rebuild(const Strings& captions)
+    {
+        auto next = std::make_shared<Version>();
+        next->m_base = std::make_shared<const IncrementalSearch>(captions, m_options);
+
+        const IncrementalSearch& base = *next->m_base;
+        m_baseItems.clear();
+        m_tokenItemCounts.assign(base.m_spellCheck.getVocabulary().size(), 0);
+
+        for (uint32_t i = 0; i < base.m_text.size(); ++i)
+        {
+            m_baseItems[base.m_text[i]].push_back(i);
+            for (TokenArena::Id token : getTokens(base, i))
+                ++m_tokenItemCounts[token];
+        }
+
+        std::atomic_store(&m_version, std::shared_ptr<const Version>(next));
+    }
+
+    // Delta is rebuilt by every write and holds at most m_maxDeltaSize captions: indexes which only speed up lookups
+    // are not worth building for it, results don't depend on them
+    static IncrementalSearch::Options getDeltaOptions(const Options& options)
+    {
+        IncrementalSearch::Options deltaOptions = options;
+        deltaOptions.m_bkTree           = false;
+        deltaOptions.m_trie             = false;
+        deltaOptions.m_buildThreads     = 1;
+        deltaOptions.m_deletionDistance = 0;
+        deltaOptions.m_substringIndex   = false;
+        deltaOptions.m_correctionIndex  = false;
+        deltaOptions.m_queryCacheSize   = 0;
+        return deltaOptions;
+    }
+
+    // unique vocabulary tokens of the base item
+    static std::vector<TokenArena::Id> getTokens(const IncrementalSearch& base, size_t item)
+    {
+        std::vector<std::string> tokens;
+        SpellCheck::tokenize(base.m_textLowercase[item], tokens);
+
+        std::vector<TokenArena::Id> ids;
+        for (const std::string& token : tokens)
+            ids.push_back(base.m_spellCheck.getVocabulary().find(token));
+
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        return ids;
+    }
+
+    LiveSearch(const LiveSearch&)            = delete;
+    LiveSearch& operator=(const LiveSearch&) = delete;
+};
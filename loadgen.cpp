@@ -0,0 +1,217 @@
+#include "searchServer.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+
+// Load generator of the search daemon (see server.cpp): every connection keeps '--depth' requests in flight for
+// '--seconds', so concurrent requests are coalesced into batches by the server. Queries are prefixes of captions typed
+// so far, occasionally misprinted, and misprinted caption words for corrections. Throughput and latency percentiles are printed.
+//
+// Usage: ./loadgen [--socket path] [--text captions.txt] [--connections count] [--depth count] [--seconds count]
+//                  [--corrections percent] [--max-count count]
+//  --socket       socket of the server, ./search.sock by default. The server is waited for up to 30 seconds
+//  --text         captions queries are made of, ../wikipedia.txt by default
+//  --connections  concurrent connections, each one is served by its thread. 8 by default
+//  --depth        pipelined requests per connection. 4 by default
+//  --seconds      duration of the load. 5 by default
+//  --corrections  percent of getCorrections() requests, the rest are search() ones. 20 by default
+//  --max-count    results or corrections per request. 10 by default
+
+typedef std::chrono::steady_clock Clock;
+
+struct Settings
+{
+    std::string m_socket      = "./search.sock";
+    std::string m_text        = "../wikipedia.txt";
+    size_t      m_connections = 8;
+    size_t      m_depth       = 4;
+    double      m_seconds     = 5;
+    unsigned    m_corrections = 20;
+    uint16_t    m_maxCount    = 10;
+};
+
+struct Query
+{
+    SearchServer::RequestType m_type;
+    std::string               m_text;
+};
+
+// 'count' queries of random captions: prefixes of 1 to 24 chars, every fifth one with a misprint, and misprinted words
+std::vector<Query> generateQueries(const std::vector<std::string>& captions, size_t count, unsigned correctionsPercent, std::mt19937& random)
+{
+    std::vector<Query> queries;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const std::string& caption = captions[std::uniform_int_distribution<size_t>(0, captions.size() - 1)(random)];
+        if (std::uniform_int_distribution<unsigned>(0, 99)(random) < correctionsPercent)
+        {
+            size_t begin = std::uniform_int_distribution<size_t>(0, caption.size() - 1)(random);
+            begin = caption.rfind(' ', begin) == std::string::npos ? 0 : caption.rfind(' ', begin) + 1;
+            std::string word = caption.substr(begin, caption.find(' ', begin) - begin);
+            if (!word.empty())
+                word[std::uniform_int_distribution<size_t>(0, word.size() - 1)(random)] = 'a' + std::uniform_int_distribution<int>(0, 25)(random);
+
+            queries.push_back(Query { SearchServer::eCORRECTIONS, word });
+            continue;
+        }
+
+        std::string prefix = caption.substr(0, std::uniform_int_distribution<size_t>(1, 24)(random));
+        if (i % 5 == 0)
+            prefix[std::uniform_int_distribution<size_t>(0, prefix.size() - 1)(random)] = 'a' + std::uniform_int_distribution<int>(0, 25)(random);
+
+        queries.push_back(Query { SearchServer::eSEARCH, prefix });
+    }
+
+    return queries;
+}
+
+struct ConnectionResult
+{
+    std::vector<double> m_latencies;    // microseconds
+    size_t              m_errors = 0;
+};
+
+// closed loop: a response is followed by the next request, so 'depth' requests are in flight
+void runConnection(const Settings& settings, const std::vector<Query>& queries, size_t first, Clock::time_point deadline, ConnectionResult& result)
+{
+    SearchClient client;
+    if (!client.connect(settings.m_socket))
+    {
+        ++result.m_errors;
+        return;
+    }
+
+    std::vector<Clock::time_point> sent(settings.m_depth);
+    size_t                         next = first;
+    auto sendNext = [&](uint32_t id)
+    {
+        const Query& query = queries[next++ % queries.size()];
+        sent[id] = Clock::now();
+        return client.send(id, query.m_type, query.m_text, settings.m_maxCount);
+    };
+
+    size_t inFlight = 0;
+    for (uint32_t id = 0; id < settings.m_depth && sendNext(id); ++id)
+        ++inFlight;
+
+    SearchClient::Response response;
+    while (inFlight != 0 && client.receive(response))
+    {
+        --inFlight;
+        Clock::time_point now = Clock::now();
+        if (response.m_id >= sent.size() || response.m_status != SearchServer::eOK)
+        {
+            ++result.m_errors;
+            continue;
+        }
+
+        result.m_latencies.push_back(std::chrono::duration<double, std::micro>(now - sent[response.m_id]).count());
+        if (now < deadline && sendNext(response.m_id))
+            ++inFlight;
+    }
+
+    result.m_errors += inFlight;
+}
+
+double getPercentile(const std::vector<double>& sorted, double percentile)
+{
+    return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, static_cast<size_t>(percentile / 100 * sorted.size()))];
+}
+
+int main(int argc, char* argv[])
+{
+    Settings settings;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        bool        hasValue = i + 1 < argc;
+
+        if (option == "--socket" && hasValue)
+            settings.m_socket = argv[++i];
+        else if (option == "--text" && hasValue)
+            settings.m_text = argv[++i];
+        else if (option == "--connections" && hasValue)
+            settings.m_connections = std::max<size_t>(1, std::stoul(argv[++i]));
+        else if (option == "--depth" && hasValue)
+            settings.m_depth = std::max<size_t>(1, std::stoul(argv[++i]));
+        else if (option == "--seconds" && hasValue)
+            settings.m_seconds = std::stod(argv[++i]);
+        else if (option == "--corrections" && hasValue)
+            settings.m_corrections = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (option == "--max-count" && hasValue)
+            settings.m_maxCount = static_cast<uint16_t>(std::stoul(argv[++i]));
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--socket path] [--text captions.txt] [--connections count] [--depth count] [--seconds count]"
+                      << " [--corrections percent] [--max-count count]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::ifstream            input(settings.m_text);
+    std::vector<std::string> captions;
+    for (std::string line; std::getline(input, line); )
+    {
+        if (!line.empty())
+            captions.push_back(std::move(line));
+    }
+
+    if (captions.empty())
+    {
+        std::cerr << settings.m_text << " is not found" << std::endl;
+        return 1;
+    }
+
+    std::mt19937       random(5);
+    std::vector<Query> queries = generateQueries(captions, 100000, settings.m_corrections, random);
+
+    // the server may still be loading its index
+    SearchClient probe;
+    for (Clock::time_point start = Clock::now(); !probe.connect(settings.m_socket); )
+    {
+        if (Clock::now() - start > std::chrono::seconds(30))
+        {
+            std::cerr << "Can't connect to " << settings.m_socket << std::endl;
+            return 1;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    probe.disconnect();
+
+    std::vector<ConnectionResult> results(settings.m_connections);
+    std::vector<std::thread>      threads;
+    Clock::time_point             start    = Clock::now();
+    Clock::time_point             deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(settings.m_seconds));
+
+    for (size_t i = 0; i < settings.m_connections; ++i)
+        threads.emplace_back(runConnection, std::cref(settings), std::cref(queries), i * queries.size() / settings.m_connections, deadline, std::ref(results[i]));
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    double              seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::vector<double> latencies;
+    size_t              errors = 0;
+    for (const ConnectionResult& result : results)
+    {
+        latencies.insert(latencies.end(), result.m_latencies.begin(), result.m_latencies.end());
+        errors += result.m_errors;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    std::cout << std::fixed << std::setprecision(1)
+              << settings.m_connections << " connections x " << settings.m_depth << " in flight, " << seconds << "s" << std::endl
+              << "requests  " << latencies.size() << " (" << errors << " errors)" << std::endl
+              << "throughput " << latencies.size() / seconds << " req/s" << std::endl
+              << "latency   p50 " << getPercentile(latencies, 50) << "us  p90 " << getPercentile(latencies, 90)
+              << "us  p99 " << getPercentile(latencies, 99) << "us  p99.9 " << getPercentile(latencies, 99.9)
+              << "us  max " << (latencies.empty() ? 0 : latencies.back()) << "us" << std::endl;
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <vector>
+#include <future>
+#include <thread>
+#include <iterator>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+
+// Runs tasks on std::async threads and waits for all of them.
+// Any callable with the same signature may be used instead, e.g. to run tasks on an existing thread pool.
+struct AsyncExecutor
+{
+    template <typename Task>
+    void operator()(size_t taskCount, const Task& task) const
+    {
+        std::vector<std::future<void>> futures;
+        for (size_t i = 1; i < taskCount; ++i)
+            futures.push_back(std::async(std::launch::async, [&task, i]() { task(i); }));
+
+        if (taskCount != 0)
+            task(0);    // calling thread would wait anyway
+
+        for (std::future<void>& future : futures)
+            future.get();
+    }
+};
+
+// Building blocks of parallel index construction. Every function gives exactly the same result as its serial counterpart,
+// so indexes built with any number of threads are identical.
+namespace parallelBuild
+{
+    // too small shards are not worth a thread
+    static const size_t k_minShardSize = 4096;
+
+    // 'threads' == 0 means hardware concurrency
+    inline size_t getShardCount(unsigned threads, size_t itemCount)
+    {
+        size_t shardCount = threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+        return std::max<size_t>(1, std::min(shardCount, itemCount / k_minShardSize));
+    }
+
+    // shard N is [getShardBegin(N), getShardBegin(N + 1))
+    inline size_t getShardBegin(size_t itemCount, size_t shardCount, size_t shard)
+    {
+        return itemCount * shard / shardCount;
+    }
+
+    // Merges 'runs' pairwise, pairs are merged in parallel by 'merge(left, right, result)'
+    template <typename Run, typename Merge>
+    Run mergePairwise(std::vector<Run> runs, const Merge& merge)
+    {
+        while (runs.size() > 1)
+        {
+            std::vector<Run> merged((runs.size() + 1) / 2);
+            AsyncExecutor()(merged.size(), [&runs, &merged, &merge](size_t pair)
+            {
+                Run& left = runs[pair * 2];
+                if (pair * 2 + 1 == runs.size())
+                {
+                    merged[pair] = std::move(left);
+                    return;
+                }
+
+                Run& right = runs[pair * 2 + 1];
+                merged[pair].reserve(left.size() + right.size());
+                merge(left, right, merged[pair]);
+                Run().swap(left);
+                Run().swap(right);
+            });
+
+            runs = std::move(merged);
+        }
+
+        return runs.empty() ? Run() : std::move(runs.front());
+    }
+
+    // Merges sorted and unique 'runs' into a single sorted and unique list
+    template <typename T>
+    std::vector<T> mergeUnique(std::vector<std::vector<T>> runs)
+    {
+        return mergePairwise(std::move(runs), [](std::vector<T>& left, std::vector<T>& right, std::vector<T>& result)
+        {
+            std::merge(std::make_move_iterator(left.begin()),  std::make_move_iterator(left.end()),
+                       std::make_move_iterator(right.begin()), std::make_move_iterator(right.end()), std::back_inserter(result));
+
+            result.erase(std::unique(result.begin(), result.end()), result.end());
+        });
+    }
+
+    // The same for runs of (item, count) pairs sorted and unique by item: counts of equal items are summed
+    template <typename T, typename Count>
+    std::vector<std::pair<T, Count>> mergeCounts(std::vector<std::vector<std::pair<T, Count>>> runs)
+    {
+        typedef std::vector<std::pair<T, Count>> Run;
+        return mergePairwise(std::move(runs), [](Run& left, Run& right, Run& result)
+        {
+            auto l = left.begin();
+            auto r = right.begin();
+            while (l != left.end() || r != right.end())
+            {
+                if (r == right.end() || (l != left.end() && l->first < r->first))
+                    result.push_back(std::move(*l++));
+                else if (l == left.end() || r->first < l->first)
+                    result.push_back(std::move(*r++));
+                else
+                {
+                    result.push_back(std::move(*l++));
+                    result.back().second += r++->second;
+                }
+            }
+        });
+    }
+
+    // The same as std::sort() followed by std::unique()
+    template <typename T>
+    void sortUnique(std::vector<T>& items, unsigned threads)
+    {
+        size_t shardCount = getShardCount(threads, items.size());
+        if (shardCount == 1)
+        {
+            std::sort(items.begin(), items.end());
+            items.erase(std::unique(items.begin(), items.end()), items.end());
+            return;
+        }
+
+        std::vector<std::vector<T>> runs(shardCount);
+        AsyncExecutor()(shardCount, [&items, &runs, shardCount](size_t shard)
+        {
+            auto first = items.begin() + getShardBegin(items.size(), shardCount, shard);
+            auto last  = items.begin() + getShardBegin(items.size(), shardCount, shard + 1);
+
+            std::vector<T>& run = runs[shard];
+            run.assign(std::make_move_iterator(first), std::make_move_iterator(last));
+            std::sort(run.begin(), run.end());
+            run.erase(std::unique(run.begin(), run.end()), run.end());
+        });
+
+        items = mergeUnique(std::move(runs));
+    }
+}
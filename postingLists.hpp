@@ -0,0 +1,129 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+
+#include "snapshot.hpp"
+#include "parallelBuild.hpp"
+
+// Sorted lists of items per key, e.g. ids of text items containing a vocabulary token.
+// Lists are compressed: every item is stored as varint-encoded delta from the previous one, so dense lists take a byte per item.
+class PostingLists
+{
+public:
+    typedef uint32_t Key;
+    typedef uint32_t Item;
+
+    PostingLists() = default;
+
+    // 'pairs' are (key, item), they are sorted and deduplicated in place using 'threads'. Keys must be less than 'keyCount'
+    PostingLists(std::vector<std::pair<Key, Item>>& pairs, size_t keyCount, unsigned threads = 1)
+    {
+        parallelBuild::sortUnique(pairs, threads);
+
+        std::vector<uint8_t>  bytes;
+        std::vector<size_t>   offsets;
+        std::vector<uint32_t> sizes;
+        offsets.reserve(keyCount + 1);
+        sizes.reserve(keyCount);
+
+        size_t pair = 0;
+        for (Key key = 0; key < keyCount; ++key)
+        {
+            offsets.push_back(bytes.size());
+
+            Item     previous = 0;
+            uint32_t size     = 0;
+            for (; pair < pairs.size() && pairs[pair].first == key; ++pair, ++size)
+            {
+                encode(bytes, pairs[pair].second - previous);
+                previous = pairs[pair].second;
+            }
+
+            sizes.push_back(size);
+        }
+
+        offsets.push_back(bytes.size());
+        bytes.shrink_to_fit();
+
+        m_bytes   = std::move(bytes);
+        m_offsets = std::move(offsets);
+        m_sizes   = std::move(sizes);
+    }
+
+    explicit PostingLists(SnapshotReader& reader)
+        : m_bytes(reader.read<uint8_t>())
+        , m_offsets(reader.read<size_t>())
+        , m_sizes(reader.read<uint32_t>())
+    {}
+
+    void save(SnapshotWriter& writer) const
+    {
+        writer.write(m_bytes);
+        writer.write(m_offsets);
+        writer.write(m_sizes);
+    }
+
+    bool   empty() const          { return m_sizes.empty(); }
+    size_t getSize(Key key) const { return m_sizes[key]; }
+
+    // Sequential decoder of a single list
+    class Cursor
+    {
+    public:
+        Cursor() = default;
+
+        Cursor(const uint8_t* begin, const uint8_t* end)
+            : m_next(begin)
+            , m_end(end)
+            , m_isEnd(false)
+        {
+            next();
+        }
+
+        bool isEnd() const      { return m_isEnd; }
+        Item operator*() const  { return m_item; }
+
+        void next()
+        {
+            if (m_next == m_end)
+            {
+                m_isEnd = true;
+                return;
+            }
+
+            Item     delta = 0;
+            unsigned shift = 0;
+            for (; *m_next & 0x80; ++m_next, shift += 7)
+                delta |= Item(*m_next & 0x7F) << shift;
+
+            delta |= Item(*m_next++) << shift;
+            m_item += delta;
+        }
+
+    private:
+        const uint8_t* m_next  = nullptr;
+        const uint8_t* m_end   = nullptr;
+        Item           m_item  = 0;
+        bool           m_isEnd = true;
+    };
+
+    Cursor getItems(Key key) const
+    {
+        return Cursor(m_bytes.data() + m_offsets[key], m_bytes.data() + m_offsets[key + 1]);
+    }
+
+private:
+    MappedArray<uint8_t>  m_bytes;
+    MappedArray<size_t>   m_offsets;    // list of key K is [m_offsets[K], m_offsets[K + 1])
+    MappedArray<uint32_t> m_sizes;      // items count per key
+
+    static void encode(std::vector<uint8_t>& bytes, Item delta)
+    {
+        for (; delta >= 0x80; delta >>= 7)
+            bytes.push_back(static_cast<uint8_t>(delta | 0x80));
+
+        bytes.push_back(static_cast<uint8_t>(delta));
+    }
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <vector>
+#include <string_view>
+#include <algorithm>
+#include <cstdint>
+
+#include "snapshot.hpp"
+
+// Lower bounds of the distance between a query and a vocabulary token, which are computed without any DP.
+// Candidates whose bound exceeds the current worst correction are rejected before the distance kernel.
+//  - eLENGTH: every insertion or deletion changes length by one. Trailing insertions of incremental match are free.
+//  - eCHAR_MASK: chars are mapped to 64 classes, and every class which is present in only one of the words needs an edit.
+//    Substitution fixes one class of each word at once, transposition doesn't change classes at all.
+//    Incremental match may drop the tail of the token for free, so only query classes missing in the token count then.
+class Prefilter
+{
+public:
+    typedef uint64_t Signature;
+
+    enum Kind : unsigned
+    {
+        eNONE      = 0,
+        eLENGTH    = 1 << 0,
+        eCHAR_MASK = 1 << 1,
+        eALL       = eLENGTH | eCHAR_MASK,
+    };
+
+    // candidates rejected by prefilters and ones passed to the distance kernel
+    struct Stats
+    {
+        uint64_t m_filtered  = 0;
+        uint64_t m_evaluated = 0;
+    };
+
+    Prefilter() = default;
+
+    // 'kinds' is a combination of Kind flags, signatures are stored only for eCHAR_MASK
+    template <typename Tokens>
+    Prefilter(const Tokens& tokens, unsigned kinds)
+        : m_kinds(kinds)
+    {
+        if ((kinds & eCHAR_MASK) == 0)
+            return;
+
+        std::vector<Signature> signatures;
+        signatures.reserve(tokens.size());
+        for (size_t i = 0; i < tokens.size(); ++i)
+            signatures.push_back(getSignature(tokens[i]));
+
+        m_signatures = std::move(signatures);
+    }
+
+    explicit Prefilter(SnapshotReader& reader)
+        : m_kinds(reader.readValue<unsigned>())
+        , m_signatures(reader.read<Signature>())
+    {}
+
+    void save(SnapshotWriter& writer) const
+    {
+        writer.writeValue(m_kinds);
+        writer.write(m_signatures);
+    }
+
+    bool isEnabled(Kind kind) const { return (m_kinds & kind) != 0; }
+
+    static Signature getSignature(char c) { return Signature(1) << getClass(c); }
+
+    static Signature getSignature(std::string_view word)
+    {
+        Signature signature = 0;
+        for (char c : word)
+            signature |= getSignature(c);
+
+        return signature;
+    }
+
+    // lower bound of the distance from 'query' to the token of 'tokenSize', see SpellCheck::getSmartDistance()
+    static unsigned getLengthBound(size_t tokenSize, size_t querySize, bool isIncrementalMatch)
+    {
+        if (isIncrementalMatch)
+            return 0;
+
+        return static_cast<unsigned>(tokenSize > querySize ? tokenSize - querySize : querySize - tokenSize);
+    }
+
+    // lower bound of the distance from the query of 'querySignature' to 'token'. Requires eCHAR_MASK
+    unsigned getCharBound(size_t token, Signature querySignature, bool isIncrementalMatch) const
+    {
+        Signature tokenSignature = m_signatures[token];
+        unsigned  missing        = popCount(querySignature & ~tokenSignature);
+        return isIncrementalMatch ? missing : std::max(missing, popCount(tokenSignature & ~querySignature));
+    }
+
+private:
+    unsigned               m_kinds = eNONE;
+    MappedArray<Signature> m_signatures;    // by token id
+
+    // digits and lowercase letters have own classes, uppercase letters share them in pairs, the rest share the last classes
+    static unsigned getClass(char c)
+    {
+        unsigned char code = static_cast<unsigned char>(c);
+        if (code >= '0' && code <= '9')
+            return code - '0';
+
+        if (code >= 'a' && code <= 'z')
+            return 10 + code - 'a';
+
+        if (code >= 'A' && code <= 'Z')
+            return 36 + (code - 'A') / 2;
+
+        return 49 + code % 15;
+    }
+
+    static unsigned popCount(Signature signature)
+    {
+#if defined __GNUC__
+        return static_cast<unsigned>(__builtin_popcountll(signature));
+#else
+        unsigned count = 0;
+        for (; signature != 0; signature &= signature - 1)
+            ++count;
+
+        return count;
+#endif
+    }
+};
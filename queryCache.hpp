@@ -0,0 +1,104 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cassert>
+
+// Bounded LRU cache of recent search results, keyed by lowercase query.
+//
+// Typing produces queries which differ from the previous one by a char: backspace repeats a recent query, so its results
+// are served from the cache, and a typed char extends a recent query. Every caption containing "abcd" contains "abc" too,
+// so entries also keep the set of items containing the query, and the extended query checks only items of that set.
+//
+// Entries are immutable and shared: the mutex guards lookups and insertions only, searches run without it.
+class QueryCache
+{
+public:
+    typedef uint32_t Item;
+
+    struct Entry
+    {
+        std::string       m_query;
+        size_t            m_maxCount      = 0;
+        std::vector<Item> m_results;                // items in order of results
+        bool              m_hasCandidates = false;  // too large sets are not kept
+        std::vector<Item> m_candidates;             // ascending items containing m_query
+    };
+
+    typedef std::shared_ptr<const Entry> EntryPtr;
+
+    explicit QueryCache(size_t capacity)
+        : m_capacity(capacity)
+    {
+        assert(capacity != 0);
+    }
+
+    EntryPtr find(std::string_view query)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto found = m_entries.find(query);
+        if (found == m_entries.end())
+            return nullptr;
+
+        m_lru.splice(m_lru.begin(), m_lru, found->second);     // most recently used
+        return *found->second;
+    }
+
+    // entry of the longest proper prefix of 'query' which has candidates
+    EntryPtr findPrefix(std::string_view query)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (size_t size = query.size(); size-- > 1; )
+        {
+            auto found = m_entries.find(query.substr(0, size));
+            if (found != m_entries.end() && (*found->second)->m_hasCandidates)
+            {
+                m_lru.splice(m_lru.begin(), m_lru, found->second);
+                return *found->second;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // replaces the entry of the same query, the least recently used one is dropped if there is no room
+    void insert(EntryPtr entry)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto found = m_entries.find(entry->m_query);
+        if (found != m_entries.end())
+        {
+            m_lru.erase(found->second);
+            m_entries.erase(found);
+        }
+
+        if (m_entries.size() >= m_capacity)
+        {
+            m_entries.erase(m_lru.back()->m_query);
+            m_lru.pop_back();
+        }
+
+        m_lru.push_front(std::move(entry));
+        m_entries.emplace(m_lru.front()->m_query, m_lru.begin());
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_entries.size();
+    }
+
+private:
+    size_t                                                              m_capacity;
+    mutable std::mutex                                                  m_mutex;
+    std::list<EntryPtr>                                                 m_lru;          // most recently used first
+    std::unordered_map<std::string_view, std::list<EntryPtr>::iterator> m_entries;      // keys are views of entry queries
+};
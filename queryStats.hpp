@@ -0,0 +1,184 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+// Opt-in hot path instrumentation: what a query cost and where its time went.
+//
+// Counting is compiled in only if INCREMENTAL_SEARCH_STATS is defined before including any header of the library,
+// e.g. `make stats-tests` or `make tests USER_DEFINES=-DINCREMENTAL_SEARCH_STATS`. Otherwise counters and timers are empty
+// inline functions and objects, which are removed by the compiler, and all stats are zero.
+//
+// Counters are kept per thread and are not synchronized on the hot path. queryStats::Scope tells the counts of the calling thread
+// during its lifetime, i.e. per query stats. Public lookups of IncrementalSearch and SpellCheck open a scope too:
+// when the outermost scope of a thread is closed, its counts are added to cumulative totals, see queryStats::getTotal().
+struct QueryStats
+{
+#if defined INCREMENTAL_SEARCH_STATS
+    static constexpr bool k_enabled = true;
+#else
+    static constexpr bool k_enabled = false;
+#endif
+
+    uint64_t m_dpCells             = 0;    // distance matrix cells computed. SIMD batches count whole matrices of their words
+    uint64_t m_candidatesEvaluated = 0;    // vocabulary tokens passed to a distance kernel
+    uint64_t m_candidatesPruned    = 0;    // vocabulary tokens rejected by prefilters, see Prefilter
+    uint64_t m_workspaceGrowths    = 0;    // DP scratch memory reallocated, see SpellCheck::Workspace
+    uint64_t m_allocations         = 0;    // heap allocations, reported by application's operator new, see countAllocation()
+
+    // time of IncrementalSearch::search() stages. Corrections lookup is what the corrected tier is built on,
+    // tiers are the time of checking items for them. Timers add their own overhead to the measured time
+    uint64_t m_correctionsNanoseconds = 0;
+    uint64_t m_startsWithNanoseconds  = 0;
+    uint64_t m_containsNanoseconds    = 0;
+    uint64_t m_correctedNanoseconds   = 0;
+
+    QueryStats& operator+=(const QueryStats& right)
+    {
+        forEachCounter(*this, right, [](uint64_t& counter, uint64_t value) { counter += value; });
+        return *this;
+    }
+
+    QueryStats operator-(const QueryStats& right) const
+    {
+        QueryStats difference = *this;
+        forEachCounter(difference, right, [](uint64_t& counter, uint64_t value) { counter -= value; });
+        return difference;
+    }
+
+    // calls 'visit(counter, value)' for every counter of 'stats' and the same counter of 'other'
+    template <typename Visitor>
+    static void forEachCounter(QueryStats& stats, const QueryStats& other, Visitor visit)
+    {
+        visit(stats.m_dpCells,                other.m_dpCells);
+        visit(stats.m_candidatesEvaluated,    other.m_candidatesEvaluated);
+        visit(stats.m_candidatesPruned,       other.m_candidatesPruned);
+        visit(stats.m_workspaceGrowths,       other.m_workspaceGrowths);
+        visit(stats.m_allocations,            other.m_allocations);
+        visit(stats.m_correctionsNanoseconds, other.m_correctionsNanoseconds);
+        visit(stats.m_startsWithNanoseconds,  other.m_startsWithNanoseconds);
+        visit(stats.m_containsNanoseconds,    other.m_containsNanoseconds);
+        visit(stats.m_correctedNanoseconds,   other.m_correctedNanoseconds);
+    }
+
+    static const size_t k_counterCount = 9;
+};
+
+namespace queryStats
+{
+#if defined INCREMENTAL_SEARCH_STATS
+    struct ThreadState
+    {
+        QueryStats m_counters;      // since the thread start
+        QueryStats m_flushed;       // part of m_counters which is added to totals
+        unsigned   m_depth = 0;     // of nested scopes
+    };
+
+    inline ThreadState& getThreadState()
+    {
+        thread_local ThreadState s_state;
+        return s_state;
+    }
+
+    inline std::atomic<uint64_t> (&getTotals())[QueryStats::k_counterCount]
+    {
+        static std::atomic<uint64_t> s_totals[QueryStats::k_counterCount] = {};
+        return s_totals;
+    }
+#endif
+
+    // adds 'value' to the 'counter' of the calling thread
+    inline void add(uint64_t QueryStats::* counter, uint64_t value)
+    {
+#if defined INCREMENTAL_SEARCH_STATS
+        getThreadState().m_counters.*counter += value;
+#else
+        (void)counter;
+        (void)value;
+#endif
+    }
+
+    // Header-only library can't replace global operator new, so allocations are counted only if the application calls it
+    // from its own operator new, see test.cpp
+    inline void countAllocation() { add(&QueryStats::m_allocations, 1); }
+
+    // sum of all finished outermost scopes of all threads
+    inline QueryStats getTotal()
+    {
+        QueryStats total;
+#if defined INCREMENTAL_SEARCH_STATS
+        size_t index = 0;
+        QueryStats::forEachCounter(total, total, [&index](uint64_t& counter, uint64_t) { counter = getTotals()[index++].load(std::memory_order_relaxed); });
+#endif
+        return total;
+    }
+
+    inline void resetTotal()
+    {
+#if defined INCREMENTAL_SEARCH_STATS
+        for (std::atomic<uint64_t>& total : getTotals())
+            total.store(0, std::memory_order_relaxed);
+#endif
+    }
+
+    // Counts of the calling thread from construction. Scopes may be nested, the outermost one adds counts to totals
+    class Scope
+    {
+    public:
+#if defined INCREMENTAL_SEARCH_STATS
+        Scope()
+            : m_start(getThreadState().m_counters)
+        {
+            ++getThreadState().m_depth;
+        }
+
+        ~Scope()
+        {
+            ThreadState& state = getThreadState();
+            if (--state.m_depth != 0)
+                return;
+
+            // counts made outside of any scope, e.g. by SpellCheck::Session::push(), are added here as well
+            QueryStats unflushed = state.m_counters - state.m_flushed;
+            size_t     index     = 0;
+            QueryStats::forEachCounter(unflushed, unflushed, [&index](uint64_t& counter, uint64_t) { getTotals()[index++].fetch_add(counter, std::memory_order_relaxed); });
+            state.m_flushed = state.m_counters;
+        }
+
+        QueryStats get() const { return getThreadState().m_counters - m_start; }
+
+    private:
+        QueryStats m_start;
+
+        Scope(const Scope&)            = delete;
+        Scope& operator=(const Scope&) = delete;
+#else
+        Scope() {}  // user-provided, so an unused scope doesn't warn
+
+        QueryStats get() const { return QueryStats(); }
+#endif
+    };
+
+    // Adds time from construction or the previous next() call to the counter
+    class Timer
+    {
+    public:
+#if defined INCREMENTAL_SEARCH_STATS
+        Timer() : m_start(std::chrono::steady_clock::now()) {}
+
+        void next(uint64_t QueryStats::* counter)
+        {
+            auto now = std::chrono::steady_clock::now();
+            add(counter, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_start).count()));
+            m_start = now;
+        }
+
+    private:
+        std::chrono::steady_clock::time_point m_start;
+#else
+        Timer() {}
+
+        void next(uint64_t QueryStats::*) {}
+#endif
+    };
+}
@@ -0,0 +1,599 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+#include <list>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <optional>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "incrementalSearch.hpp"
+
+// Resident search over a Unix domain socket (POSIX only): one process owns the immutable index, e.g. a memory-mapped
+// snapshot, and serves search() and getCorrections() requests of many clients instead of every client embedding a copy.
+//
+// Protocol is binary in host byte order, the socket is local. A connection carries any number of requests: RequestHeader
+// followed by m_querySize bytes of the query. Response is ResponseHeader followed by m_count items: ResponseItem followed
+// by m_size bytes of text. Clients may pipeline requests, responses are matched by m_id.
+//
+// Readers of connections queue requests, and a worker takes all queued ones at once (up to Options::m_maxBatch):
+// identical queries of the batch, e.g. popular prefixes, are looked up once. Unique queries are looked up one by one:
+// sharing a vocabulary scan between them was measured to cost the same per query, the scan is bound by distance
+// computation rather than by memory. The more concurrent requests there are, the more repeats a batch catches.
+class SearchServer
+{
+public:
+    enum RequestType : uint8_t
+    {
+        eSEARCH      = 1,   // items are results, ResponseItem::m_value is the position of the caption
+        eCORRECTIONS = 2,   // items are corrections of the lowercase query, ResponseItem::m_value is the distance
+    };
+
+    enum Status : uint8_t
+    {
+        eOK          = 0,
+        eBAD_REQUEST = 1,   // unknown type, there are no items
+    };
+
+    struct RequestHeader
+    {
+        uint32_t m_id;              // is returned in the response
+        uint8_t  m_type;            // RequestType
+        uint8_t  m_isIncremental;   // eCORRECTIONS: ignore insertions past the end of the query, see SpellCheck::getCorrections()
+        uint16_t m_maxCount;        // of items, it's capped by k_maxResults or k_maxCorrections
+        uint32_t m_querySize;       // bytes of the query after the header, the connection is closed if it's above k_maxQuerySize
+    };
+
+    struct ResponseHeader
+    {
+        uint32_t m_id;
+        uint8_t  m_status;          // Status
+        uint8_t  m_reserved;
+        uint16_t m_count;           // items after the header
+    };
+
+    struct ResponseItem
+    {
+        uint32_t m_value;           // caption position or distance
+        uint32_t m_size;            // bytes of text after the item
+    };
+
+    static constexpr uint32_t k_maxQuerySize   = 4096;
+    static constexpr size_t   k_maxResults     = 1000;
+    static constexpr size_t   k_maxCorrections = 64;
+
+    struct Options
+    {
+        // threads which serve batches. Responses of a connection keep the order of requests with a single worker only
+        unsigned m_workers;
+
+        // requests per batch
+        size_t m_maxBatch;
+
+        Options() : m_workers(1), m_maxBatch(256) {}
+    };
+
+    struct Stats
+    {
+        uint64_t m_requests = 0;
+        uint64_t m_batches  = 0;
+    };
+
+    // 'search' must outlive SearchServer
+    explicit SearchServer(const IncrementalSearch& search, const Options& options = Options())
+        : m_search(search)
+        , m_options(options)
+    {}
+
+    ~SearchServer() { stop(); }
+
+    // Listens on 'path', an existing socket file is replaced. False if the socket can't be created or the server is started
+    bool start(const std::string& path)
+    {
+        sockaddr_un address = {};
+        if (m_listener >= 0 || path.size() >= sizeof(address.sun_path))
+            return false;
+
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+            return false;
+
+        unlink(path.c_str());
+        if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+        {
+            close(listener);
+            return false;
+        }
+
+        m_path       = path;
+        m_listener   = listener;
+        m_isStopping = false;
+
+        unsigned workerCount = m_options.m_workers != 0 ? m_options.m_workers : std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < workerCount; ++i)
+            m_workers.emplace_back([this]() { serve(); });
+
+        m_acceptor = std::thread([this]() { accept(); });
+        return true;
+    }
+
+    // closes the socket and all connections, queued requests are dropped
+    void stop()
+    {
+        if (m_listener < 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_queueMutex);
+            m_isStopping = true;
+            m_queue.clear();
+        }
+
+        m_wakeUp.notify_all();
+
+        // blocked accept() and recv() return once their sockets are shut down
+        shutdown(m_listener, SHUT_RDWR);
+        m_acceptor.join();
+
+        for (Reader& reader : m_readers)
+        {
+            if (std::shared_ptr<Connection> connection = reader.m_connection.lock())
+                shutdown(connection->m_socket, SHUT_RDWR);
+
+            reader.m_thread.join();
+        }
+
+        for (std::thread& worker : m_workers)
+            worker.join();
+
+        m_readers.clear();
+        m_workers.clear();
+        m_queue.clear();
+
+        close(m_listener);
+        unlink(m_path.c_str());
+        m_listener = -1;
+    }
+
+    Stats getStats() const
+    {
+        Stats stats;
+        stats.m_requests = m_requests.load(std::memory_order_relaxed);
+        stats.m_batches  = m_batches.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    // the whole buffer, false if the peer is gone
+    static bool sendAll(int socket, const void* data, size_t size)
+    {
+        for (const char* next = static_cast<const char*>(data); size != 0; )
+        {
+            ssize_t sent = send(socket, next, size, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR)
+                continue;
+
+            if (sent <= 0)
+                return false;
+
+            next += sent;
+            size -= static_cast<size_t>(sent);
+        }
+
+        return true;
+    }
+
+    static bool receiveAll(int socket, void* data, size_t size)
+    {
+        for (char* next = static_cast<char*>(data); size != 0; )
+        {
+            ssize_t received = recv(socket, next, size, 0);
+            if (received < 0 && errno == EINTR)
+                continue;
+
+            if (received <= 0)
+                return false;
+
+            next += received;
+            size -= static_cast<size_t>(received);
+        }
+
+        return true;
+    }
+
+private:
+    struct Connection
+    {
+        int        m_socket;
+        std::mutex m_sendMutex;     // responses of different workers are not interleaved
+
+        explicit Connection(int socket) : m_socket(socket) {}
+        ~Connection() { close(m_socket); }
+    };
+
+    // the socket is closed once the reader and all queued requests of the connection are done
+    struct Reader
+    {
+        std::thread               m_thread;
+        std::weak_ptr<Connection> m_connection;
+        std::atomic<bool>         m_isDone { false };
+    };
+
+    struct Request
+    {
+        std::shared_ptr<Connection> m_connection;
+        RequestHeader               m_header;
+        std::string                 m_query;
+    };
+
+    const IncrementalSearch& m_search;
+    Options                  m_options;
+    std::string              m_path;
+    int                      m_listener = -1;
+
+    std::thread              m_acceptor;
+    std::list<Reader>        m_readers;         // accessed by the acceptor, or by stop() once the acceptor is joined
+    std::vector<std::thread> m_workers;
+
+    std::mutex               m_queueMutex;
+    std::condition_variable  m_wakeUp;
+    std::deque<Request>      m_queue;
+    bool                     m_isStopping = false;
+
+    std::atomic<uint64_t>    m_requests { 0 };
+    std::atomic<uint64_t>    m_batches { 0 };
+
+    SearchServer(const SearchServer&)            = delete;
+    SearchServer& operator=(const SearchServer&) = delete;
+
+    void accept()
+    {
+        for (;;)
+        {
+            int socket = ::accept(m_listener, nullptr, nullptr);
+            if (socket < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+
+                return;     // the listener is shut down
+            }
+
+            // readers of closed connections are joined here, so they don't pile up
+            m_readers.remove_if([](Reader& reader)
+            {
+                if (!reader.m_isDone)
+                    return false;
+
+                reader.m_thread.join();
+                return true;
+            });
+
+            auto connection = std::make_shared<Connection>(socket);
+            Reader& reader = m_readers.emplace_back();
+            reader.m_connection = connection;
+            reader.m_thread     = std::thread([this, &reader, connection]() { read(reader, connection); });
+        }
+    }
+
+    void read(Reader& reader, const std::shared_ptr<Connection>& connection)
+    {
+        RequestHeader header;
+        while (receiveAll(connection->m_socket, &header, sizeof(header)) && header.m_querySize <= k_maxQuerySize)
+        {
+            Request request { connection, header, std::string(header.m_querySize, '\0') };
+            if (!receiveAll(connection->m_socket, request.m_query.data(), request.m_query.size()))
+                break;
+
+            {
+                std::lock_guard<std::mutex> lock(m_queueMutex);
+                if (m_isStopping)
+                    break;
+
+                m_queue.push_back(std::move(request));
+            }
+
+            m_wakeUp.notify_one();
+        }
+
+        reader.m_isDone = true;
+    }
+
+    void serve()
+    {
+        std::vector<Request> batch;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_queueMutex);
+                m_wakeUp.wait(lock, [this]() { return m_isStopping || !m_queue.empty(); });
+                if (m_isStopping)
+                    return;
+
+                size_t count = std::min(m_queue.size(), m_options.m_maxBatch);
+                batch.assign(std::make_move_iterator(m_queue.begin()), std::make_move_iterator(m_queue.begin() + count));
+                m_queue.erase(m_queue.begin(), m_queue.begin() + count);
+            }
+
+            m_requests.fetch_add(batch.size(), std::memory_order_relaxed);
+            m_batches.fetch_add(1, std::memory_order_relaxed);
+            execute(batch);
+            batch.clear();
+        }
+    }
+
+    void execute(const std::vector<Request>& batch)
+    {
+        // identical searches of equal result count share a lookup, so do corrections of equal incrementality
+        std::map<uint16_t, std::vector<const Request*>> searches;
+        std::vector<const Request*>                     corrections[2];
+
+        for (const Request& request : batch)
+        {
+            if (request.m_header.m_type == eSEARCH)
+                searches[static_cast<uint16_t>(std::min<size_t>(request.m_header.m_maxCount, k_maxResults))].push_back(&request);
+            else if (request.m_header.m_type == eCORRECTIONS)
+                corrections[request.m_header.m_isIncremental != 0].push_back(&request);
+            else
+                respond(request, eBAD_REQUEST, 0, [](size_t) { return ResponseItem {}; }, [](size_t) { return std::string_view(); });
+        }
+
+        for (const auto& search : searches)
+            executeSearches(search.second, search.first);
+
+        for (bool isIncremental : { false, true })
+            executeCorrections(corrections[isIncremental], isIncremental);
+    }
+
+    // identical queries of a batch, e.g. popular ones, are looked up once: 'slots[i]' is the position of query 'i' in 'unique'
+    static void deduplicate(const std::vector<std::string_view>& queries, std::vector<std::string_view>& unique, std::vector<size_t>& slots)
+    {
+        std::unordered_map<std::string_view, size_t> positions;
+        for (std::string_view query : queries)
+        {
+            auto position = positions.emplace(query, unique.size());
+            if (position.second)
+                unique.push_back(query);
+
+            slots.push_back(position.first->second);
+        }
+    }
+
+    void executeSearches(const std::vector<const Request*>& requests, size_t maxCount)
+    {
+        std::vector<std::string_view> queries;
+        std::vector<std::string_view> unique;
+        std::vector<size_t>           slots;
+
+        for (const Request* request : requests)
+            queries.push_back(request->m_query);
+
+        deduplicate(queries, unique, slots);
+
+        std::vector<IncrementalSearch::Result> results(unique.size() * maxCount);
+        std::vector<size_t>                    counts(unique.size());
+        for (size_t i = 0; i < unique.size(); ++i)
+            counts[i] = m_search.search(unique[i], &results[i * maxCount], maxCount);
+
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            const IncrementalSearch::Result* found = &results[slots[i] * maxCount];
+            respond(*requests[i], eOK, counts[slots[i]], [found](size_t item) { return ResponseItem { static_cast<uint32_t>(found[item].m_index), 0 }; },
+                                                         [found](size_t item) { return found[item].m_text; });
+        }
+    }
+
+    void executeCorrections(const std::vector<const Request*>& requests, bool isIncremental)
+    {
+        typedef SpellCheck::TopCorrections<k_maxCorrections> Corrections;
+
+        std::vector<std::string>      words;
+        std::vector<std::string_view> queries;
+        std::vector<std::string_view> unique;
+        std::vector<size_t>           slots;
+
+        // vocabulary is lowercase
+        words.reserve(requests.size());
+        for (const Request* request : requests)
+        {
+            words.push_back(request->m_query);
+            utf8::lowercase(words.back());
+            queries.push_back(words.back());
+        }
+
+        deduplicate(queries, unique, slots);
+
+        // corrections are ordered by (distance, rank), so the fewer ones a request asks for are the first of the lookup
+        std::vector<size_t> maxCounts(unique.size(), 0);
+        for (size_t i = 0; i < requests.size(); ++i)
+            maxCounts[slots[i]] = std::max<size_t>(maxCounts[slots[i]], requests[i]->m_header.m_maxCount);
+
+        std::vector<Corrections> corrections;
+        for (size_t i = 0; i < unique.size(); ++i)
+        {
+            corrections.emplace_back(maxCounts[i]);
+            m_search.getSpellCheck().collectCorrections(unique[i], isIncremental, corrections.back());
+        }
+
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            const Corrections& found = corrections[slots[i]];
+            respond(*requests[i], eOK, std::min<size_t>(found.size(), requests[i]->m_header.m_maxCount),
+                    [&found](size_t item) { return ResponseItem { found[item].m_distance, 0 }; },
+                    [&found](size_t item) { return found[item].m_word; });
+        }
+    }
+
+    // 'getItem(i)' gives the value of the item, 'getText(i)' gives its text
+    template <typename GetItem, typename GetText>
+    void respond(const Request& request, Status status, size_t count, GetItem getItem, GetText getText)
+    {
+        thread_local std::string s_response;
+        s_response.clear();
+
+        ResponseHeader header = { request.m_header.m_id, status, 0, static_cast<uint16_t>(count) };
+        s_response.append(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            std::string_view text = getText(i);
+            ResponseItem     item = getItem(i);
+            item.m_size = static_cast<uint32_t>(text.size());
+
+            s_response.append(reinterpret_cast<const char*>(&item), sizeof(item));
+            s_response.append(text.data(), text.size());
+        }
+
+        // a failure means the client is gone, its reader stops then
+        std::lock_guard<std::mutex> lock(request.m_connection->m_sendMutex);
+        sendAll(request.m_connection->m_socket, s_response.data(), s_response.size());
+    }
+};
+
+// Blocking client of SearchServer over a single connection. Requests may be pipelined: send() several of them,
+// then receive() their responses
+class SearchClient
+{
+public:
+    struct Item
+    {
+        uint32_t    m_value;        // see SearchServer::ResponseItem
+        std::string m_text;
+    };
+
+    struct Response
+    {
+        uint32_t          m_id     = 0;
+        uint8_t           m_status = SearchServer::eOK;
+        std::vector<Item> m_items;
+    };
+
+    SearchClient() = default;
+    ~SearchClient() { disconnect(); }
+
+    SearchClient(const SearchClient&)            = delete;
+    SearchClient& operator=(const SearchClient&) = delete;
+
+    bool connect(const std::string& path)
+    {
+        sockaddr_un address = {};
+        if (path.size() >= sizeof(address.sun_path))
+            return false;
+
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        disconnect();
+        m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_socket >= 0 && ::connect(m_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0)
+            return true;
+
+        disconnect();
+        return false;
+    }
+
+    void disconnect()
+    {
+        if (m_socket >= 0)
+            close(m_socket);
+
+        m_socket = -1;
+    }
+
+    bool isConnected() const { return m_socket >= 0; }
+
+    bool send(uint32_t id, SearchServer::RequestType type, std::string_view query, uint16_t maxCount, bool isIncremental = false)
+    {
+        if (query.size() > SearchServer::k_maxQuerySize)
+            return false;
+
+        SearchServer::RequestHeader header = { id, type, static_cast<uint8_t>(isIncremental), maxCount, static_cast<uint32_t>(query.size()) };
+
+        m_request.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+        m_request.append(query.data(), query.size());
+        return SearchServer::sendAll(m_socket, m_request.data(), m_request.size());
+    }
+
+    bool receive(Response& response)
+    {
+        SearchServer::ResponseHeader header;
+        if (!SearchServer::receiveAll(m_socket, &header, sizeof(header)))
+            return false;
+
+        response.m_id     = header.m_id;
+        response.m_status = header.m_status;
+        response.m_items.resize(header.m_count);
+
+        for (Item& item : response.m_items)
+        {
+            SearchServer::ResponseItem responseItem;
+            if (!SearchServer::receiveAll(m_socket, &responseItem, sizeof(responseItem)))
+                return false;
+
+            item.m_value = responseItem.m_value;
+            item.m_text.resize(responseItem.m_size);
+            if (!SearchServer::receiveAll(m_socket, item.m_text.data(), item.m_text.size()))
+                return false;
+        }
+
+        return true;
+    }
+
+    // round trips, see IncrementalSearch::search(). Nothing on connection errors
+    std::optional<IncrementalSearch::Strings> search(std::string_view query, uint16_t maxCount = 10)
+    {
+        std::optional<IncrementalSearch::Strings> results;
+        if (roundTrip(SearchServer::eSEARCH, query, maxCount, false))
+        {
+            results.emplace();
+            for (Item& item : m_response.m_items)
+                results->push_back(std::move(item.m_text));
+        }
+
+        return results;
+    }
+
+    // corrections of the lowercase 'word' and their distances, see SpellCheck::getCorrections()
+    std::optional<std::vector<std::pair<std::string, unsigned>>> getCorrections(std::string_view word, uint16_t maxCount, bool isIncremental = false)
+    {
+        std::optional<std::vector<std::pair<std::string, unsigned>>> corrections;
+        if (roundTrip(SearchServer::eCORRECTIONS, word, maxCount, isIncremental))
+        {
+            corrections.emplace();
+            for (Item& item : m_response.m_items)
+                corrections->emplace_back(std::move(item.m_text), item.m_value);
+        }
+
+        return corrections;
+    }
+
+private:
+    int         m_socket = -1;
+    uint32_t    m_nextId = 0;
+    std::string m_request;
+    Response    m_response;
+
+    bool roundTrip(SearchServer::RequestType type, std::string_view query, uint16_t maxCount, bool isIncremental)
+    {
+        uint32_t id = m_nextId++;
+        return send(id, type, query, maxCount, isIncremental) && receive(m_response) && m_response.m_id == id && m_response.m_status == SearchServer::eOK;
+    }
+};
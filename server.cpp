@@ -0,0 +1,106 @@
+#include "searchServer.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <csignal>
+#include <pthread.h>
+
+// Resident search daemon: owns one index and serves search() and getCorrections() over a Unix domain socket,
+// see SearchServer. Stops on SIGINT or SIGTERM and prints how requests were batched.
+//
+// Usage: ./server [--socket path] [--text captions.txt] [--snapshot index.snapshot] [--workers count] [--batch count]
+//  --socket    socket file, ./search.sock by default
+//  --text      captions, one per line, ../wikipedia.txt by default
+//  --snapshot  index file: it's memory-mapped if it exists, otherwise the index is built from text and saved there
+//  --workers   threads which serve batches, 0 is hardware concurrency. 1 by default, so batches are as large as possible
+//  --batch     requests per batch
+
+std::optional<IncrementalSearch> loadIndex(const std::string& textPath, const std::string& snapshotPath)
+{
+    if (!snapshotPath.empty())
+    {
+        std::optional<IncrementalSearch> search = IncrementalSearch::loadSnapshot(snapshotPath);
+        if (search)
+            return search;
+    }
+
+    std::ifstream            input(textPath);
+    std::vector<std::string> text;
+    for (std::string line; std::getline(input, line); )
+    {
+        if (!line.empty())
+            text.push_back(std::move(line));
+    }
+
+    if (text.empty())
+        return std::nullopt;
+
+    std::optional<IncrementalSearch> search;
+    search.emplace(text);
+    if (!snapshotPath.empty() && !search->saveSnapshot(snapshotPath))
+        std::cerr << "Can't write " << snapshotPath << std::endl;
+
+    return search;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string           socketPath = "./search.sock";
+    std::string           textPath   = "../wikipedia.txt";
+    std::string           snapshotPath;
+    SearchServer::Options options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        bool        hasValue = i + 1 < argc;
+
+        if (option == "--socket" && hasValue)
+            socketPath = argv[++i];
+        else if (option == "--text" && hasValue)
+            textPath = argv[++i];
+        else if (option == "--snapshot" && hasValue)
+            snapshotPath = argv[++i];
+        else if (option == "--workers" && hasValue)
+            options.m_workers = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (option == "--batch" && hasValue)
+            options.m_maxBatch = std::max<size_t>(1, std::stoul(argv[++i]));
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--socket path] [--text captions.txt] [--snapshot index.snapshot] [--workers count] [--batch count]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::optional<IncrementalSearch> search = loadIndex(textPath, snapshotPath);
+    if (!search)
+    {
+        std::cerr << "Neither " << textPath << " nor the snapshot is found" << std::endl;
+        return 1;
+    }
+
+    // threads of the server inherit the mask, so signals are received by sigwait() below only
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    SearchServer server(*search, options);
+    if (!server.start(socketPath))
+    {
+        std::cerr << "Can't listen on " << socketPath << std::endl;
+        return 1;
+    }
+
+    std::cout << "Serving " << search->getSpellCheck().getVocabulary().size() << " words of vocabulary on " << socketPath << std::endl;
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+    server.stop();
+
+    SearchServer::Stats stats = server.getStats();
+    std::cout << stats.m_requests << " requests in " << stats.m_batches << " batches, "
+              << (stats.m_batches != 0 ? static_cast<double>(stats.m_requests) / stats.m_batches : 0.0) << " per batch" << std::endl;
+    return 0;
+}
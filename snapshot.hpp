@@ -0,0 +1,268 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+
+#if defined _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Read-only array which either owns its items or refers to external memory, e.g. to a memory-mapped snapshot
+template <typename T>
+class MappedArray
+{
+public:
+    MappedArray() = default;
+
+    MappedArray(std::vector<T> items)
+        : m_owned(std::move(items))
+    {}
+
+    MappedArray(const T* mapped, size_t size)
+        : m_mapped(mapped)
+        , m_mappedSize(size)
+    {}
+
+    bool     empty() const { return size() == 0; }
+    size_t   size() const  { return m_mapped != nullptr ? m_mappedSize : m_owned.size(); }
+    const T* data() const  { return m_mapped != nullptr ? m_mapped : m_owned.data(); }
+
+    const T& operator[](size_t index) const { return data()[index]; }
+    const T& back() const                   { return data()[size() - 1]; }
+    const T* begin() const                  { return data(); }
+    const T* end() const                    { return data() + size(); }
+
+    // owned items for modification, mapped ones are copied first
+    std::vector<T>& mutate()
+    {
+        if (m_mapped != nullptr)
+        {
+            m_owned.assign(m_mapped, m_mapped + m_mappedSize);
+            m_mapped = nullptr;
+        }
+
+        return m_owned;
+    }
+
+private:
+    std::vector<T> m_owned;
+    const T*       m_mapped     = nullptr;
+    size_t         m_mappedSize = 0;
+};
+
+// Whole file mapped into memory for reading. Pages are shared between processes which map the same file
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path)
+    {
+#if defined _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+
+        LARGE_INTEGER size;
+        HANDLE mapping = GetFileSizeEx(file, &size) && size.QuadPart != 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        if (mapping != nullptr)
+        {
+            m_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            m_size = m_data != nullptr ? static_cast<size_t>(size.QuadPart) : 0;
+            CloseHandle(mapping);
+        }
+
+        CloseHandle(file);
+#else
+        int file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+            return;
+
+        struct stat info;
+        if (fstat(file, &info) == 0 && info.st_size != 0)
+        {
+            void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, file, 0);
+            if (data != MAP_FAILED)
+            {
+                m_data = static_cast<const char*>(data);
+                m_size = static_cast<size_t>(info.st_size);
+            }
+        }
+
+        close(file);
+#endif
+    }
+
+    ~MappedFile()
+    {
+        if (m_data == nullptr)
+            return;
+
+#if defined _WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap(const_cast<char*>(m_data), m_size);
+#endif
+    }
+
+    bool        isGood() const { return m_data != nullptr; }
+    const char* data() const   { return m_data; }
+    size_t      size() const   { return m_size; }
+
+private:
+    const char* m_data = nullptr;
+    size_t      m_size = 0;
+
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Snapshot is a header followed by sections. Section is 64-bit size in bytes and raw items, padded to k_alignment.
+// Items are stored as is, so the header records the layout of the writer: snapshot is only readable by the same version
+// built for the same platform. Any change of stored structures must increment k_version.
+namespace snapshot
+{
+    static const uint32_t k_version   = 6;
+    static const size_t   k_alignment = 8;
+
+    struct Header
+    {
+        char     m_magic[8];
+        uint32_t m_version;
+        uint32_t m_byteOrder;       // k_byteOrder as written
+        uint32_t m_sizeofSize;      // sizeof(size_t)
+        uint32_t m_reserved;
+    };
+
+    static const char     k_magic[8]  = { 'I', 'S', 'C', 'H', 'E', 'C', 'K', '\0' };
+    static const uint32_t k_byteOrder = 0x01020304;
+}
+
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(const std::string& path)
+        : m_file(path, std::ios::binary | std::ios::trunc)
+    {
+        snapshot::Header header = {};
+        memcpy(header.m_magic, snapshot::k_magic, sizeof(header.m_magic));
+        header.m_version    = snapshot::k_version;
+        header.m_byteOrder  = snapshot::k_byteOrder;
+        header.m_sizeofSize = sizeof(size_t);
+
+        writeRaw(&header, sizeof(header));
+    }
+
+    bool isGood() const { return m_file.good(); }
+
+    template <typename T>
+    void write(const T* items, size_t count)
+    {
+        static_assert(std::is_trivially_copyable<T>::value && alignof(T) <= snapshot::k_alignment, "only plain data is stored as is");
+        static_assert(std::has_unique_object_representations<T>::value, "padding bytes would make snapshots differ");
+
+        uint64_t bytes = count * sizeof(T);
+        writeRaw(&bytes, sizeof(bytes));
+        writeRaw(items, static_cast<size_t>(bytes));
+
+        static const char k_padding[snapshot::k_alignment] = {};
+        writeRaw(k_padding, (snapshot::k_alignment - bytes % snapshot::k_alignment) % snapshot::k_alignment);
+    }
+
+    template <typename T>
+    void write(const MappedArray<T>& items) { write(items.data(), items.size()); }
+
+    template <typename T>
+    void writeValue(const T& value)         { write(&value, 1); }
+
+private:
+    std::ofstream m_file;
+
+    void writeRaw(const void* data, size_t size)
+    {
+        m_file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    }
+};
+
+// Sections are read in order they were written. If the snapshot is malformed, reading returns empty arrays
+// and the reader becomes not good, so the caller checks isGood() once after all sections are read.
+// Only the layout is validated: contents of the snapshot are trusted.
+class SnapshotReader
+{
+public:
+    SnapshotReader(const char* data, size_t size)
+        : m_data(data)
+        , m_size(size)
+        , m_position(sizeof(snapshot::Header))
+        , m_isGood(false)
+    {
+        snapshot::Header header;
+        if (data == nullptr || size < sizeof(header))
+            return;
+
+        memcpy(&header, data, sizeof(header));
+        m_isGood = 0 == memcmp(header.m_magic, snapshot::k_magic, sizeof(header.m_magic))
+                && header.m_version    == snapshot::k_version
+                && header.m_byteOrder  == snapshot::k_byteOrder
+                && header.m_sizeofSize == sizeof(size_t);
+    }
+
+    bool isGood() const  { return m_isGood; }
+    bool isAtEnd() const { return m_position == m_size; }    // every section is read
+
+    template <typename T>
+    MappedArray<T> read()
+    {
+        static_assert(std::is_trivially_copyable<T>::value && alignof(T) <= snapshot::k_alignment, "only plain data is stored as is");
+
+        uint64_t bytes = 0;
+        if (!m_isGood || m_size - m_position < sizeof(bytes))
+            return fail<T>();
+
+        memcpy(&bytes, m_data + m_position, sizeof(bytes));
+        m_position += sizeof(bytes);
+
+        uint64_t padded = bytes + (snapshot::k_alignment - bytes % snapshot::k_alignment) % snapshot::k_alignment;
+        if (bytes % sizeof(T) != 0 || padded > m_size - m_position)
+            return fail<T>();
+
+        const T* items = reinterpret_cast<const T*>(m_data + m_position);
+        m_position += static_cast<size_t>(padded);
+        return MappedArray<T>(items, static_cast<size_t>(bytes / sizeof(T)));
+    }
+
+    template <typename T>
+    T readValue()
+    {
+        MappedArray<T> value = read<T>();
+        if (value.size() != 1)
+        {
+            fail<T>();
+            return T();
+        }
+
+        return value[0];
+    }
+
+private:
+    const char* m_data;
+    size_t      m_size;
+    size_t      m_position;
+    bool        m_isGood;
+
+    template <typename T>
+    MappedArray<T> fail()
+    {
+        m_isGood = false;
+        return MappedArray<T>();
+    }
+};
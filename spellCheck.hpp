@@ -2,11 +2,28 @@
 #include <algorithm>
 #include <numeric>
 #include <string>
+#include <string_view>
 #include <cstring>
 #include <list>
 #include <array>
+#include <limits>
 #include <vector>
 #include <cassert>
+#include <cstdint>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <type_traits>
+
+#include "bkTree.hpp"
+#include "tokenTrie.hpp"
+#include "batchDistance.hpp"
+#include "tokenArena.hpp"
+#include "parallelBuild.hpp"
+#include "prefilter.hpp"
+#include "deletionIndex.hpp"
+#include "queryStats.hpp"
+#include "utf8.hpp"
 
 #ifdef max
 #undef max
@@ -40,205 +57,1398 @@ public:
         char operator()(char c) const { return c; }
     };
 
+    // optional indexes and tweaks, see fields for details
+    struct Options
+    {
+        // Build metric tree over vocabulary. It speeds up non-incremental getCorrections() for large vocabularies,
+        // but costs a lot of distance computations in constructor
+        bool m_bkTree;
+
+        // Build prefix tree over vocabulary, it's needed for Session
+        bool m_trie;
+
+        // Group vocabulary into batches of equal-length words for SIMD distance computation, see BatchDistance
+        bool m_batches;
+
+        // Threads for tokenization and deduplication of vocabulary: 1 is serial build, 0 is hardware concurrency.
+        // Vocabulary and indexes don't depend on it. IncrementalSearch also shards its items, trigram index and posting lists.
+        // Token arena, trie, SIMD batches and prefilter are deliberately serial: they are linear passes over the vocabulary,
+        // about 1% of the build time. BK-tree is serial too, its shape depends on insertion order. See "build" cases of benchmark.cpp
+        unsigned m_buildThreads;
+
+        // Prefilter::Kind flags: cheap lower bounds which reject candidates before distance computation
+        unsigned m_prefilters;
+
+        // Max distance of symmetric deletion index, 0 is no index. It trades a lot of memory for latency of non-incremental
+        // getCorrections(): tokens within this distance are found without the vocabulary scan, see DeletionIndex
+        unsigned m_deletionDistance;
+
+        // Corrections of equal distance are ordered by descending corpus frequency of tokens instead of vocabulary order,
+        // it's needed for getLikelyCorrections(). Order of tokens takes 8 bytes per token
+        bool m_frequencyOrder;
+
+        Options() : m_bkTree(false), m_trie(false), m_batches(true), m_buildThreads(1), m_prefilters(Prefilter::eALL), m_deletionDistance(0), m_frequencyOrder(false) {}
+    };
+
     // with vocabulary
     template <typename StringsArray, typename CaseConvertor = NoCaseConversion>
-    explicit SpellCheck(const StringsArray& text, CaseConvertor changeCase = NoCaseConversion())
+    explicit SpellCheck(const StringsArray& text, CaseConvertor changeCase = NoCaseConversion(), const Options& options = Options())
+    {
+        std::vector<std::string> tokens;
+        std::vector<uint32_t>    frequencies;
+        for (std::pair<std::string, uint32_t>& token : collectTokens(text, changeCase, options.m_buildThreads))
+        {
+            tokens.push_back(std::move(token.first));
+            frequencies.push_back(token.second);
+        }
+
+        m_tokens      = TokenArena(tokens);
+        m_frequencies = MappedArray<uint32_t>(std::move(frequencies));
+
+        if (options.m_frequencyOrder)
+            buildFrequencyOrder();
+
+        std::vector<TokenArena::Id> utf8Tokens;
+        for (size_t i = 0; i < tokens.size(); ++i)
+            if (!utf8::isAscii(tokens[i]))
+                utf8Tokens.push_back(static_cast<TokenArena::Id>(i));
+
+        m_utf8Tokens = MappedArray<TokenArena::Id>(std::move(utf8Tokens));
+
+        if (options.m_bkTree)
+            buildBkTree();
+
+        if (options.m_trie)
+            m_trie = TokenTrie(m_tokens);
+
+        // non-ASCII tokens are not batched anyway, see scanUtf8()
+        bool isBatchable = std::all_of(tokens.begin(), tokens.end(), [](const std::string& token) { return token.size() <= BatchDistance::k_maxLength || !utf8::isAscii(token); });
+        if (options.m_batches && isBatchable)
+            m_batches = BatchDistance(m_tokens);
+
+        m_prefilter = Prefilter(m_tokens, options.m_prefilters);
+
+        if (options.m_deletionDistance != 0)
+            m_deletions = DeletionIndex(m_tokens, std::min(options.m_deletionDistance, DeletionIndex::k_maxDistance));
+    }
+
+    // Vocabulary and indexes from the snapshot, see snapshot.hpp. Arrays are used in place, so snapshot memory must outlive SpellCheck
+    explicit SpellCheck(SnapshotReader& reader)
+        : m_tokens(reader)
+        , m_utf8Tokens(reader.read<TokenArena::Id>())
+        , m_frequencies(reader.read<uint32_t>())
+        , m_byFrequency(reader.read<TokenArena::Id>())
+        , m_ranks(reader.read<uint32_t>())
+        , m_bkTree(reader)
+        , m_trie(reader)
+        , m_batches(reader)
+        , m_prefilter(reader)
+        , m_deletions(reader)
+    {}
+
+    // members are written in order of declaration, which is the order of reading
+    void save(SnapshotWriter& writer) const
+    {
+        m_tokens.save(writer);
+        writer.write(m_utf8Tokens);
+        writer.write(m_frequencies);
+        writer.write(m_byFrequency);
+        writer.write(m_ranks);
+        m_bkTree.save(writer);
+        m_trie.save(writer);
+        m_batches.save(writer);
+        m_prefilter.save(writer);
+        m_deletions.save(writer);
+    }
+
+    struct Correction
+    {
+        unsigned         m_distance;
+        std::string_view m_word;        // refers to the vocabulary
+        TokenArena::Id   m_token;       // vocabulary position, see getVocabulary()
+        uint32_t         m_rank = 0;    // order of equal distances: vocabulary position or frequency rank, see Options::m_frequencyOrder
+    };
+
+    typedef std::list<Correction> Corrections;
+
+    // sorted and unique tokens
+    const TokenArena& getVocabulary() const { return m_tokens; }
+
+    // occurrences of the vocabulary token in the text
+    uint32_t getFrequency(TokenArena::Id token) const { return m_frequencies[token]; }
+
+    // empty unless Options::m_deletionDistance is set
+    const DeletionIndex& getDeletionIndex() const { return m_deletions; }
+
+    // 'maxDistance' value for unbounded distance computation
+    static const unsigned k_noLimit = std::numeric_limits<unsigned>::max();
+
+    // scratch memory of distance kernels, see below
+    class Workspace;
+
+    // Get a list of correction suggestions. In case of 'isIncremental', don't count insertions past the end if 'initialWord', 
+    // assume that user will type insufficient chars later
+    // Corrections are sorted by distance, equal distances are sorted by vocabulary order or by frequency, see Options::m_frequencyOrder.
+    //
+    // Non-incremental lookup uses BK-tree if it's enabled in Options. Incremental distance is not a metric
+    // (it's asymmetric and 'abc' ~ 'abcd' ~ 'abce' while 'abcd' !~ 'abce'), so the triangle inequality can't prune anything
+    // and incremental lookup always falls back to the full vocabulary scan.
+    template <typename String>
+    Corrections getCorrections(const String& initialWord, unsigned maxCorrections, bool isIncremental = false) const
+    {
+        Corrections corrections;
+        CorrectionsCollector collector(corrections, maxCorrections);
+        collectCorrections(initialWord, isIncremental, collector);
+        return corrections;
+    }
+
+    // Fixed-capacity alternative to Corrections: the best corrections are kept sorted in the inline array.
+    // 'maxCorrections' may be less than 'Capacity'.
+    template <size_t Capacity>
+    class TopCorrections
+    {
+    public:
+        explicit TopCorrections(size_t maxCorrections = Capacity)
+            : m_items()
+            , m_size(0)
+            , m_maxSize(std::min(maxCorrections, Capacity))
+        {}
+
+        bool   empty() const { return m_size == 0; }
+        size_t size() const  { return m_size; }
+        void   clear()       { m_size = 0; }
+
+        const Correction& operator[](size_t index) const { return m_items[index]; }
+        const Correction& front() const                  { return m_items[0]; }
+        const Correction* begin() const                  { return m_items.data(); }
+        const Correction* end() const                    { return m_items.data() + m_size; }
+
+        unsigned getWorstDistance() const
+        {
+            if (m_maxSize == 0)
+                return 0;   // nothing is accepted
+
+            return m_size < m_maxSize ? k_noLimit : m_items[m_size - 1].m_distance;
+        }
+
+        // the same as addCorrection(): the worst item is dropped if there is no room
+        void add(const Correction& correction)
+        {
+            if (m_maxSize == 0 || (m_size == m_maxSize && !isBetterCorrection(correction, m_items[m_size - 1])))
+                return;
+
+            size_t position = m_size < m_maxSize ? m_size++ : m_size - 1;
+            for (; position > 0 && isBetterCorrection(correction, m_items[position - 1]); --position)
+                m_items[position] = m_items[position - 1];
+
+            m_items[position] = correction;
+        }
+
+    private:
+        std::array<Correction, Capacity> m_items;
+        size_t                           m_size;
+        size_t                           m_maxSize;
+    };
+
+    // The same as getCorrections(), but corrections are written into caller-owned 'corrections', which also limits their count.
+    // Linear scan doesn't allocate memory once thread-local scratch buffers have grown to the query size,
+    // while BK-tree lookup still allocates its stack of pending nodes.
+    template <typename String, size_t Capacity>
+    void getCorrections(const String& initialWord, TopCorrections<Capacity>& corrections, bool isIncremental = false) const
+    {
+        corrections.clear();
+        collectCorrections(initialWord, isIncremental, corrections);
+    }
+
+    // Alternative engine: only corrections within the deletion index distance (Options::m_deletionDistance), no vocabulary scan.
+    // They are the same as of getCorrections() if there are enough of them, otherwise farther corrections are missing.
+    // Requires the deletion index and a narrow string
+    template <typename String>
+    Corrections getNearCorrections(const String& initialWord, unsigned maxCorrections) const
+    {
+        Corrections corrections;
+        CorrectionsCollector collector(corrections, maxCorrections);
+        addNearCandidates(initialWord, collector);
+        return corrections;
+    }
+
+    template <typename String, size_t Capacity>
+    void getNearCorrections(const String& initialWord, TopCorrections<Capacity>& corrections) const
+    {
+        corrections.clear();
+        addNearCandidates(initialWord, corrections);
+    }
+
+    // Alternative engine with early termination: the vocabulary is scanned from the most frequent tokens, and the scan stops
+    // once 'maxCorrections' corrections within 'stopDistance' are found. Common typos of common words stop after a small part
+    // of the vocabulary. Tokens at distance 0 are found before the scan, and every token after the stop is less frequent
+    // than found ones, so corrections are the same as of getCorrections() if 'stopDistance' is 0 or 1.
+    // Larger 'stopDistance' may miss nearer but less frequent tokens.
+    // Requires a narrow string. Without Options::m_frequencyOrder it's the same as getCorrections()
+    template <typename String>
+    Corrections getLikelyCorrections(const String& initialWord, unsigned maxCorrections, unsigned stopDistance = 1, bool isIncremental = false) const
+    {
+        Corrections corrections;
+        CorrectionsCollector collector(corrections, maxCorrections);
+        addLikelyCandidates(initialWord, isIncremental, stopDistance, collector);
+        return corrections;
+    }
+
+    template <typename String, size_t Capacity>
+    void getLikelyCorrections(const String& initialWord, TopCorrections<Capacity>& corrections, unsigned stopDistance = 1, bool isIncremental = false) const
+    {
+        corrections.clear();
+        addLikelyCandidates(initialWord, isIncremental, stopDistance, corrections);
+    }
+
+    // Lookup into any collector with add(const Correction&) and getWorstDistance() methods, like TopCorrections.
+    // Collector may reject some corrections, e.g. of tokens which are no longer valid, it's not cleared before lookup
+    template <typename String, typename Collector>
+    void collectCorrections(const String& initialWord, bool isIncremental, Collector& corrections) const
+    {
+        queryStats::Scope scope;
+
+        if (isUtf8Query(initialWord))
+            return scanUtf8(initialWord, isIncremental, true, k_noLimit, corrections);
+
+        if (!isIncremental && !m_deletions.empty() && isNarrowString(initialWord))
+        {
+            // every token within the index distance is found, so lookup is complete if these tokens fill 'corrections'
+            addNearCandidates(initialWord, corrections);
+            if (corrections.getWorstDistance() != k_noLimit)
+                return;
+
+            // otherwise the rest of corrections are farther tokens, they are searched as usual
+            FartherCollector<Collector> farther { corrections, m_deletions.getMaxDistance() };
+            return collectAllCorrections(initialWord, isIncremental, farther);
+        }
+
+        collectAllCorrections(initialWord, isIncremental, corrections);
+    }
+
+    // Candidates rejected by prefilters and ones passed to the distance kernel by all lookups since the last reset.
+    // Typing sessions reuse DP state instead, so they are not counted
+    Prefilter::Stats getPrefilterStats() const
+    {
+        Prefilter::Stats stats;
+        stats.m_filtered  = m_prefilterStats.m_filtered.load(std::memory_order_relaxed);
+        stats.m_evaluated = m_prefilterStats.m_evaluated.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void resetPrefilterStats() const
+    {
+        m_prefilterStats.m_filtered  = 0;
+        m_prefilterStats.m_evaluated = 0;
+    }
+
+    // Default executor for getCorrectionsParallel(), see parallelBuild.hpp
+    typedef ::AsyncExecutor AsyncExecutor;
+
+    // The same as getCorrections(), but vocabulary is split into 'chunks' (hardware concurrency by default),
+    // every chunk keeps its own top 'maxCorrections', then they are merged. Results are exactly the same as serial ones,
+    // because corrections with equal distance are ordered by rank regardless of the chunk.
+    // BK-tree and deletion index lookups are serial, so they are used as is.
+    template <typename String, typename Executor = AsyncExecutor>
+    Corrections getCorrectionsParallel(const String& initialWord, unsigned maxCorrections, bool isIncremental = false, 
+                                       unsigned chunks = 0, const Executor& executor = Executor()) const
+    {
+        // too small chunks are not worth a thread
+        static const size_t k_minChunkSize = 1024;
+
+        size_t chunkCount = chunks != 0 ? chunks : std::max(1u, std::thread::hardware_concurrency());
+        chunkCount = std::min(chunkCount, (m_tokens.size() + k_minChunkSize - 1) / k_minChunkSize);
+
+        bool isIndexed = !isIncremental && (!m_bkTree.empty() || !m_deletions.empty()) && isNarrowString(initialWord);
+        if (chunkCount <= 1 || isIndexed || isUtf8Query(initialWord))
+            return getCorrections(initialWord, maxCorrections, isIncremental);
+
+        std::vector<Corrections> chunkCorrections(chunkCount);
+        // counts of executor threads go to totals only, per query stats of the calling thread don't include them
+        queryStats::Scope scope;
+        executor(chunkCount, [&](size_t chunk)
+        {
+            queryStats::Scope chunkScope;
+            CorrectionsCollector collector(chunkCorrections[chunk], maxCorrections);
+            scanChunk(initialWord, isIncremental, chunk, chunkCount, collector);
+        });
+
+        Corrections corrections;
+        for (const Corrections& chunk : chunkCorrections)
+            for (const Correction& correction : chunk)
+                addCorrection(corrections, maxCorrections, correction);
+
+        CorrectionsCollector collector(corrections, maxCorrections);
+        scanUtf8(initialWord, isIncremental, false, k_noLimit, collector);
+        return corrections;
+    }
+
+    // Get either Optimal String Alignment distance or its 'incremental' version. 
+    // Note that parameters order is important in incremental version, 
+    // because it's asymmetric ('abc.*' matches 'abcd', but 'abcd.*' does not match 'abc')
+    //
+    // See getCorrections() for incremental explanations or optimalStringAlignementDistance() for OSA distance details
+    //
+    // If 'maxDistance' is specified, the exact distance is returned only if it doesn't exceed 'maxDistance', 
+    // otherwise the result is just some value greater than 'maxDistance'. This allows to stop computation early.
+    //
+    // DP memory is taken from 'workspace', the one of the calling thread by default
+    template <typename String, typename OtherString>
+    static unsigned getSmartDistance(const String& correctWord, const OtherString& initialWord, bool isIncremental = false, unsigned maxDistance = k_noLimit,
+                                     Workspace& workspace = Workspace::getLocal())
+    {
+        if (!isIncrementalMatch(getSize(correctWord), getSize(initialWord), isIncremental))
+        {
+            // plain OSA distance, use faster kernel if possible
+            if (isBitParallelSupported(correctWord, initialWord))
+                return bitParallelDistance(correctWord, initialWord, maxDistance);
+
+            if (maxDistance < std::max(getSize(correctWord), getSize(initialWord)))
+                return bandedDistance(correctWord, initialWord, maxDistance, workspace);
+
+            return optimalStringAlignementDistance(correctWord, initialWord, k_noLimit, workspace);
+        }
+
+        return incrementalDistance(correctWord, initialWord, maxDistance, workspace);
+    }
+
+    // Reference incremental distance: full DP matrix, then insertions past the end of word are counted by the backtrace.
+    // getSmartDistance() uses incrementalDistance() instead, which gives exactly the same result
+    template <typename String, typename OtherString>
+    static unsigned backtraceIncrementalDistance(const String& correctWord, const OtherString& initialWord, unsigned maxDistance = k_noLimit,
+                                                 Workspace& workspace = Workspace::getLocal())
+    {
+        size_t width  = getSize(correctWord) + 1;
+        size_t height = getSize(initialWord) + 1;
+
+        if (!fillOsaMatrices(correctWord, initialWord, maxDistance, workspace))
+            return maxDistance + 1;
+
+        // ignore insertions past the end of word, assume user will type them later.
+        // The backtrace ends with them: it goes left along the last row of the alternatives matrix while they are insertions
+        const CorrectionType* lastRow = &workspace.m_corrections[(height - 1) * width];
+
+        unsigned insertionsPastEnd = 0;
+        for (size_t column = width - 1; column != 0 && lastRow[column] == CorrectionType::eINSERTION; --column)
+            ++insertionsPastEnd;
+
+        return workspace.m_distances[width * height - 1] - insertionsPastEnd;
+    }
+
+    // OSA distance ignoring insertions past the end of 'target', without the backtrace. Trailing insertions of the backtrace
+    // are the tail of the last DP row, where insertion is the chosen alternative, so the distance is the cell where this chain
+    // of insertions starts. Alternatives are chosen exactly as optimalStringAlignementDistance() does, e.g. insertion wins
+    // the tie with substitution, so the result is the same as of backtraceIncrementalDistance(). It's not the plain minimum
+    // of the last row: a match or a deletion ends the chain even if the insertion is as cheap.
+    // Three rolling rows are enough, because transposition looks back at (i-2, j-2).
+    template <typename String, typename OtherString>
+    static unsigned incrementalDistance(const String& source, const OtherString& target, unsigned maxDistance = k_noLimit,
+                                        Workspace& workspace = Workspace::getLocal())
+    {
+        size_t width  = getSize(source) + 1;
+        size_t height = getSize(target) + 1;
+
+        unsigned* rows = Workspace::grow(workspace.m_distances, 3 * width);
+
+        unsigned* thisRow  = &rows[0];
+        unsigned* prevRow  = &rows[width];
+        unsigned* prevRow2 = &rows[2 * width];
+
+        std::iota(thisRow, thisRow + width, 0);    // 0,1,2,...,width
+        unsigned incremental = 0;                   // of the last row, empty 'target' is all insertions
+
+        for (size_t i = 1, im = 0; i < height; ++i, ++im)
+        {
+            std::swap(prevRow2, prevRow);
+            std::swap(prevRow, thisRow);
+
+            thisRow[0]      = static_cast<unsigned>(i);
+            incremental     = thisRow[0];           // deletion, stops the chain of insertions
+            unsigned rowMin = thisRow[0];
+
+            for (size_t j = 1, jn = 0; j < width; ++j, ++jn)
+            {
+                if (source[jn] == target[im])
+                {
+                    thisRow[j]  = prevRow[j - 1];
+                    incremental = thisRow[j];
+                }
+                else
+                {
+                    Alternative correction;
+
+                    if (i > 1 && j > 1 && source[jn] == target[im - 1] && source[jn - 1] == target[im])
+                        correction.propose(CorrectionType::eTRANSPOSITION, prevRow2[j - 2] + TRANSPOSITION);
+
+                    correction.propose(CorrectionType::eINSERTION,    thisRow[j - 1] + INSERTION);
+                    correction.propose(CorrectionType::eSUBSTITUTION, prevRow[j - 1] + SUBSTITUTION);
+                    correction.propose(CorrectionType::eDELETION,     prevRow[j]     + DELETION);
+
+                    thisRow[j] = correction.bestDistance;
+                    if (correction.bestType != CorrectionType::eINSERTION)
+                        incremental = thisRow[j];
+                }
+
+                rowMin = std::min(rowMin, thisRow[j]);
+            }
+
+            queryStats::add(&QueryStats::m_dpCells, width - 1);
+
+            // row minimums never decrease, and the incremental distance is a cell of the last row
+            if (maxDistance != k_noLimit && rowMin > maxDistance)
+                return maxDistance + 1;
+        }
+
+        return incremental;
+    }
+
+    // Typing session: keeps DP rows of the distance between every query prefix and every vocabulary prefix (trie node),
+    // so appending a character computes a single row for the whole vocabulary, and removing it just drops the row.
+    // Corrections are the same as getCorrections() of the whole query would return.
+    //
+    // Rows need Options::m_trie, without it every lookup scans the vocabulary like getCorrections().
+    // Session refers to SpellCheck, so it must not outlive (or be moved from) SpellCheck.
+    class Session
+    {
+    public:
+        explicit Session(const SpellCheck& spellCheck)
+            : m_spellCheck(&spellCheck)
+        {
+            const TokenTrie& trie = getTrie();
+
+            // query is empty: all trie prefixes are insertions
+            m_distances.resize(trie.size());
+            m_incremental.resize(trie.size(), 0);
+            for (TokenTrie::Node node = 0; node < trie.size(); ++node)
+                m_distances[node] = trie.getDepth(node);
+        }
+
+        const std::string& getQuery() const { return m_query; }
+
+        void push(char c)
+        {
+            const TokenTrie& trie = getTrie();
+            const size_t     size = trie.size();
+
+            m_query += c;
+            if (trie.empty())
+                return;
+
+            size_t row = m_query.size();
+
+            m_distances.resize((row + 1) * size);
+            m_incremental.resize((row + 1) * size);
+
+            unsigned*       distance     = &m_distances[row * size];
+            unsigned*       incremental  = &m_incremental[row * size];
+            const unsigned* previous     = &m_distances[(row - 1) * size];
+            const unsigned* previous2    = row > 1 ? &m_distances[(row - 2) * size] : nullptr;
+            const char      previousChar = row > 1 ? m_query[row - 2] : '\0';
+
+            queryStats::add(&QueryStats::m_dpCells, size);
+
+            distance[TokenTrie::k_root]    = static_cast<unsigned>(row);    // deletions
+            incremental[TokenTrie::k_root] = static_cast<unsigned>(row);
+
+            // the same as optimalStringAlignementDistance(), but column is a trie node instead of position in a word
+            for (TokenTrie::Node node = 1; node < size; ++node)
+            {
+                TokenTrie::Node parent = trie.getParent(node);
+                char            nodeChar = trie.getChar(node);
+
+                if (nodeChar == c)
+                {
+                    distance[node]    = previous[parent];
+                    incremental[node] = distance[node];
+                    continue;
+                }
+
+                Alternative correction;
+
+                if (row > 1 && parent != TokenTrie::k_root && nodeChar == previousChar && trie.getChar(parent) == c)
+                    correction.propose(CorrectionType::eTRANSPOSITION, previous2[trie.getParent(parent)] + TRANSPOSITION);
+
+                correction.propose(CorrectionType::eINSERTION,    distance[parent] + INSERTION);
+                correction.propose(CorrectionType::eSUBSTITUTION, previous[parent] + SUBSTITUTION);
+                correction.propose(CorrectionType::eDELETION,     previous[node]   + DELETION);
+
+                distance[node] = correction.bestDistance;
+
+                // the same as backtrace: trailing insertions are ignored in incremental search
+                incremental[node] = correction.bestType == CorrectionType::eINSERTION ? incremental[parent] : distance[node];
+            }
+        }
+
+        void pop()
+        {
+            assert(!m_query.empty());
+            m_query.pop_back();
+
+            size_t rowsSize = (m_query.size() + 1) * getTrie().size();
+            m_distances.resize(rowsSize);
+            m_incremental.resize(rowsSize);
+        }
+
+        // replace query, reusing rows of the common prefix
+        void setQuery(const std::string& query)
+        {
+            size_t common = std::mismatch(m_query.begin(), m_query.begin() + std::min(m_query.size(), query.size()), query.begin()).first - m_query.begin();
+
+            while (m_query.size() > common)
+                pop();
+
+            for (size_t i = common; i < query.size(); ++i)
+                push(query[i]);
+        }
+
+        // see SpellCheck::getCorrections()
+        Corrections getCorrections(unsigned maxCorrections, bool isIncremental = false) const
+        {
+            Corrections corrections;
+            CorrectionsCollector collector(corrections, maxCorrections);
+            collectCorrections(isIncremental, collector);
+            return corrections;
+        }
+
+        // allocation-free version, see SpellCheck::TopCorrections
+        template <size_t Capacity>
+        void getCorrections(TopCorrections<Capacity>& corrections, bool isIncremental = false) const
+        {
+            corrections.clear();
+            collectCorrections(isIncremental, corrections);
+        }
+
+    private:
+        const SpellCheck*     m_spellCheck;
+        std::string           m_query;
+        std::vector<unsigned> m_distances;       // row per query prefix, column per trie node
+        std::vector<unsigned> m_incremental;     // the same, but ignoring insertions past the end of query
+
+        const TokenTrie& getTrie() const { return m_spellCheck->m_trie; }
+
+        template <typename Collector>
+        void collectCorrections(bool isIncremental, Collector& corrections) const
+        {
+            queryStats::Scope scope;
+
+            // rows are byte distances, they are valid for ASCII queries and tokens only
+            if (getTrie().empty() || isUtf8Query(m_query))
+                return m_spellCheck->collectCorrections(m_query, isIncremental, corrections);
+
+            const TokenTrie&                   trie       = getTrie();
+            const size_t                       row        = m_query.size();
+            const MappedArray<TokenArena::Id>& utf8Tokens = m_spellCheck->m_utf8Tokens;
+
+            const unsigned* distance    = &m_distances[row * trie.size()];
+            const unsigned* incremental = &m_incremental[row * trie.size()];
+
+            size_t nextUtf8 = 0;
+            for (TokenArena::Id token = 0; token < m_spellCheck->m_tokens.size(); ++token)
+            {
+                if (nextUtf8 < utf8Tokens.size() && utf8Tokens[nextUtf8] == token)
+                {
+                    ++nextUtf8;
+                    continue;
+                }
+
+                size_t          tokenSize = m_spellCheck->m_tokens[token].size();
+                TokenTrie::Node node      = trie.getTokenNode(token);
+
+                unsigned tokenDistance = isIncrementalMatch(tokenSize, row, isIncremental) ? incremental[node] : distance[node];
+                m_spellCheck->addCandidate(corrections, tokenDistance, token);
+            }
+
+            m_spellCheck->scanUtf8(m_query, isIncremental, false, k_noLimit, corrections);
+        }
+    };
+
+    // Whether getSmartDistance() ignores trailing insertions: the query must be long enough and the word must be longer than query
+    static bool isIncrementalMatch(size_t correctSize, size_t initialSize, bool isIncremental)
+    {
+        static const size_t k_minIncrSearchLen = 3;
+        return isIncremental && initialSize >= k_minIncrSearchLen && correctSize > initialSize;
+    }
+
+    // Unrestricted Damerau-Levenshtein distance. Unlike OSA distance, it's a metric: DL("ca", "abc") == 2 <= DL("ca", "ac") + DL("ac", "abc").
+    // It never exceeds OSA distance, so it's a lower bound suitable for metric tree pruning.
+    // Only narrow strings are supported, see isNarrowString()
+    template <typename String, typename OtherString>
+    static unsigned damerauLevenshteinDistance(const String& source, const OtherString& target, Workspace& workspace = Workspace::getLocal())
+    {
+        // Lowrance-Wagner algorithm: https://en.wikipedia.org/wiki/Damerau%E2%80%93Levenshtein_distance#Distance_with_adjacent_transpositions
+        // matrix has extra leading row and column filled with 'infinity'
+        size_t sourceSize = getSize(source);
+        size_t targetSize = getSize(target);
+        size_t width      = sourceSize + 2;
+        size_t height     = targetSize + 2;
+        unsigned infinity = static_cast<unsigned>(sourceSize + targetSize);
+
+        unsigned*                  distanceMatrix = Workspace::grow(workspace.m_distances, width * height);
+        std::array<uint32_t, 256>& lastRow        = workspace.m_lastRows;    // last row where the character was seen in 'target'
+
+        distanceMatrix[0]     = infinity;
+        distanceMatrix[width] = infinity;
+        for (size_t j = 0; j <= sourceSize; ++j)
+        {
+            distanceMatrix[j + 1]         = infinity;
+            distanceMatrix[width + j + 1] = static_cast<unsigned>(j);
+        }
+
+        for (size_t i = 1; i <= targetSize; ++i)
+        {
+            size_t thisRow = (i + 1) * width;
+            size_t prevRow = i * width;
+            size_t lastMatchColumn = 0;
+
+            unsigned char targetChar = static_cast<unsigned char>(target[i - 1]);
+            distanceMatrix[thisRow]     = infinity;
+            distanceMatrix[thisRow + 1] = static_cast<unsigned>(i);
+
+            for (size_t j = 1; j <= sourceSize; ++j)
+            {
+                unsigned char sourceChar = static_cast<unsigned char>(source[j - 1]);
+                size_t   k    = lastRow[sourceChar];
+                size_t   l    = lastMatchColumn;
+                unsigned cost = SUBSTITUTION;
+
+                if (sourceChar == targetChar)
+                {
+                    cost = 0;
+                    lastMatchColumn = j;
+                }
+
+                unsigned distance = std::min({ distanceMatrix[prevRow + j] + cost,
+                                               distanceMatrix[thisRow + j] + INSERTION,
+                                               distanceMatrix[prevRow + j + 1] + DELETION,
+                                               distanceMatrix[k * width + l] + static_cast<unsigned>((i - k - 1) + TRANSPOSITION + (j - l - 1)) });
+
+                distanceMatrix[thisRow + j + 1] = distance;
+            }
+
+            lastRow[targetChar] = static_cast<uint32_t>(i);
+        }
+
+        // the next call expects zeros, only chars of 'target' were set
+        for (size_t i = 0; i < targetSize; ++i)
+            lastRow[static_cast<unsigned char>(target[i])] = 0;
+
+        queryStats::add(&QueryStats::m_dpCells, sourceSize * targetSize);
+        return distanceMatrix[width * height - 1];
+    }
+
+    // Bit-parallel kernel is limited by machine word size
+    static const size_t k_maxBitParallelSize = 64;
+
+    template <typename String, typename OtherString>
+    static bool isBitParallelSupported(const String& source, const OtherString& target)
+    {
+        return isNarrowString(source) && isNarrowString(target) && std::min(getSize(source), getSize(target)) <= k_maxBitParallelSize;
+    }
+
+    // The same OSA distance as optimalStringAlignementDistance(), but computed column by column using bit-vectors,
+    // so the whole column of DP matrix takes O(1) machine-word operations.
+    // Requires isBitParallelSupported(), i.e. narrow strings and at least one of them not longer than 64 chars.
+    //
+    // See H. Hyyro, "A bit-vector algorithm for computing Levenshtein and Damerau edit distances", 2003
+    template <typename String, typename OtherString>
+    static unsigned bitParallelDistance(const String& source, const OtherString& target, unsigned maxDistance = k_noLimit)
+    {
+        // distance is symmetric, so choose pattern (DP column) that fits into the machine word
+        if (getSize(target) > k_maxBitParallelSize)
+            return bitParallelDistance(target, source, maxDistance);
+
+        size_t patternSize = getSize(target);
+        size_t textSize    = getSize(source);
+        if (patternSize == 0)
+            return static_cast<unsigned>(textSize);
+
+        if (isLengthDifferenceExceeds(patternSize, textSize, maxDistance))
+            return maxDistance + 1;
+
+        // per-character match masks. Table is shared between calls and only touched bits are cleared afterwards
+        thread_local std::array<uint64_t, 256> s_matchMasks {};
+        for (size_t i = 0; i < patternSize; ++i)
+            s_matchMasks[static_cast<unsigned char>(target[i])] |= uint64_t(1) << i;
+
+        const uint64_t lastBit = uint64_t(1) << (patternSize - 1);
+
+        uint64_t verticalPositive = ~uint64_t(0);   // D[i][j] - D[i-1][j] == +1
+        uint64_t verticalNegative = 0;              // D[i][j] - D[i-1][j] == -1
+        uint64_t diagonalZero     = 0;              // D[i][j] == D[i-1][j-1]
+        uint64_t previousMatch    = 0;
+        unsigned distance         = static_cast<unsigned>(patternSize);
+        size_t   columns          = textSize;       // computed ones
+
+        for (size_t j = 0; j < textSize; ++j)
+        {
+            uint64_t match         = s_matchMasks[static_cast<unsigned char>(source[j])];
+            uint64_t transposition = ((~diagonalZero & match) << 1) & previousMatch;
+
+            diagonalZero = (((match & verticalPositive) + verticalPositive) ^ verticalPositive) | match | verticalNegative | transposition;
+
+            uint64_t horizontalPositive = verticalNegative | ~(diagonalZero | verticalPositive);
+            uint64_t horizontalNegative = verticalPositive & diagonalZero;
+
+            if (horizontalPositive & lastBit)
+                ++distance;
+            else if (horizontalNegative & lastBit)
+                --distance;
+
+            horizontalPositive = (horizontalPositive << 1) | 1;     // first row is 0,1,2,... (global alignment)
+            horizontalNegative = horizontalNegative << 1;
+
+            verticalPositive = horizontalNegative | ~(diagonalZero | horizontalPositive);
+            verticalNegative = horizontalPositive & diagonalZero;
+            previousMatch    = match;
+
+            // each of remaining columns may decrease the distance by 1 at most
+            size_t columnsLeft = textSize - j - 1;
+            if (distance > columnsLeft && distance - columnsLeft > maxDistance)
+            {
+                distance = maxDistance + 1;
+                columns  = j + 1;
+                break;
+            }
+        }
+
+        queryStats::add(&QueryStats::m_dpCells, patternSize * columns);
+
+        for (size_t i = 0; i < patternSize; ++i)
+            s_matchMasks[static_cast<unsigned char>(target[i])] = 0;
+
+        return distance;
+    }
+
+    // tokens of wide strings are runs of alphanumeric chars, the rest of chars are separators
+    static bool isTokenChar(int c) { return isalnum(c) != 0; }
+
+    // Narrow strings are UTF-8: tokens are runs of letters and digits of utf8::isAlnum(), see utf8::forEachToken()
+    template <typename String, typename StringList, typename CaseConvertor = NoCaseConversion>
+    static void tokenize(const String& input, StringList& insertInto,  CaseConvertor changeCase = NoCaseConversion())
+    {
+        using Token = typename StringList::value_type;
+        std::string nextToken;
+
+        if constexpr (std::is_convertible_v<const String&, std::string_view>)
+        {
+            auto addToken = [&insertInto, &nextToken](const char* data, size_t size)
+            {
+                if constexpr (std::is_constructible_v<Token, const char*, size_t>)
+                {
+                    insertInto.push_back(Token(data, size));
+                }
+                else
+                {
+                    nextToken.assign(data, size);
+                    insertInto.push_back(Token(nextToken.c_str()));
+                }
+            };
+
+            // lowercasing keeps offsets and token boundaries, so the whole text is folded at once and tokens are its slices
+            constexpr bool isWholeText = std::is_same_v<CaseConvertor, utf8::Lowercase> || std::is_same_v<CaseConvertor, NoCaseConversion>;
+
+            std::string_view text = input;
+            if constexpr (std::is_same_v<CaseConvertor, utf8::Lowercase>)
+            {
+                thread_local std::string s_lowercase;
+                s_lowercase.assign(text.data(), text.size());
+                utf8::lowercase(s_lowercase);
+                text = s_lowercase;
+            }
+
+            utf8::forEachToken(text, [&](size_t begin, size_t end)
+            {
+                if constexpr (isWholeText)
+                {
+                    addToken(text.data() + begin, end - begin);
+                }
+                else
+                {
+                    nextToken.assign(text.data() + begin, end - begin);
+                    applyCase(nextToken, changeCase);
+                    addToken(nextToken.data(), nextToken.size());
+                }
+            });
+        }
+        else
+        {
+            nextToken.reserve(getSize(input));
+
+            for(size_t i = 0; i < getSize(input); ++i)
+            {
+                int nextChar = input[i];
+                if(isTokenChar(nextChar))
+                {
+                    nextToken += changeCase(nextChar);
+                }
+                else if(!nextToken.empty())
+                {
+                    insertInto.push_back(Token(nextToken.c_str()));
+                    nextToken.clear();
+                }
+            }
+
+            if(!nextToken.empty())
+            {
+                insertInto.push_back(Token(nextToken.c_str()));
+                nextToken.clear();
+            }
+        }
+    }
+
+    // case conversion of a UTF-8 token: char convertors like tolower() are applied to ASCII chars only
+    template <typename CaseConvertor>
+    static void applyCase(std::string& token, CaseConvertor changeCase)
+    {
+        for (char& c : token)
+            if (static_cast<unsigned char>(c) < 0x80)
+                c = static_cast<char>(changeCase(c));
+    }
+
+    static void applyCase(std::string&, NoCaseConversion)        {}
+    static void applyCase(std::string& token, utf8::Lowercase)   { utf8::lowercase(token); }
+
+    // getSmartDistance() of UTF-8 strings in codepoints: an accented letter is a single substitution, not two
+    static unsigned getUtf8Distance(std::string_view correctWord, std::string_view initialWord, bool isIncremental = false, unsigned maxDistance = k_noLimit,
+                                    Workspace& workspace = Workspace::getLocal())
+    {
+        if (utf8::isAscii(correctWord) && utf8::isAscii(initialWord))
+            return getSmartDistance(correctWord, initialWord, isIncremental, maxDistance, workspace);
+
+        thread_local std::u32string s_correct, s_initial;
+        utf8::decode(correctWord, s_correct);
+        utf8::decode(initialWord, s_initial);
+        return getSmartDistance(s_correct, s_initial, isIncremental, maxDistance, workspace);
+    }
+
+private:
+    enum COST
+    {
+        DELETION = 1,
+        INSERTION = 1,
+        SUBSTITUTION = 1,
+        TRANSPOSITION = 1,
+    };
+
+    TokenArena                  m_tokens;
+    MappedArray<TokenArena::Id> m_utf8Tokens;   // ascending ids of non-ASCII tokens, see scanUtf8()
+    MappedArray<uint32_t>       m_frequencies;  // occurrences of every token in the text
+    MappedArray<TokenArena::Id> m_byFrequency;  // tokens by descending frequency, empty unless Options::m_frequencyOrder
+    MappedArray<uint32_t>       m_ranks;        // positions of tokens in m_byFrequency
+    BkTree                      m_bkTree;
+    TokenTrie                   m_trie;
+    BatchDistance               m_batches;
+    Prefilter                   m_prefilter;
+    DeletionIndex               m_deletions;
+
+    // lookups are counted once per scan, so concurrent lookups rarely touch these
+    struct AtomicStats
     {
-        for (const auto& sentence : text)
-            tokenize(sentence, m_tokens, changeCase);
+        std::atomic<uint64_t> m_filtered  { 0 };
+        std::atomic<uint64_t> m_evaluated { 0 };
+
+        AtomicStats() = default;
+        AtomicStats(const AtomicStats& right)
+            : m_filtered(right.m_filtered.load())
+            , m_evaluated(right.m_evaluated.load())
+        {}
+
+        void add(const Prefilter::Stats& stats)
+        {
+            m_filtered.fetch_add(stats.m_filtered, std::memory_order_relaxed);
+            m_evaluated.fetch_add(stats.m_evaluated, std::memory_order_relaxed);
+        }
+    };
 
-        // remove duplicates
-        std::sort(m_tokens.begin(), m_tokens.end());
-        m_tokens.erase(std::unique(m_tokens.begin(), m_tokens.end()), m_tokens.end());
+    mutable AtomicStats m_prefilterStats;
+
+    void countCandidates(const Prefilter::Stats& stats) const
+    {
+        m_prefilterStats.add(stats);
+        queryStats::add(&QueryStats::m_candidatesEvaluated, stats.m_evaluated);
+        queryStats::add(&QueryStats::m_candidatesPruned, stats.m_filtered);
     }
 
-    struct Correction
+    // sorted and unique tokens of 'text' and their counts. Shards of text are tokenized and counted in parallel, then merged
+    template <typename StringsArray, typename CaseConvertor>
+    static std::vector<std::pair<std::string, uint32_t>> collectTokens(const StringsArray& text, CaseConvertor changeCase, unsigned threads)
     {
-        unsigned           m_distance;
-        const std::string* m_word;
-    };
+        size_t textSize   = std::size(text);
+        size_t shardCount = parallelBuild::getShardCount(threads, textSize);
 
-    typedef std::list<Correction> Corrections;
+        std::vector<std::vector<std::pair<std::string, uint32_t>>> shards(shardCount);
+        AsyncExecutor()(shardCount, [&](size_t shard)
+        {
+            size_t first = parallelBuild::getShardBegin(textSize, shardCount, shard);
+            size_t last  = parallelBuild::getShardBegin(textSize, shardCount, shard + 1);
 
-    // Get a list of correction suggestions. In case of 'isIncremental', don't count insertions past the end if 'initialWord', 
-    // assume that user will type insufficient chars later
-    template <typename String>
-    Corrections getCorrections(const String& initialWord, unsigned maxCorrections, bool isIncremental = false) const
+            std::vector<std::string> tokens;
+            for (auto sentence = std::next(std::begin(text), first); first != last; ++sentence, ++first)
+                tokenize(*sentence, tokens, changeCase);
+
+            std::sort(tokens.begin(), tokens.end());
+
+            std::vector<std::pair<std::string, uint32_t>>& counts = shards[shard];
+            for (std::string& token : tokens)
+            {
+                if (!counts.empty() && counts.back().first == token)
+                    ++counts.back().second;
+                else
+                    counts.emplace_back(std::move(token), 1);
+            }
+        });
+
+        return parallelBuild::mergeCounts(std::move(shards));
+    }
+
+    // the most frequent tokens first, equal frequencies in vocabulary order
+    void buildFrequencyOrder()
     {
-        Corrections corrections;
+        std::vector<TokenArena::Id> byFrequency(m_tokens.size());
+        std::iota(byFrequency.begin(), byFrequency.end(), TokenArena::Id(0));
+        std::stable_sort(byFrequency.begin(), byFrequency.end(), [this](TokenArena::Id left, TokenArena::Id right) { return m_frequencies[left] > m_frequencies[right]; });
+
+        std::vector<uint32_t> ranks(m_tokens.size());
+        for (size_t rank = 0; rank < byFrequency.size(); ++rank)
+            ranks[byFrequency[rank]] = static_cast<uint32_t>(rank);
+
+        m_byFrequency = MappedArray<TokenArena::Id>(std::move(byFrequency));
+        m_ranks       = MappedArray<uint32_t>(std::move(ranks));
+    }
+
+    void buildBkTree()
+    {
+        Workspace& workspace = Workspace::getLocal();
+        auto       metric    = [this, &workspace](BkTree::Item left, BkTree::Item right) { return damerauLevenshteinDistance(m_tokens[left], m_tokens[right], workspace); };
+
+        for (size_t i = 0; i < m_tokens.size(); ++i)
+            if (!isUtf8Token(static_cast<TokenArena::Id>(i)))
+                m_bkTree.insert(static_cast<BkTree::Item>(i), metric);
+    }
 
-        for (const auto& correctWord : m_tokens)
+    // BK-tree lookup or vocabulary scan
+    template <typename String, typename Collector>
+    void collectAllCorrections(const String& initialWord, bool isIncremental, Collector& corrections) const
+    {
+        if (!isIncremental && !m_bkTree.empty() && isNarrowString(initialWord))
         {
-            unsigned distance = getSmartDistance(correctWord, initialWord, isIncremental);
+            Prefilter::Stats     stats;
+            Prefilter::Signature signature  = 0;
+            bool                 isCharMask = getQuerySignature(initialWord, signature);
 
-            if (corrections.empty() || corrections.back().m_distance > distance)
+            Workspace& workspace  = Workspace::getLocal();
+            auto       distanceTo = [this, &initialWord, &workspace](BkTree::Item item) { return damerauLevenshteinDistance(m_tokens[item], initialWord, workspace); };
+            auto visit      = [&](BkTree::Item item, unsigned /*metricDistance*/)
             {
-                // insert item, keep correction sorted
-                auto position = std::find_if(corrections.begin(), corrections.end(), [distance](const Correction& c) { return c.m_distance > distance; });
-                corrections.insert(position, Correction { distance, &correctWord });
+                if (isCharMask && m_prefilter.getCharBound(item, signature, false) > corrections.getWorstDistance())
+                {
+                    ++stats.m_filtered;
+                    return corrections.getWorstDistance();
+                }
 
-                if(corrections.size() > maxCorrections)
-                    corrections.resize(maxCorrections);
-            }
+                ++stats.m_evaluated;
+                addCandidate(corrections, getSmartDistance(m_tokens[item], initialWord, false, corrections.getWorstDistance(), workspace), item);
+                return corrections.getWorstDistance();
+            };
+
+            m_bkTree.search(distanceTo, visit);
+            countCandidates(stats);
+        }
+        else
+        {
+            scanChunk(initialWord, isIncremental, 0, 1, corrections);
         }
 
-        return corrections;
+        scanUtf8(initialWord, isIncremental, false, k_noLimit, corrections);
     }
 
-    // Get either Optimal String Alignment distance or its 'incremental' version. 
-    // Note that parameters order is important in incremental version, 
-    // because it's asymmetric ('abc.*' matches 'abcd', but 'abcd.*' does not match 'abc')
-    //
-    // See getCorrections() for incremental explanations or optimalStringAlignementDistance() for OSA distance details
-    template <typename String, typename OtherString>
-    static unsigned getSmartDistance(const String& correctWord, const OtherString& initialWord, bool isIncremental = false)
+    // tokens within the deletion index distance
+    template <typename String, typename Collector>
+    void addNearCandidates(const String& initialWord, Collector& corrections) const
     {
-        Buffer<CorrectionType> traceback;
-        unsigned distance = optimalStringAlignementDistance(correctWord, initialWord, &traceback);
+        queryStats::Scope scope;
 
-        static const size_t k_minIncrSearchLen = 3;
-        if (isIncremental && getSize(initialWord) >= k_minIncrSearchLen && getSize(correctWord) > getSize(initialWord))
+        // deletion variants are byte strings, they don't work for codepoint distances
+        if (isUtf8Query(initialWord))
+            return scanUtf8(initialWord, false, true, m_deletions.getMaxDistance(), corrections);
+
+        // contiguous copy of the query, the buffer is reused between calls
+        thread_local std::string s_query;
+        s_query.clear();
+        for (size_t i = 0; i < getSize(initialWord); ++i)
+            s_query += initialWord[i];
+
+        // candidates are collected first, because a token may share several variants with the query
+        thread_local std::vector<DeletionIndex::Token> s_candidates;
+        s_candidates.clear();
+        m_deletions.forEachCandidate(s_query, [](DeletionIndex::Token token) { s_candidates.push_back(token); });
+
+        std::sort(s_candidates.begin(), s_candidates.end());
+        s_candidates.erase(std::unique(s_candidates.begin(), s_candidates.end()), s_candidates.end());
+
+        Prefilter::Stats stats;
+        Workspace&       workspace = Workspace::getLocal();
+        for (DeletionIndex::Token token : s_candidates)
         {
-            // ignore insertions past the end of word, assume user will type them later.
-            int insertionsPastEnd = 0;
-            for(auto it = traceback.rbegin(); it != traceback.rend() && *it == CorrectionType::eINSERTION; ++it)
-                ++insertionsPastEnd;
+            if (isUtf8Token(token))
+                continue;
 
-            distance -= insertionsPastEnd;
+            ++stats.m_evaluated;
+            unsigned distance = getSmartDistance(m_tokens[token], s_query, false, std::min(corrections.getWorstDistance(), m_deletions.getMaxDistance()), workspace);
+            if (distance <= m_deletions.getMaxDistance())
+                addCandidate(corrections, distance, token);
         }
 
-        return distance;
+        countCandidates(stats);
+        scanUtf8(initialWord, false, false, m_deletions.getMaxDistance(), corrections);
     }
 
-    template <typename String, typename StringList, typename CaseConvertor = NoCaseConversion>
-    static void tokenize(const String& input, StringList& insertInto,  CaseConvertor changeCase = NoCaseConversion())
+    // see getLikelyCorrections()
+    template <typename String, typename Collector>
+    void addLikelyCandidates(const String& initialWord, bool isIncremental, unsigned stopDistance, Collector& corrections) const
     {
-        using Token = typename StringList::value_type;
-        std::string nextToken;
-        nextToken.reserve(getSize(input));
+        // there is no order to stop early in, the whole vocabulary is scanned
+        if (m_byFrequency.empty())
+            return collectCorrections(initialWord, isIncremental, corrections);
 
-        for(size_t i = 0; i < getSize(input); ++i)
+        queryStats::Scope scope;
+
+        // contiguous copy of the query, the buffer is reused between calls
+        thread_local std::string s_query;
+        s_query.clear();
+        for (size_t i = 0; i < getSize(initialWord); ++i)
+            s_query += initialWord[i];
+
+        const std::string& query = s_query;
+        const bool         isAsciiQuery = utf8::isAscii(query);
+
+        Prefilter::Stats     stats;
+        Prefilter::Signature signature  = 0;
+        bool                 isCharMask = isAsciiQuery && getQuerySignature(query, signature);
+        Workspace&           workspace  = Workspace::getLocal();
+
+        // exact distance up to 'maxDistance', otherwise some greater value
+        auto getDistance = [&](TokenArena::Id token, unsigned maxDistance)
         {
-            int nextChar = input[i];
-            if(isalnum(nextChar))
+            if (!isAsciiQuery || isUtf8Token(token))
             {
-                nextToken += changeCase(nextChar);
+                ++stats.m_evaluated;
+                return getUtf8Distance(m_tokens[token], query, isIncremental, maxDistance, workspace);
             }
-            else if(!nextToken.empty())
+
+            std::string_view word              = m_tokens[token];
+            bool             isIncrementalWord = isIncrementalMatch(word.size(), query.size(), isIncremental);
+            if ((m_prefilter.isEnabled(Prefilter::eLENGTH) && Prefilter::getLengthBound(word.size(), query.size(), isIncrementalWord) > maxDistance)
+                || (isCharMask && m_prefilter.getCharBound(token, signature, isIncrementalWord) > maxDistance))
             {
-                insertInto.push_back(Token(nextToken.c_str()));
-                nextToken.clear();
+                ++stats.m_filtered;
+                return k_noLimit;
+            }
+
+            ++stats.m_evaluated;
+            return getSmartDistance(word, query, isIncremental, maxDistance, workspace);
+        };
+
+        // tokens at distance 0 start with the query (incremental) or are equal to it, they are a range of sorted vocabulary
+        TokenArena::Id first = 0;
+        TokenArena::Id last  = static_cast<TokenArena::Id>(m_tokens.size());
+        for (TokenArena::Id count = last; count != 0; )
+        {
+            TokenArena::Id half = count / 2;
+            if (m_tokens[first + half] < query)
+            {
+                first += half + 1;
+                count -= half + 1;
+            }
+            else
+            {
+                count = half;
             }
         }
 
-        if(!nextToken.empty())
+        last = first;
+        while (last < m_tokens.size() && (isIncremental ? m_tokens[last].substr(0, query.size()) == query : m_tokens[last] == query))
+            ++last;
+
+        // the rest of the range may be farther, e.g. if the query is too short for incremental match, they are scanned as usual
+        for (TokenArena::Id token = first; token < last; ++token)
+            if (getDistance(token, 0) == 0)
+                addCandidate(corrections, 0, token);
+
+        // A token of the scan is less frequent than scanned ones, so it replaces the worst correction only if it's nearer.
+        // The worst correction is never a token of distance 0 from the range: the scan is stopped then
+        for (size_t rank = 0; rank < m_byFrequency.size(); ++rank)
         {
-            insertInto.push_back(Token(nextToken.c_str()));
-            nextToken.clear();
+            unsigned worstDistance = corrections.getWorstDistance();
+            if (worstDistance <= stopDistance)
+                break;
+
+            TokenArena::Id token    = m_byFrequency[rank];
+            unsigned       distance = getDistance(token, worstDistance == k_noLimit ? k_noLimit : worstDistance - 1);
+            if (distance < worstDistance && (distance != 0 || token < first || token >= last))
+                addCandidate(corrections, distance, token);
         }
+
+        countCandidates(stats);
     }
 
-private:
-    enum COST
+    // passes only corrections farther than the deletion index distance, nearer ones are already added
+    template <typename Collector>
+    struct FartherCollector
     {
-        DELETION = 1,
-        INSERTION = 1,
-        SUBSTITUTION = 1,
-        TRANSPOSITION = 1,
-    };
+        Collector& m_corrections;
+        unsigned   m_minDistance;
 
-    std::vector<std::string> m_tokens;
+        unsigned getWorstDistance() const { return m_corrections.getWorstDistance(); }
 
-    // this is simple BUffer implementation. Actually, it's either std::array or std::vector
-    // std::array is user in order to speed up computation by avoiding extra heap allocations
-    // while std::vector is a fallback in case of large buffer needed
-    template <typename T>
-    class Buffer
-    {
-        static const size_t STATIC_SIZE = 16 * 16;
+        void add(const Correction& correction)
+        {
+            if (correction.m_distance > m_minDistance)
+                m_corrections.add(correction);
+        }
+    };
 
-        std::array<T, STATIC_SIZE> m_static;
-        std::vector<T>             m_dynamic;
-        T*                         m_actual;
-        size_t                     m_size;
+    // add corrections from the part of vocabulary: 'chunk' of 'chunkCount' equal parts
+    template <typename String, typename Collector>
+    void scanChunk(const String& initialWord, bool isIncremental, size_t chunk, size_t chunkCount, Collector& corrections) const
+    {
+        if (!m_batches.empty() && isNarrowString(initialWord) && getSize(initialWord) <= BatchDistance::k_maxLength)
+        {
+            size_t begin = m_batches.size() * chunk / chunkCount;
+            size_t end   = m_batches.size() * (chunk + 1) / chunkCount;
+            return scanBatches(initialWord, isIncremental, begin, end, corrections);
+        }
 
-        Buffer(const Buffer&)            = delete;
-        Buffer& operator=(const Buffer&) = delete;
+        // tokens are scanned in storage order, bucket by bucket. Chunk is the range of storage positions
+        size_t begin = m_tokens.size() * chunk / chunkCount;
+        size_t end   = m_tokens.size() * (chunk + 1) / chunkCount;
+        size_t size  = getSize(initialWord);
 
-        bool isStatic() const { return m_actual == m_static.data(); }
+        Prefilter::Stats     stats;
+        Prefilter::Signature signature  = 0;
+        bool                 isCharMask = getQuerySignature(initialWord, signature);
+        Workspace&           workspace  = Workspace::getLocal();
 
-        class ReverseIterator : std::forward_iterator_tag
+        for (size_t i = 0; i < m_tokens.getBucketCount(); ++i)
         {
-            T* m_ptr;
+            const TokenArena::Bucket& bucket = m_tokens.getBucket(i);
+            size_t first = std::max<size_t>(begin, bucket.m_first);
+            size_t last  = std::min<size_t>(end, bucket.m_last);
+            if (first >= last)
+                continue;
+
+            // words of the bucket are too short or too long for the current worst correction
+            bool isIncrementalBucket = isIncrementalMatch(bucket.m_length, size, isIncremental);
+            if (m_prefilter.isEnabled(Prefilter::eLENGTH) && Prefilter::getLengthBound(bucket.m_length, size, isIncrementalBucket) > corrections.getWorstDistance())
+            {
+                stats.m_filtered += last - first;
+                continue;
+            }
+
+            // candidates worse than the current worst correction are useless, so their distance computation is bounded
+            for (size_t position = first; position < last; ++position)
+            {
+                TokenArena::Id token = m_tokens.getStorageId(position);
+                if (isNarrowString(initialWord) && isUtf8Token(token))
+                    continue;
 
-        public:
-            ReverseIterator(T* ptr) : m_ptr(ptr) {}
+                if (isCharMask && m_prefilter.getCharBound(token, signature, isIncrementalBucket) > corrections.getWorstDistance())
+                {
+                    ++stats.m_filtered;
+                    continue;
+                }
 
-            T& operator*()  { return *m_ptr; }
-            T* operator->() { return m_ptr; }
+                ++stats.m_evaluated;
+                std::string_view correctWord = m_tokens.getBucketToken(bucket, position);
+                addCandidate(corrections, getSmartDistance(correctWord, initialWord, isIncremental, corrections.getWorstDistance(), workspace), token);
+            }
+        }
 
-            ReverseIterator operator++()    { return ReverseIterator{ --m_ptr }; }
-            ReverseIterator operator++(int) { ReverseIterator old{ m_ptr }; ++(*this); return old; }
+        countCandidates(stats);
+    }
 
-            bool operator==(const ReverseIterator& other) const { return m_ptr == other.m_ptr; }
-            bool operator!=(const ReverseIterator& other) const { return !(*this == other); }
-        };
+    bool isUtf8Token(TokenArena::Id token) const
+    {
+        return !m_utf8Tokens.empty() && std::binary_search(m_utf8Tokens.begin(), m_utf8Tokens.end(), token);
+    }
 
-    public:
-        explicit Buffer(size_t size = 0)
-            : m_static()
-            , m_dynamic()
-            , m_actual(m_static.data())
-            , m_size(size)
+    // narrow query with non-ASCII chars, it's compared with every token by codepoints
+    template <typename String>
+    static bool isUtf8Query(const String& initialWord)
+    {
+        if (!isNarrowString(initialWord))
+            return false;
+
+        for (size_t i = 0; i < getSize(initialWord); ++i)
+            if (static_cast<unsigned char>(initialWord[i]) >= 0x80)
+                return true;
+
+        return false;
+    }
+
+    // Codepoint distances, see getUtf8Distance(): of the whole vocabulary or of non-ASCII tokens only, which byte-level
+    // engines skip. Byte and codepoint distances of ASCII strings are the same. Tokens farther than 'maxDistance' are not added
+    template <typename String, typename Collector>
+    void scanUtf8(const String& initialWord, bool isIncremental, bool isWholeVocabulary, unsigned maxDistance, Collector& corrections) const
+    {
+        if (!isNarrowString(initialWord) || (!isWholeVocabulary && m_utf8Tokens.empty()))
+            return;
+
+        thread_local std::string    s_query;
+        thread_local std::u32string s_codepoints;
+        thread_local std::u32string s_word;
+        s_query.clear();
+        for (size_t i = 0; i < getSize(initialWord); ++i)
+            s_query += initialWord[i];
+
+        utf8::decode(s_query, s_codepoints);
+
+        Prefilter::Stats stats;
+        Workspace&       workspace = Workspace::getLocal();
+        size_t           count     = isWholeVocabulary ? m_tokens.size() : m_utf8Tokens.size();
+        for (size_t i = 0; i < count; ++i)
         {
-            if (size > STATIC_SIZE)
+            TokenArena::Id token = isWholeVocabulary ? static_cast<TokenArena::Id>(i) : m_utf8Tokens[i];
+            utf8::decode(m_tokens[token], s_word);
+
+            unsigned worstDistance     = std::min(corrections.getWorstDistance(), maxDistance);
+            bool     isIncrementalWord = isIncrementalMatch(s_word.size(), s_codepoints.size(), isIncremental);
+            if (m_prefilter.isEnabled(Prefilter::eLENGTH) && Prefilter::getLengthBound(s_word.size(), s_codepoints.size(), isIncrementalWord) > worstDistance)
             {
-                m_dynamic.resize(size);
-                m_actual = m_dynamic.data();
+                ++stats.m_filtered;
+                continue;
             }
-        }
 
-        Buffer(Buffer&& right)
-        {
-            *this = std::move(right);
+            ++stats.m_evaluated;
+            unsigned distance = getSmartDistance(s_word, s_codepoints, isIncremental, worstDistance, workspace);
+            if (distance <= maxDistance)
+                addCandidate(corrections, distance, token);
         }
 
-        Buffer& operator=(Buffer&& other)
-        {
-            if(other.isStatic())
-            {
-                size_t mineItems = isStatic() ? m_size : 0;
-                size_t itemsToMove = std::max(mineItems, other.m_size);
+        countCandidates(stats);
+    }
 
-                for(size_t i = 0; i < itemsToMove; ++i)
-                    std::swap(m_static[i], other.m_static[i]);
+    // Query signature for the char mask prefilter, false if it's not used.
+    // Wide chars can't be mapped to classes of vocabulary chars, so they are not filtered
+    template <typename String>
+    bool getQuerySignature(const String& initialWord, Prefilter::Signature& signature) const
+    {
+        if (!m_prefilter.isEnabled(Prefilter::eCHAR_MASK) || !isNarrowString(initialWord))
+            return false;
 
-                m_actual = m_static.data();
-            }
-            else
+        signature = 0;
+        for (size_t i = 0; i < getSize(initialWord); ++i)
+            signature |= Prefilter::getSignature(static_cast<char>(initialWord[i]));
+
+        return true;
+    }
+
+    template <typename String, typename Collector>
+    void scanBatches(const String& initialWord, bool isIncremental, size_t begin, size_t end, Collector& corrections) const
+    {
+        // contiguous copy of the query, the buffer is reused between calls
+        thread_local std::string s_query;
+        s_query.clear();
+        for (size_t i = 0; i < getSize(initialWord); ++i)
+            s_query += initialWord[i];
+
+        const std::string& query = s_query;
+
+        Prefilter::Stats     stats;
+        Prefilter::Signature signature  = 0;
+        bool                 isCharMask = getQuerySignature(query, signature);
+
+        unsigned distances[BatchDistance::k_lanes];
+        for (size_t i = begin; i < end; ++i)
+        {
+            const BatchDistance::Batch& batch = m_batches[i];
+            const bool isIncrementalBatch = isIncrementalMatch(batch.m_length, query.size(), isIncremental);
+
+            // words of the batch are too short or too long for the current worst correction
+            unsigned maxDistance = corrections.getWorstDistance();
+            if (m_prefilter.isEnabled(Prefilter::eLENGTH) && Prefilter::getLengthBound(batch.m_length, query.size(), isIncrementalBatch) > maxDistance)
             {
-                std::swap(m_dynamic, other.m_dynamic);
-                m_actual = m_dynamic.data();
+                stats.m_filtered += batch.m_count;
+                continue;
             }
 
-            m_size = other.m_size;
+            // lanes are computed together, so the batch is skipped only if every word of it is rejected
+            if (isCharMask && std::all_of(batch.m_words.begin(), batch.m_words.begin() + batch.m_count, [&](uint32_t token)
+                              { return m_prefilter.getCharBound(token, signature, isIncrementalBatch) > maxDistance; }))
+            {
+                stats.m_filtered += batch.m_count;
+                continue;
+            }
 
-            // don't care about these members in temporary 'other'
-            other.m_actual = nullptr;
-            other.m_size = 0;
+            stats.m_evaluated += batch.m_count;
+            queryStats::add(&QueryStats::m_dpCells, batch.m_count * batch.m_length * query.size());
+            m_batches.getDistances(batch, query.data(), query.size(), isIncrementalBatch, maxDistance, distances);
 
-            return *this;
+            for (size_t lane = 0; lane < batch.m_count; ++lane)
+                addCandidate(corrections, distances[lane], batch.m_words[lane]);
         }
 
-        void reset(size_t newSize) { *this = Buffer(newSize); }
+        countCandidates(stats);
+    }
+
+    // Corrections list with the same interface as TopCorrections
+    class CorrectionsCollector
+    {
+    public:
+        CorrectionsCollector(Corrections& corrections, unsigned maxCorrections)
+            : m_corrections(corrections)
+            , m_maxCorrections(maxCorrections)
+        {}
 
-        T&       operator[](size_t index)       { return m_actual[index]; }
-        const T& operator[](size_t index) const { return m_actual[index]; }
+        unsigned getWorstDistance() const           { return SpellCheck::getWorstDistance(m_corrections, m_maxCorrections); }
+        void     add(const Correction& correction) { addCorrection(m_corrections, m_maxCorrections, correction); }
 
-        ReverseIterator rbegin() const { return ReverseIterator{ m_actual + m_size - 1 }; }
-        ReverseIterator rend() const   { return ReverseIterator{ m_actual - 1 }; }
+    private:
+        Corrections& m_corrections;
+        unsigned     m_maxCorrections;
     };
 
+    static unsigned getWorstDistance(const Corrections& corrections, unsigned maxCorrections)
+    {
+        if (maxCorrections == 0)
+            return 0;   // nothing is accepted
+
+        return corrections.size() < maxCorrections ? k_noLimit : corrections.back().m_distance;
+    }
+
+    static bool isLengthDifferenceExceeds(size_t size, size_t otherSize, unsigned maxDistance)
+    {
+        return (size > otherSize ? size - otherSize : otherSize - size) > maxDistance;
+    }
+
+    // insert correction preserving (distance, rank) sorting, keep no more than 'maxCorrections' best items
+    static void addCorrection(Corrections& corrections, unsigned maxCorrections, const Correction& correction)
+    {
+        auto isBetter = [&correction](const Correction& c) { return isBetterCorrection(correction, c); };
+
+        if (maxCorrections == 0 || (corrections.size() >= maxCorrections && !isBetter(corrections.back())))
+            return;
+
+        corrections.insert(std::find_if(corrections.begin(), corrections.end(), isBetter), correction);
+
+        if (corrections.size() > maxCorrections)
+            corrections.pop_back();
+    }
+
+    // whether 'correction' goes before 'other' in (distance, rank) sorting
+    static bool isBetterCorrection(const Correction& correction, const Correction& other)
+    {
+        return other.m_distance > correction.m_distance || (other.m_distance == correction.m_distance && other.m_rank > correction.m_rank);
+    }
+
+    // add vocabulary 'token' to Collector, unless it's certainly rejected: the word is fetched for accepted candidates only
+    template <typename Collector>
+    void addCandidate(Collector& corrections, unsigned distance, TokenArena::Id token) const
+    {
+        if (distance <= corrections.getWorstDistance())
+            corrections.add(Correction { distance, m_tokens[token], token, m_ranks.empty() ? token : m_ranks[token] });
+    }
+
     enum class CorrectionType : char
     {
         eNOT_INITIALIZED = 0,
@@ -266,6 +1476,53 @@ private:
         }
     };
 
+public:
+    // Grow-only scratch memory of the distance kernels: DP matrices and rows are taken from it instead of being allocated
+    // and initialized by every call, so neither candidates nor queries touch the heap once it has grown to the longest words.
+    // Kernels use the workspace of the calling thread (getLocal()) unless the caller passes its own one, e.g. to keep it
+    // out of thread-local storage. A workspace must not be shared by concurrent calls
+    class Workspace
+    {
+    public:
+        Workspace() = default;
+
+        static Workspace& getLocal()
+        {
+            thread_local Workspace s_workspace;
+            return s_workspace;
+        }
+
+        size_t getMemoryUsage() const
+        {
+            return m_distances.capacity() * sizeof(unsigned) + m_corrections.capacity() * sizeof(CorrectionType) + sizeof(m_lastRows);
+        }
+
+    private:
+        friend class SpellCheck;
+
+        std::vector<unsigned>       m_distances;        // DP matrix or rolling rows
+        std::vector<CorrectionType> m_corrections;      // alternatives of the OSA matrix, see fillOsaMatrices()
+        std::array<uint32_t, 256>   m_lastRows {};      // of damerauLevenshteinDistance(), zeros between calls
+
+        Workspace(const Workspace&)            = delete;
+        Workspace& operator=(const Workspace&) = delete;
+
+        // at least 'size' items, their values are left from the previous use
+        template <typename T>
+        static T* grow(std::vector<T>& buffer, size_t size)
+        {
+            if (buffer.size() < size)
+            {
+                queryStats::add(&QueryStats::m_workspaceGrowths, 1);
+                buffer.resize(std::max(size, buffer.size() * 2));
+            }
+
+            return buffer.data();
+        }
+    };
+
+private:
+
     // std::string support. Note: 'auto' return type is needed in order to force "expression SFINAE" to work under MSVC 2015
     template <typename T> static auto getSize(const T& string) -> decltype(string.size())
     { 
@@ -283,8 +1540,104 @@ private:
         return strlen(string);
     }
 
+    template <typename String> static bool isNarrowString(const String& string)
+    {
+        return sizeof(string[0]) == sizeof(char);
+    }
+
+    // OSA distance bounded by 'maxDistance', see getSmartDistance(). Only diagonal band of DP matrix is computed:
+    // cells farther than 'maxDistance' from diagonal can't be on the path cheaper than 'maxDistance'.
+    // Three rolling rows are enough, because transposition looks back at (i-2, j-2) only.
+    // Requires 'maxDistance' less than the longest string length, otherwise there's no band and nothing to save.
+    template <typename String, typename OtherString>
+    static unsigned bandedDistance(const String& source, const OtherString& target, unsigned maxDistance, Workspace& workspace)
+    {
+        size_t width  = getSize(source) + 1;
+        size_t height = getSize(target) + 1;
+        size_t band   = maxDistance;
+
+        assert(maxDistance < std::max(width, height) - 1);
+        if (isLengthDifferenceExceeds(width, height, maxDistance))
+            return maxDistance + 1;
+
+        // cells outside of the band are saturated to 'infinity'
+        const unsigned infinity = maxDistance + 1;
+        unsigned*      rows     = Workspace::grow(workspace.m_distances, 3 * width);
+
+        unsigned* thisRow  = &rows[0];
+        unsigned* prevRow  = &rows[width];
+        unsigned* prevRow2 = &rows[2 * width];
+
+        for (size_t j = 0; j <= std::min(band + 1, width - 1); ++j)
+            thisRow[j] = std::min(static_cast<unsigned>(j), infinity);
+
+        for (size_t i = 1, im = 0; i < height; ++i, ++im)
+        {
+            std::swap(prevRow2, prevRow);
+            std::swap(prevRow, thisRow);
+
+            size_t first = i > band ? i - band : 0;
+            size_t last  = std::min(i + band, width - 1);
+            unsigned rowMin = infinity;
+
+            queryStats::add(&QueryStats::m_dpCells, last - first + 1);
+
+            // neighbours of the band are read by the next rows
+            if (first > 0)
+                thisRow[first - 1] = infinity;
+            if (last + 1 < width)
+                thisRow[last + 1] = infinity;
+
+            if (first == 0)
+            {
+                thisRow[0] = std::min(static_cast<unsigned>(i), infinity);
+                rowMin     = thisRow[0];
+                first      = 1;
+            }
+
+            for (size_t j = first, jn = first - 1; j <= last; ++j, ++jn)
+            {
+                unsigned distance = prevRow[j - 1];
+                if (source[jn] != target[im])
+                {
+                    distance = std::min({ prevRow[j - 1] + SUBSTITUTION, thisRow[j - 1] + INSERTION, prevRow[j] + DELETION });
+
+                    if (i > 1 && j > 1 && source[jn] == target[im - 1] && source[jn - 1] == target[im])
+                        distance = std::min(distance, prevRow2[j - 2] + TRANSPOSITION);
+
+                    distance = std::min(distance, infinity);
+                }
+
+                thisRow[j] = distance;
+                rowMin = std::min(rowMin, distance);
+            }
+
+            if (rowMin > maxDistance)
+                return infinity;    // row minimums never decrease
+        }
+
+        return thisRow[width - 1];
+    }
+
+public:
+    // Reference OSA implementation, which fills the whole DP matrix. Plain distance uses it as a fallback for long or wide strings,
+    // backtraceIncrementalDistance() uses its backtrace.
+    // If 'maxDistance' is exceeded by the whole row, computation stops, see getSmartDistance()
+    template <typename String, typename OtherString>
+    static unsigned optimalStringAlignementDistance(const String& source, const OtherString& target, unsigned maxDistance = k_noLimit,
+                                                    Workspace& workspace = Workspace::getLocal())
+    {
+        if (!fillOsaMatrices(source, target, maxDistance, workspace))
+            return maxDistance + 1;
+
+        return workspace.m_distances[(getSize(source) + 1) * (getSize(target) + 1) - 1];
+    }
+
+private:
+    // Distance and alternatives matrices of optimalStringAlignementDistance() in 'workspace', the alternatives are needed by
+    // the backtrace. False if computation was stopped because of 'maxDistance', matrices are incomplete then
     template <typename String, typename OtherString>
-    static unsigned optimalStringAlignementDistance(const String& source, const OtherString& target, Buffer<CorrectionType>* backtrace = nullptr)
+    static bool fillOsaMatrices(const String& source, const OtherString& target, unsigned maxDistance, Workspace& workspace)
     {
         // it's a variation of Damerau-Levenshtein distance with small improvement:
         // https://en.wikipedia.org/wiki/Damerau%E2%80%93Levenshtein_distance#Algorithm
@@ -293,9 +1646,9 @@ private:
         size_t width  = getSize(source) + 1;
         size_t height = getSize(target) + 1;
 
-        Buffer<unsigned>       distanceMatrix   (width * height);
-        Buffer<CorrectionType> correctionsMatrix(width * height);
-        
+        unsigned*       distanceMatrix    = Workspace::grow(workspace.m_distances, width * height);
+        CorrectionType* correctionsMatrix = Workspace::grow(workspace.m_corrections, width * height);
+
         std::iota(&distanceMatrix[0], &distanceMatrix[width], 0);  // 0,1,2,...,width
         std::fill(&correctionsMatrix[1], &correctionsMatrix[width], CorrectionType::eINSERTION);
 
@@ -334,9 +1687,13 @@ private:
                     correctionsMatrix[thisRow + j] = correction.bestType;
                 }
             }
-        }
 
-        int distance = distanceMatrix[width * height - 1];
+            queryStats::add(&QueryStats::m_dpCells, width - 1);
+
+            // row minimums never decrease, so the distance (and its incremental version) is at least the row minimum
+            if (maxDistance != k_noLimit && *std::min_element(&distanceMatrix[i * width], &distanceMatrix[i * width] + width) > maxDistance)
+                return false;
+        }
 
 #if defined DUMP
         std::cout << "Costs:\n";
@@ -346,65 +1703,8 @@ private:
         dump((char*) &correctionsMatrix[0], width, height);
 #endif
 
-        // in case of incremental match, we need both 'distance' and a list of corrections
-        // backtrace will construct corrections list from 'distanceMatrix'
-        if(backtrace != nullptr)
-        {
-            *backtrace = optimalStringAlignmentBacktrace(height, width, correctionsMatrix);
-        }
-
-        return distance;
-    }
-
-    // backtrace. The idea description: https://web.stanford.edu/class/cs124/lec/med.pdf
-    static Buffer<CorrectionType> optimalStringAlignmentBacktrace(size_t height, size_t width, const Buffer<CorrectionType>& correctionsMatrix)
-    {
-        Buffer<CorrectionType> backtrace(height + width);
-
-        int row    = height - 1;
-        int column = width - 1;
-
-        auto itPrevious = backtrace.rbegin();
-
-        while(row != 0 || column != 0)
-        {
-            CorrectionType fixType = correctionsMatrix[column + row * width];
-
-            assert(itPrevious != backtrace.rend());
-            *itPrevious = fixType;
-            ++itPrevious;
-
-            switch(fixType)
-            {
-            case CorrectionType::eNONE:
-            case CorrectionType::eSUBSTITUTION:     // moved diagonal by 1 cell
-                --column;
-                --row;
-                break;
-
-            case CorrectionType::eDELETION:         // moved up by 1 cell
-                --row;
-                break;
-
-            case CorrectionType::eINSERTION:        // moved left
-                --column;
-                break;
-
-            case CorrectionType::eTRANSPOSITION:    // moved diagonal by 2 cells
-                column -= 2;
-                row    -= 2;
-                break;
-
-            case CorrectionType::eNOT_INITIALIZED:
-            default:
-                assert(0 && "incorrect fixType");
-                break;
-            }
-        }
-
-        return backtrace;
+        return true;
     }
-
 };
 
 #ifdef HAD_MAX_DEFINE
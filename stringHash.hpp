@@ -0,0 +1,17 @@
+#pragma once
+#include <string_view>
+#include <cstdint>
+
+// FNV-1a followed by a finalizer, so both halves of the hash are well mixed: hash tables may select a slot by
+// the low half and keep the high one as a fingerprint. Hashes are stored in snapshots, so they must not change
+inline uint64_t getStringHash(std::string_view string)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : string)
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
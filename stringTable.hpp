@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include <string_view>
+#include <cstddef>
+
+#include "snapshot.hpp"
+
+// Read-only list of strings packed into a single char array
+class StringTable
+{
+public:
+    StringTable() = default;
+
+    // Strings: any list of items convertible to std::string_view
+    template <typename Strings>
+    explicit StringTable(const Strings& strings)
+    {
+        std::vector<char>   chars;
+        std::vector<size_t> offsets { 0 };
+        offsets.reserve(strings.size() + 1);
+
+        for (const auto& item : strings)
+        {
+            std::string_view string = item;
+            chars.insert(chars.end(), string.begin(), string.end());
+            offsets.push_back(chars.size());
+        }
+
+        m_chars   = std::move(chars);
+        m_offsets = std::move(offsets);
+    }
+
+    explicit StringTable(SnapshotReader& reader)
+        : m_chars(reader.read<char>())
+        , m_offsets(reader.read<size_t>())
+    {}
+
+    void save(SnapshotWriter& writer) const
+    {
+        writer.write(m_chars);
+        writer.write(m_offsets);
+    }
+
+    bool   empty() const { return size() == 0; }
+    size_t size() const  { return m_offsets.empty() ? 0 : m_offsets.size() - 1; }
+
+    std::string_view operator[](size_t index) const
+    {
+        return std::string_view(m_chars.data() + m_offsets[index], m_offsets[index + 1] - m_offsets[index]);
+    }
+
+private:
+    MappedArray<char>   m_chars;
+    MappedArray<size_t> m_offsets;      // string N is [m_offsets[N], m_offsets[N + 1])
+};
@@ -1,79 +1,1714 @@
 #include "incrementalSearch.hpp"
+#include "liveSearch.hpp"
+#include "asyncSearch.hpp"
+#include "documentCheck.hpp"
+#if !defined _WIN32
+#include "searchServer.hpp"
+#endif
 #include "getch.h"
 
-#include <iostream>
-#include <fstream>
-#include <ctime>
-#include <cassert>
-#include <map>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cassert>
+#include <map>
+#include <random>
+#include <functional>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstdio>
+#include <iterator>
+#include <chrono>
+
+void unitTests();
+void interactive();
+void help();
+void profileSnapshot();
+void profileDeletionIndex();
+
+static const std::string s_help = "-h";
+
+// heap allocations counter for allocation-free API tests
+static std::atomic<size_t> s_allocations(0);
+
+// Every form of operator new and delete is replaced, so all allocations are counted and freed by the allocator
+// they came from. Alignment 0 is the default one
+static void* allocate(size_t size, size_t alignment) noexcept
+{
+    ++s_allocations;
+    queryStats::countAllocation();
+
+    size = size != 0 ? size : 1;
+    if (alignment == 0)
+        return malloc(size);
+
+#if defined _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    void* memory = nullptr;
+    return posix_memalign(&memory, alignment, size) == 0 ? memory : nullptr;
+#endif
+}
+
+static void* allocateOrThrow(size_t size, size_t alignment)
+{
+    if (void* memory = allocate(size, alignment))
+        return memory;
+
+    throw std::bad_alloc();
+}
+
+// not inlined: GCC would pair free() with new-expressions of callers and warn of mismatched deallocation
+#if defined _MSC_VER
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+static void deallocate(void* memory, size_t alignment) noexcept
+{
+#if defined _WIN32
+    if (alignment != 0)
+        return _aligned_free(memory);
+#endif
+    (void)alignment;
+    free(memory);
+}
+
+void* operator new(size_t size)                                                           { return allocateOrThrow(size, 0); }
+void* operator new[](size_t size)                                                         { return allocateOrThrow(size, 0); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept                           { return allocate(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept                         { return allocate(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment)                               { return allocateOrThrow(size, static_cast<size_t>(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment)                             { return allocateOrThrow(size, static_cast<size_t>(alignment)); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept   { return allocate(size, static_cast<size_t>(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, static_cast<size_t>(alignment)); }
+
+void operator delete(void* memory) noexcept                                                    { deallocate(memory, 0); }
+void operator delete[](void* memory) noexcept                                                  { deallocate(memory, 0); }
+void operator delete(void* memory, size_t) noexcept                                            { deallocate(memory, 0); }
+void operator delete[](void* memory, size_t) noexcept                                          { deallocate(memory, 0); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept                             { deallocate(memory, 0); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept                           { deallocate(memory, 0); }
+void operator delete(void* memory, std::align_val_t alignment) noexcept                        { deallocate(memory, static_cast<size_t>(alignment)); }
+void operator delete[](void* memory, std::align_val_t alignment) noexcept                      { deallocate(memory, static_cast<size_t>(alignment)); }
+void operator delete(void* memory, size_t, std::align_val_t alignment) noexcept                { deallocate(memory, static_cast<size_t>(alignment)); }
+void operator delete[](void* memory, size_t, std::align_val_t alignment) noexcept              { deallocate(memory, static_cast<size_t>(alignment)); }
+void operator delete(void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept   { deallocate(memory, static_cast<size_t>(alignment)); }
+void operator delete[](void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept { deallocate(memory, static_cast<size_t>(alignment)); }
+
+typedef void (*Callback)();
+typedef std::pair<Callback, const char*> CallbackInfo;
+typedef std::map<std::string, CallbackInfo> Handlers;
+
+static Handlers s_handlers =
+{
+    { "-u",       { &unitTests,             "unit test" } },
+    { "-i",       { &interactive,           "interactive" } },
+    { s_help,     { &help,                  "help" } },
+    { "-p_snap",  { &profileSnapshot,       "profile building indexes vs loading them from snapshot" } },
+    { "-p_del",   { &profileDeletionIndex,  "profile memory and latency of deletion index on wikipedia and 1M random words" } },
+};
+
+void help()
+{
+    std::cout << "Available options: " << std::endl;
+    for(const auto& optionHandlerPair : s_handlers)
+        std::cout << "  " << optionHandlerPair.first << "\t  : " << optionHandlerPair.second.second << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> params;
+    for(int i = 1; i < argc; ++i)
+        params.push_back(argv[i]);
+
+    if (params.empty())
+        params.push_back(s_help);
+
+    for(const std::string& mode : params)
+    {
+        Callback handler = s_handlers[mode].first;
+        if (handler == nullptr)
+        {
+            help();
+            return 1;
+        }
+
+        handler();
+    }
+
+    return 0;
+}
+
+std::vector<std::string> loadWikipedia()
+{
+    std::ifstream articles = std::ifstream("../wikipedia.txt");
+    std::vector<std::string> wikipedia;
+    wikipedia.reserve(10000);
+    while (articles)
+    {
+        std::string line;
+        std::getline(articles, line);
+
+        if (!line.empty())
+            wikipedia.emplace_back(std::move(line));
+    }
+
+    return wikipedia;
+}
+
+IncrementalSearch load(const IncrementalSearch::Options& options = IncrementalSearch::Options())
+{
+    return IncrementalSearch { loadWikipedia(), options };
+}
+
+// sessions keep DP rows with the trie only
+IncrementalSearch::Options withTrie()
+{
+    IncrementalSearch::Options options;
+    options.m_trie = true;
+    return options;
+}
+
+bool isSameCorrections(const SpellCheck::Corrections& left, const SpellCheck::Corrections& right)
+{
+    return left.size() == right.size()
+        && std::equal(left.begin(), left.end(), right.begin(), [](const SpellCheck::Correction& l, const SpellCheck::Correction& r)
+                      { return l.m_distance == r.m_distance && l.m_token == r.m_token && l.m_word == r.m_word; });
+}
+
+std::string randomWord(std::mt19937& random, size_t maxLength, const std::string& alphabet)
+{
+    std::string word(std::uniform_int_distribution<size_t>(0, maxLength)(random), ' ');
+    for (char& c : word)
+        c = alphabet[std::uniform_int_distribution<size_t>(0, alphabet.size() - 1)(random)];
+
+    return word;
+}
+
+void testBitParallel()
+{
+    std::mt19937 random(42);
+
+    // small alphabets produce a lot of matches and transpositions, long words cover 64-bit boundary and fallback
+    for (const std::string alphabet : { "ab", "abc", "abcdefgh", "abcdefghijklmnopqrstuvwxyz0123456789" })
+    {
+        for (size_t maxLength : { 5, 16, 70 })
+        {
+            for (int i = 0; i < 3000; ++i)
+            {
+                std::string source = randomWord(random, maxLength, alphabet);
+                std::string target = randomWord(random, maxLength, alphabet);
+
+                unsigned expected = SpellCheck::optimalStringAlignementDistance(source, target);
+                assert(SpellCheck::getSmartDistance(source, target) == expected);
+
+                if (SpellCheck::isBitParallelSupported(source, target))
+                    assert(SpellCheck::bitParallelDistance(source, target) == expected);
+            }
+        }
+    }
+
+    std::string word64(64, 'a');
+    assert(SpellCheck::bitParallelDistance(word64, word64) == 0);
+    assert(SpellCheck::bitParallelDistance(word64, word64 + "bb") == 2);
+    assert(SpellCheck::bitParallelDistance(word64 + "bb", word64) == 2);
+    assert(SpellCheck::bitParallelDistance("", "abc") == 3);
+    assert(SpellCheck::bitParallelDistance("abc", "") == 3);
+}
+
+void testBoundedDistance()
+{
+    std::mt19937 random(7);
+
+    for (const std::string alphabet : { "ab", "abcd", "abcdefghijklmnopqrstuvwxyz" })
+    {
+        for (size_t maxLength : { 6, 20, 90 })
+        {
+            for (int i = 0; i < 2000; ++i)
+            {
+                std::string correct = randomWord(random, maxLength, alphabet);
+                std::string initial = randomWord(random, maxLength, alphabet);
+                unsigned maxDistance = std::uniform_int_distribution<unsigned>(0, 12)(random);
+
+                for (bool isIncremental : { false, true })
+                {
+                    unsigned exact   = SpellCheck::getSmartDistance(correct, initial, isIncremental);
+                    unsigned bounded = SpellCheck::getSmartDistance(correct, initial, isIncremental, maxDistance);
+                    assert(exact > maxDistance ? bounded > maxDistance : bounded == exact);
+                }
+            }
+        }
+    }
+
+    assert(SpellCheck::getSmartDistance("abcdef", "abc", false, 2) > 2);
+    assert(SpellCheck::getSmartDistance("abcdef", "abc", false, 3) == 3);
+    assert(SpellCheck::getSmartDistance("abcdef", "abc", true, 0) == 0);
+    assert(SpellCheck::getSmartDistance("abcdef", "xyz", true, 2) > 2);
+}
+
+void testIncrementalDistance()
+{
+    std::mt19937 random(9);
+
+    // small alphabets produce a lot of ties between alternatives, long words make the workspace grow
+    for (const std::string alphabet : { "ab", "abc", "abcdefgh", "abcdefghijklmnopqrstuvwxyz" })
+    {
+        for (size_t maxLength : { 6, 20, 90 })
+        {
+            for (int i = 0; i < 2000; ++i)
+            {
+                std::string correct = randomWord(random, maxLength, alphabet);
+                std::string initial = randomWord(random, maxLength, alphabet);
+
+                for (unsigned maxDistance : { SpellCheck::k_noLimit, 0u, 1u, 3u, std::uniform_int_distribution<unsigned>(0, 12)(random) })
+                {
+                    unsigned expected = SpellCheck::backtraceIncrementalDistance(correct, initial, maxDistance);
+                    assert(SpellCheck::incrementalDistance(correct, initial, maxDistance) == expected);
+
+                    if (SpellCheck::isIncrementalMatch(correct.size(), initial.size(), true))
+                        assert(SpellCheck::getSmartDistance(correct, initial, true, maxDistance) == expected);
+                }
+            }
+        }
+    }
+
+    // "ba" -> "aba" is 1 and the minimum of the last row, but backtrace prefers the match of 'a', so "ba" -> "abaa.*" is 2
+    assert(SpellCheck::backtraceIncrementalDistance("abaabb", "ba") == 2);
+    assert(SpellCheck::incrementalDistance("abaabb", "ba") == 2);
+    assert(SpellCheck::incrementalDistance("", "") == 0);
+    assert(SpellCheck::incrementalDistance("abc", "") == 0);
+    assert(SpellCheck::incrementalDistance("", "abc") == 3);
+
+    // scratch memory is reused: once the workspace has grown, long words don't allocate
+    std::string longWord = std::string(40, 'x') + "abcdefghijklmnopqrstuvwxyz";
+    std::string longTypo = std::string(40, 'x') + "abdcefghijklmnopqrstuvwxyz";
+    std::string typed    = std::string(40, 'x') + "abc";
+
+    SpellCheck::Workspace workspace;
+    SpellCheck::backtraceIncrementalDistance(longWord, longTypo, SpellCheck::k_noLimit, workspace);
+    SpellCheck::damerauLevenshteinDistance(longWord, longTypo, workspace);
+    {
+        queryStats::Scope scope;
+        size_t allocations = s_allocations;
+        assert(SpellCheck::getSmartDistance(longWord, typed, true, SpellCheck::k_noLimit, workspace) == 0);
+        assert(SpellCheck::backtraceIncrementalDistance(longWord, longTypo, SpellCheck::k_noLimit, workspace) == 1);
+        assert(SpellCheck::optimalStringAlignementDistance(longWord, longTypo, SpellCheck::k_noLimit, workspace) == 1);
+        assert(SpellCheck::damerauLevenshteinDistance(longWord, longTypo, workspace) == 1);
+        assert(s_allocations == allocations && scope.get().m_workspaceGrowths == 0);
+        assert(!QueryStats::k_enabled || scope.get().m_dpCells == longWord.size() * (typed.size() + 3 * longTypo.size()));
+    }
+
+    // values left by previous calls of other sizes don't matter
+    for (int i = 0; i < 2000; ++i)
+    {
+        std::string source = randomWord(random, 30, "abcd");
+        std::string target = randomWord(random, 30, "abcd");
+
+        SpellCheck::Workspace fresh;
+        assert(SpellCheck::damerauLevenshteinDistance(source, target, workspace) == SpellCheck::damerauLevenshteinDistance(source, target, fresh));
+        assert(SpellCheck::optimalStringAlignementDistance(source, target, SpellCheck::k_noLimit, workspace)
+               == SpellCheck::optimalStringAlignementDistance(source, target, SpellCheck::k_noLimit, fresh));
+    }
+}
+
+void testAsyncSearch()
+{
+    std::vector<std::string> wikipedia = loadWikipedia();
+    IncrementalSearch search { wikipedia };
+
+    typedef std::vector<std::pair<IncrementalSearch::Tier, IncrementalSearch::Strings>> Delivered;
+    auto collect = [](Delivered& delivered)
+    {
+        return [&delivered](IncrementalSearch::Tier tier, const IncrementalSearch::Result* results, size_t count)
+        {
+            IncrementalSearch::Strings strings;
+            for (size_t i = 0; i < count; ++i)
+                strings.emplace_back(results[i].m_text);
+
+            delivered.emplace_back(tier, std::move(strings));
+        };
+    };
+
+    // tiers are delivered in order, every one is a prefix of the final results
+    for (const char* query : { "hystorical", "the", "parliament", "HIST", "zzzzzz", "" })
+    {
+        for (size_t maxCount : { size_t(10), size_t(3) })
+        {
+            Delivered delivered;
+            assert(search.searchProgressive(query, maxCount, []() { return false; }, collect(delivered)));
+
+            auto expected = search.search(query, maxCount);
+            assert(delivered.size() == 3 && delivered.back().second == expected);
+            for (size_t tier = 0; tier < delivered.size(); ++tier)
+            {
+                const IncrementalSearch::Strings& results = delivered[tier].second;
+                assert(delivered[tier].first == tier && results.size() <= expected.size());
+                assert(std::equal(results.begin(), results.end(), expected.begin()));
+            }
+        }
+    }
+
+    // full cheap tiers make the corrections lookup needless
+    size_t polls = 0;
+    Delivered delivered;
+    search.searchProgressive("the", 3, [&polls]() { ++polls; return false; }, collect(delivered));
+    assert(polls == 3 && delivered.front().second.size() == 3);
+
+    // the stop condition is polled before tiers and between chunks of the corrections lookup
+    polls = 0;
+    search.searchProgressive("hystorical", 10, [&polls]() { ++polls; return false; }, [](IncrementalSearch::Tier, const IncrementalSearch::Result*, size_t) {});
+    assert(polls > 4);
+
+    for (size_t stopAt : { size_t(1), size_t(2), size_t(5) })
+    {
+        polls = 0;
+        delivered.clear();
+        assert(!search.searchProgressive("hystorical", 10, [&polls, stopAt]() { return ++polls >= stopAt; }, collect(delivered)));
+        assert(delivered.size() == std::min<size_t>(stopAt - 1, 2));
+    }
+
+    // background search
+    AsyncSearch async { search };
+    {
+        Delivered results;
+        assert(async.search("hystorical", 10, collect(results)).get() == AsyncSearch::eCOMPLETED);
+        assert(results.size() == 3 && results.back().second == search.search("hystorical"));
+
+        CancellationToken token;
+        token.cancel();
+        results.clear();
+        assert(async.search("hystorical", 10, collect(results), token).get() == AsyncSearch::eCANCELLED && results.empty());
+
+        auto expired = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+        assert(async.search("hystorical", 10, collect(results), CancellationToken(), expired).get() == AsyncSearch::eDEADLINE_EXCEEDED && results.empty());
+
+        auto throwing = [](IncrementalSearch::Tier, const IncrementalSearch::Result*, size_t) { throw std::runtime_error("callback"); };
+        auto failed   = async.search("hystorical", 10, throwing);
+        bool isThrown = false;
+        try { failed.get(); } catch (const std::runtime_error&) { isThrown = true; }
+        assert(isThrown);
+    }
+
+    // typing: every keystroke cancels the previous query, only the last one has to complete
+    {
+        std::vector<std::future<AsyncSearch::Status>> statuses;
+        Delivered last;
+        std::string query;
+        for (char c : std::string("hystorical parliament"))
+        {
+            query += c;
+            bool isLast = query.size() == 21;
+            auto ignore = [](IncrementalSearch::Tier, const IncrementalSearch::Result*, size_t) {};
+            statuses.push_back(async.search(query, 10, isLast ? AsyncSearch::Callback(collect(last)) : AsyncSearch::Callback(ignore)));
+        }
+
+        for (size_t i = 0; i + 1 < statuses.size(); ++i)
+            assert(statuses[i].get() != AsyncSearch::eDEADLINE_EXCEEDED);
+
+        assert(statuses.back().get() == AsyncSearch::eCOMPLETED && last.back().second == search.search("hystorical parliament"));
+    }
+
+    // destruction drops the pending query
+    std::future<AsyncSearch::Status> pending;
+    {
+        AsyncSearch destroyed { search };
+        destroyed.search("hystorical", 10, [](IncrementalSearch::Tier, const IncrementalSearch::Result*, size_t) {});
+        pending = destroyed.search("parliament", 10, [](IncrementalSearch::Tier, const IncrementalSearch::Result*, size_t) {});
+    }
+    assert(pending.get() != AsyncSearch::eDEADLINE_EXCEEDED);
+}
+
+void testSearchServer()
+{
+    std::vector<std::string> wikipedia = loadWikipedia();
+    IncrementalSearch search { wikipedia };
+
+    // typed prefixes of captions, some with a misprint, and repeated ones
+    std::vector<std::string> queries = { "hystorical", "the", "HIST", "parliament", "zzzzzz", "", "caf\xC3\xA9", "a", "hystorical", "the" };
+    std::mt19937 random(12);
+    for (int i = 0; i < 40; ++i)
+    {
+        const std::string& caption = wikipedia[std::uniform_int_distribution<size_t>(0, wikipedia.size() - 1)(random)];
+        std::string query = caption.substr(0, std::uniform_int_distribution<size_t>(1, 16)(random));
+        if (i % 3 == 0)
+            query[std::uniform_int_distribution<size_t>(0, query.size() - 1)(random)] = 'a' + std::uniform_int_distribution<int>(0, 25)(random);
+
+        queries.push_back(query);
+    }
+
+    std::vector<std::string> lowercase(queries);
+    for (std::string& query : lowercase)
+        utf8::lowercase(query);
+
+#if !defined _WIN32
+    static const char* k_socket = "test.sock";
+
+    SearchServer::Options options;
+    options.m_workers  = 2;
+    options.m_maxBatch = 8;
+
+    SearchServer server(search, options);
+    assert(server.start(k_socket) && !server.start(k_socket));
+
+    SearchClient client;
+    assert(client.connect(k_socket));
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        assert(*client.search(queries[i], 10) == search.search(queries[i], 10));
+
+        for (bool isIncremental : { false, true })
+        {
+            auto corrections = client.getCorrections(queries[i], 5, isIncremental);
+            auto expected    = search.getSpellCheck().getCorrections(lowercase[i], 5, isIncremental);
+            assert(corrections && std::equal(corrections->begin(), corrections->end(), expected.begin(), expected.end(),
+                                             [](const std::pair<std::string, unsigned>& left, const SpellCheck::Correction& right)
+                                             { return left.first == right.m_word && left.second == right.m_distance; }));
+        }
+    }
+
+    // pipelined requests of concurrent clients are batched, responses are matched by id
+    std::vector<std::thread> clients;
+    std::atomic<size_t>      failures(0);
+    for (int thread = 0; thread < 4; ++thread)
+    {
+        clients.emplace_back([&]()
+        {
+            SearchClient pipelined;
+            if (!pipelined.connect(k_socket))
+                return void(++failures);
+
+            for (uint32_t id = 0; id < queries.size(); ++id)
+                pipelined.send(id, SearchServer::eSEARCH, queries[id], 10);
+
+            SearchClient::Response response;
+            for (size_t i = 0; i < queries.size(); ++i)
+            {
+                IncrementalSearch::Strings found;
+                bool isReceived = pipelined.receive(response);
+                for (const SearchClient::Item& item : response.m_items)
+                    found.push_back(item.m_text);
+
+                if (!isReceived || response.m_id >= queries.size() || found != search.search(queries[response.m_id], 10))
+                    ++failures;
+            }
+        });
+    }
+
+    for (std::thread& thread : clients)
+        thread.join();
+
+    assert(failures == 0);
+
+    // the same word of different counts in a batch: fewer corrections are the first ones
+    auto expected = search.getSpellCheck().getCorrections("hystorical", 5);
+    for (uint16_t maxCount : { 1, 5, 3 })
+        assert(client.send(maxCount, SearchServer::eCORRECTIONS, "hystorical", maxCount));
+
+    SearchClient::Response response;
+    for (int i = 0; i < 3; ++i)
+    {
+        assert(client.receive(response) && response.m_items.size() == std::min<size_t>(response.m_id, expected.size()));
+        assert(std::equal(response.m_items.begin(), response.m_items.end(), expected.begin(), [](const SearchClient::Item& item, const SpellCheck::Correction& correction)
+                          { return item.m_text == correction.m_word && item.m_value == correction.m_distance; }));
+    }
+
+    // unknown request type
+    assert(client.send(7, static_cast<SearchServer::RequestType>(9), "the", 10));
+    assert(client.receive(response) && response.m_id == 7 && response.m_status == SearchServer::eBAD_REQUEST && response.m_items.empty());
+    assert(!client.send(8, SearchServer::eSEARCH, std::string(SearchServer::k_maxQuerySize + 1, 'a'), 10));
+
+    SearchServer::Stats stats = server.getStats();
+    assert(stats.m_requests >= queries.size() * 7 && stats.m_batches <= stats.m_requests);
+
+    // connections are closed by stop()
+    server.stop();
+    assert(!client.search("the"));
+    assert(!SearchClient().connect(k_socket));
+#endif
+}
+
+void testDocumentCheck()
+{
+    std::vector<std::string> wikipedia = loadWikipedia();
+    SpellCheck speller { wikipedia, &tolower };
+
+    // wikipedia text with misprints, repeated so that misprints repeat too
+    std::string document;
+    for (size_t i = 0; i < 300; ++i)
+        document += wikipedia[i * 7 % wikipedia.size()] + (i % 3 == 0 ? ", hystorical Parliment!\n" : i % 5 == 0 ? " -- revolutoin\t" : "\n");
+
+    std::vector<std::string> tokens;
+    SpellCheck::tokenize(document, tokens, &tolower);
+
+    // reference: every token not in vocabulary, corrections of every one
+    std::vector<std::string> expectedWords;
+    for (const std::string& token : tokens)
+        if (speller.getVocabulary().find(token) == TokenArena::k_none)
+            expectedWords.push_back(token);
+
+    assert(expectedWords.size() > 100);
+
+    for (unsigned threads : { 1u, 4u })
+    {
+        for (size_t batchSize : { size_t(1) << 20, size_t(16), size_t(3) })
+        {
+            DocumentCheck::Options options;
+            options.m_threads   = threads;
+            options.m_batchSize = batchSize;
+            DocumentCheck checker(speller, options);
+
+            std::vector<std::string> words;
+            size_t lastOffset = 0;
+            auto onMisspelling = [&](const DocumentCheck::Misspelling& misspelling)
+            {
+                assert(words.empty() || misspelling.m_offset > lastOffset);
+                std::string original = document.substr(misspelling.m_offset, misspelling.m_word.size());
+                std::transform(original.begin(), original.end(), original.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+                assert(original == misspelling.m_word);
+                assert(isSameCorrections(misspelling.m_corrections, speller.getCorrections(std::string(misspelling.m_word), options.m_maxCorrections)));
+
+                lastOffset = misspelling.m_offset;
+                words.emplace_back(misspelling.m_word);
+            };
+
+            DocumentCheck::Stats stats = checker.check(document, onMisspelling, &tolower);
+            assert(words == expectedWords && stats.m_words == tokens.size() && stats.m_misspellings == words.size());
+
+            // repeated misprints of a batch are looked up once
+            assert(batchSize > 16 ? stats.m_lookups < stats.m_misspellings / 10 : stats.m_lookups <= stats.m_misspellings);
+
+            // stream blocks split tokens, ones longer than a block too
+            words.clear();
+            std::istringstream stream(document);
+            DocumentCheck::Stats streamStats = checker.check(stream, onMisspelling, &tolower);
+            assert(words == expectedWords && streamStats.m_words == tokens.size());
+        }
+    }
+
+    DocumentCheck checker(speller);
+    assert(checker.isKnown("parliament") && !checker.isKnown("parliment") && !checker.isKnown(""));
+
+    // memory-mapped file
+    static const char* k_path = "document.txt";
+    std::ofstream(k_path, std::ios::binary) << document;
+
+    size_t count = 0;
+    auto stats = checker.checkFile(k_path, [&count](const DocumentCheck::Misspelling&) { ++count; }, &tolower);
+    assert(stats && stats->m_misspellings == expectedWords.size() && count == expectedWords.size());
+    std::remove(k_path);
+
+    assert(!checker.checkFile(k_path, [](const DocumentCheck::Misspelling&) {}));
+    assert(checker.check(std::string_view(), [](const DocumentCheck::Misspelling&) {}).m_words == 0);
+}
+
+void testUtf8()
+{
+    // case folding keeps token chars and UTF-8 length of every codepoint
+    for (char32_t c = 0; c <= 0x10FFFF; ++c)
+    {
+        if (c >= 0xD800 && c <= 0xDFFF)
+            continue;
+
+        char32_t lower = utf8::lowercase(c);
+        auto     getLength = [](char32_t c) { return c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4; };
+        assert(utf8::isAlnum(lower) == utf8::isAlnum(c) && getLength(lower) == getLength(c) && utf8::lowercase(lower) == lower);
+
+        char   sequence[4];
+        size_t position = 0;
+        utf8::encode(c, sequence, getLength(c));
+        assert(utf8::decode(std::string_view(sequence, getLength(c)), position) == c && position == size_t(getLength(c)));
+    }
+
+    // overlong forms, surrogates and truncated sequences are invalid bytes
+    for (const char* invalid : { "\xC0\xAF", "\xE0\x80\xAF", "\xED\xA0\x80", "\xF4\x90\x80\x80", "\xE2\x82", "\x80" })
+    {
+        size_t position = 0;
+        assert(utf8::decode(invalid, position) == utf8::k_invalid + static_cast<unsigned char>(invalid[0]) && position == 1);
+    }
+
+    // SIMD blocks give the same tokens and lowercase text as the codepoint by codepoint reference
+    std::mt19937 random(22);
+    const std::vector<std::string> pieces = { "a", "Z", "9", " ", ".", "-", "\xC3\x89", "\xC3\xA9", "\xC3\x9F", "\xD0\x96", "\xD0\xB6",
+                                              "\xE2\x80\x94", "\xE4\xB8\xAD", "\xF0\x9F\x98\x80", "\xFF", "\xC3", "\xE2\x82" };
+    for (int i = 0; i < 3000; ++i)
+    {
+        std::string text;
+        for (size_t count = std::uniform_int_distribution<size_t>(0, 80)(random); count != 0; --count)
+            text += std::uniform_int_distribution<size_t>(0, 3)(random) != 0 ? pieces[std::uniform_int_distribution<size_t>(0, 5)(random)]
+                                                                           : pieces[std::uniform_int_distribution<size_t>(0, pieces.size() - 1)(random)];
+
+        std::vector<std::pair<size_t, size_t>> expectedTokens;
+        std::string                            expectedLowercase;
+        for (size_t position = 0; position < text.size(); )
+        {
+            size_t   begin     = position;
+            char32_t codepoint = utf8::decode(text, position);
+            bool     isToken   = utf8::isAlnum(codepoint);
+
+            if (isToken && (expectedTokens.empty() || expectedTokens.back().second != begin))
+                expectedTokens.emplace_back(begin, position);
+            else if (isToken)
+                expectedTokens.back().second = position;
+
+            if (codepoint >= utf8::k_invalid + 0x80 && codepoint <= utf8::k_invalid + 0xFF)
+            {
+                expectedLowercase += text[begin];
+                continue;
+            }
+
+            char buffer[4];
+            utf8::encode(utf8::lowercase(codepoint), buffer, position - begin);
+            expectedLowercase.append(buffer, position - begin);
+        }
+
+        std::vector<std::pair<size_t, size_t>> tokens;
+        utf8::forEachToken(text, [&tokens](size_t begin, size_t end) { tokens.emplace_back(begin, end); });
+        assert(tokens == expectedTokens);
+
+        std::string lowercase = text;
+        utf8::lowercase(lowercase);
+        assert(lowercase == expectedLowercase);
+        assert(utf8::isAscii(text) == std::all_of(text.begin(), text.end(), [](char c) { return static_cast<unsigned char>(c) < 0x80; }));
+    }
+
+    // tokens and distances are in codepoints
+    std::vector<std::string> tokens;
+    SpellCheck::tokenize("Caf\xC3\xA9 Stra\xC3\x9F" "e\xE2\x80\x94na\xC3\xAFve \xC3\x89" "COLE", tokens, utf8::Lowercase());
+    assert((tokens == std::vector<std::string> { "caf\xC3\xA9", "stra\xC3\x9F" "e", "na\xC3\xAFve", "\xC3\xA9" "cole" }));
+
+    tokens.clear();
+    SpellCheck::tokenize("\xC3\x89" "COLE", tokens, &tolower);
+    assert((tokens == std::vector<std::string> { "\xC3\x89" "cole" }));
+
+    assert(SpellCheck::getUtf8Distance("caf\xC3\xA9", "cafe") == 1);
+    assert(SpellCheck::getUtf8Distance("stra\xC3\x9F" "e", "strasse") == 2);
+    assert(SpellCheck::getUtf8Distance("na\xC3\xAFve", "na\xC3\xAF", true) == 0);
+    assert(SpellCheck::getUtf8Distance("\xD0\xB6\xD1\x83\xD0\xBA", "\xD0\xB6\xD0\xBA\xD1\x83") == 1);   // transposition
+
+    // every engine gives the same corrections as codepoint distances to every token
+    const std::string alphabet[] = { "a", "b", "c", "d", "\xC3\xA9", "\xD0\xB6", "\xC3\x9F" };
+    std::vector<std::string> text;
+    for (int i = 0; i < 3000; ++i)
+    {
+        std::string word;
+        for (size_t size = std::uniform_int_distribution<size_t>(1, 7)(random); size != 0; --size)
+            word += alphabet[std::uniform_int_distribution<size_t>(0, i % 2 == 0 ? 3 : 6)(random)];
+
+        text.push_back(word);
+    }
+
+    SpellCheck::Options scan, unbatched, bkTree, deletions;
+    unbatched.m_batches = false;
+    bkTree.m_bkTree     = true;
+    deletions.m_deletionDistance = 2;
+    deletions.m_trie             = true;
+
+    SpellCheck engines[] = { SpellCheck { text, utf8::Lowercase(), scan }, SpellCheck { text, utf8::Lowercase(), unbatched },
+                             SpellCheck { text, utf8::Lowercase(), bkTree }, SpellCheck { text, utf8::Lowercase(), deletions } };
+    const SpellCheck&   speller = engines[0];
+    SpellCheck::Session session { engines[3] };
+
+    for (int i = 0; i < 200; ++i)
+    {
+        std::string query;
+        for (size_t size = std::uniform_int_distribution<size_t>(0, 8)(random); size != 0; --size)
+            query += alphabet[std::uniform_int_distribution<size_t>(0, i % 3 == 0 ? 3 : 6)(random)];
+
+        for (bool isIncremental : { false, true })
+        {
+            SpellCheck::Corrections expected;
+            const TokenArena&       vocabulary = speller.getVocabulary();
+            for (TokenArena::Id token = 0; token < vocabulary.size(); ++token)
+                expected.push_back({ SpellCheck::getUtf8Distance(vocabulary[token], query, isIncremental), vocabulary[token], token });
+
+            expected.sort([](const SpellCheck::Correction& left, const SpellCheck::Correction& right)
+                          { return left.m_distance < right.m_distance || (left.m_distance == right.m_distance && left.m_token < right.m_token); });
+            expected.resize(7);
+
+            for (const SpellCheck& engine : engines)
+                assert(isSameCorrections(engine.getCorrections(query, 7, isIncremental), expected));
+
+            assert(isSameCorrections(speller.getCorrectionsParallel(query, 7, isIncremental, 3), expected));
+
+            session.setQuery(query);
+            assert(isSameCorrections(session.getCorrections(7, isIncremental), expected));
+
+            if (!isIncremental)
+            {
+                auto nearest = engines[3].getNearCorrections(query, 7);
+                expected.remove_if([](const SpellCheck::Correction& correction) { return correction.m_distance > 2; });
+                assert(isSameCorrections(nearest, expected));
+            }
+        }
+    }
+
+    // non-ASCII tokens are stored in the snapshot too
+    static const char* k_path = "test.snapshot";
+    {
+        SnapshotWriter writer(k_path);
+        engines[2].save(writer);
+        assert(writer.isGood());
+    }
+
+    {
+        MappedFile file(k_path);
+        SnapshotReader reader(file.data(), file.size());
+        SpellCheck loaded(reader);
+        assert(reader.isGood() && reader.isAtEnd());
+
+        for (const char* query : { "ab\xC3\xA9", "\xD0\xB6\xD0\xB6", "abcd" })
+            assert(isSameCorrections(loaded.getCorrections(query, 7), engines[2].getCorrections(query, 7)));
+    }
+
+    std::remove(k_path);
+
+    // captions are folded by codepoints, and typed UTF-8 sequences are folded once they are complete
+    std::vector<std::string> captions = { "Caf\xC3\xA9 de Flore", "\xC3\x89" "cole normale", "\xD0\x9C\xD0\xBE\xD1\x81\xD0\xBA\xD0\xB2\xD0\xB0 river", "Cafe society" };
+    IncrementalSearch search { captions };
+
+    assert((search.search("CAF\xC3\x89") == IncrementalSearch::Strings { captions[0] }));
+    assert((search.search("CAFX") == IncrementalSearch::Strings { captions[0], captions[3] }));     // both are a substitution away
+    assert((search.search("\xC3\xA9" "cole") == IncrementalSearch::Strings { captions[1] }));
+    assert((search.search("\xD0\xBC\xD0\xBE\xD1\x81\xD0\xBA\xD0\xB0") == IncrementalSearch::Strings { captions[2] }));
+
+    IncrementalSearch::SearchSession typing = search.startSession();
+    std::string typed = "\xD0\x9C\xD0\x9E\xD0\xA1\xD0\x9A";
+    for (char c : typed)
+    {
+        typing.push(c);
+        assert(typing.search() == search.search(typing.getQuery()));
+    }
+
+    assert(typing.getQuery() == "\xD0\xBC\xD0\xBE\xD1\x81\xD0\xBA");
+    assert((typing.search() == IncrementalSearch::Strings { captions[2] }));
+}
+
+void testParallelCorrections()
+{
+    std::vector<std::string> wikipedia = loadWikipedia();
+    SpellCheck speller { wikipedia, &tolower };
+
+    // executor may be any callable, e.g. serial one
+    auto serialExecutor = [](size_t taskCount, const std::function<void(size_t)>& task)
+    {
+        for (size_t i = taskCount; i-- > 0;)
+            task(i);
+    };
+
+    static const char* queries[] = { "earthqake", "revolutoin", "wrold", "the", "a", "", "1918", "qwertyuiop" };
+    for (const char* query : queries)
+    {
+        for (bool isIncremental : { false, true })
+        {
+            auto expected = speller.getCorrections(query, 7, isIncremental);
+
+            for (unsigned chunks : { 0u, 2u, 3u, 8u })
+                assert(isSameCorrections(speller.getCorrectionsParallel(query, 7, isIncremental, chunks), expected));
+
+            assert(isSameCorrections(speller.getCorrectionsParallel(query, 7, isIncremental, 5, serialExecutor), expected));
+        }
+    }
+}
+
+void testSearchSession()
+{
+    IncrementalSearch search = load(withTrie());
+    IncrementalSearch plain  = load();
+    IncrementalSearch::SearchSession session   = search.startSession();
+    IncrementalSearch::SearchSession stateless = plain.startSession();
+
+    // random typing with occasional backspaces, including uppercase and non-alphanumeric chars
+    std::mt19937 random(1);
+    const std::string alphabet = "etaoinshrdlucmfwypvbgkqjxz EA0";
+    std::string query;
+
+    for (int i = 0; i < 200; ++i)
+    {
+        if (!query.empty() && std::uniform_int_distribution<int>(0, 3)(random) == 0)
+        {
+            query.pop_back();
+            session.pop();
+            stateless.pop();
+        }
+        else
+        {
+            char c = alphabet[std::uniform_int_distribution<size_t>(0, alphabet.size() - 1)(random)];
+            query += c;
+            session.push(c);
+            stateless.push(c);
+        }
+
+        if (query.size() > 12)
+        {
+            session.setQuery(query = query.substr(0, 2));
+            stateless.setQuery(query);
+        }
+
+        std::string lowercase = query;
+        std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(), [](char c) { return tolower(c); });
+
+        assert(session.getQuery() == lowercase);
+        assert(isSameCorrections(session.getCorrections(), search.getCorrections(lowercase)));
+        assert(session.search() == search.search(query));
+        assert(stateless.getQuery() == lowercase && stateless.search() == session.search());
+    }
+
+    // non-incremental corrections and query replacement
+    SpellCheck::Options options;
+    options.m_trie = true;
+
+    const char* vocabulary[] = { "abc abcd abd xyz", "b ba bab" };
+    SpellCheck speller { vocabulary, SpellCheck::NoCaseConversion(), options };
+    SpellCheck::Session spellerSession { speller };
+
+    for (const char* word : { "ab", "abx", "x", "", "baab", "abdc", "xyzzy" })
+    {
+        spellerSession.setQuery(word);
+        for (bool isIncremental : { false, true })
+            assert(isSameCorrections(spellerSession.getCorrections(10, isIncremental), speller.getCorrections(word, 10, isIncremental)));
+    }
+}
+
+void testAllocationFreeSearch()
+{
+    IncrementalSearch search = load(withTrie());
+    IncrementalSearch::SearchSession session = search.startSession();
+
+    const std::string queries[] = { "Bulgaria", "bulgaia", "Buolgaria", "fotbal", "a", "", "zzzzzz", "hystorical parliament", "kin" };
+    const size_t      k_maxCount = 10;
+    IncrementalSearch::Result results[k_maxCount];
+
+    // the same results as search() returns, including limits less than tiers size
+    for (const std::string& query : queries)
+    {
+        for (size_t maxCount : { size_t(0), size_t(1), size_t(3), k_maxCount })
+        {
+            auto expected = search.search(query, maxCount);
+            size_t count  = search.search(query, results, maxCount);
+
+            assert(count == expected.size());
+            for (size_t i = 0; i < count; ++i)
+                assert(results[i].m_text == expected[i]);
+        }
+    }
+
+    // thread-local buffers have grown to the longest query, so no more allocations are expected
+    session.setQuery(queries[0]);
+
+    size_t allocations = s_allocations;
+    for (const std::string& query : queries)
+        search.search(query, results, k_maxCount);
+
+    size_t sessionCount = session.search(results, k_maxCount);
+    assert(s_allocations == allocations);
+
+    auto expected = search.search(queries[0], k_maxCount);
+    assert(sessionCount == expected.size());
+    for (size_t i = 0; i < sessionCount; ++i)
+        assert(results[i].m_text == expected[i]);
+
+    // inline top-k is the same as the list one
+    SpellCheck::TopCorrections<7> top;
+    SpellCheck::TopCorrections<7> fewer(2);
+    for (const std::string& query : queries)
+    {
+        for (bool isIncremental : { false, true })
+        {
+            auto corrections = search.getSpellCheck().getCorrections(query, 7, isIncremental);
+            search.getSpellCheck().getCorrections(query, top, isIncremental);
+            search.getSpellCheck().getCorrections(query, fewer, isIncremental);
+
+            assert(top.size() == corrections.size() && fewer.size() == std::min<size_t>(2, corrections.size()));
+            assert(std::equal(top.begin(), top.end(), corrections.begin(), [](const SpellCheck::Correction& left, const SpellCheck::Correction& right)
+            {
+                return left.m_distance == right.m_distance && left.m_token == right.m_token;
+            }));
+            assert(std::equal(fewer.begin(), fewer.end(), top.begin(), [](const SpellCheck::Correction& left, const SpellCheck::Correction& right)
+            {
+                return left.m_distance == right.m_distance && left.m_token == right.m_token;
+            }));
+        }
+    }
+}
+
+void testSearchIndexes()
+{
+    std::vector<std::string> wikipedia = loadWikipedia();
+    IncrementalSearch::Options noIndex;
+    noIndex.m_substringIndex  = false;
+    noIndex.m_correctionIndex = false;
+
+    IncrementalSearch::Options substringIndex = noIndex;
+    substringIndex.m_substringIndex = true;
+
+    IncrementalSearch::Options correctionIndex = noIndex;
+    correctionIndex.m_correctionIndex = true;
+
+    IncrementalSearch indexed        { wikipedia };
+    IncrementalSearch scanned        { wikipedia, noIndex };
+    IncrementalSearch substringOnly  { wikipedia, substringIndex };
+    IncrementalSearch correctionOnly { wikipedia, correctionIndex };
+
+    // substrings of the text, misprints and absent ones, long enough to fill all tiers
+    std::mt19937 random(2);
+    std::vector<std::string> queries = { "", "a", "an", "ana", "history", "hystory", "of the", "zzzz", "aaa", "ababab" };
+    for (int i = 0; i < 200; ++i)
+    {
+        const std::string& item = wikipedia[std::uniform_int_distribution<size_t>(0, wikipedia.size() - 1)(random)];
+        size_t first = std::uniform_int_distribution<size_t>(0, item.size() - 1)(random);
+        size_t size  = std::uniform_int_distribution<size_t>(1, 12)(random);
+        queries.push_back(item.substr(first, size));
+
+        if (i % 2 == 0)
+            queries.push_back(randomWord(random, 6, "etaoinshrdlu "));
+    }
+
+    for (const std::string& query : queries)
+    {
+        for (size_t maxCount : { 1, 10, 200 })
+        {
+            auto expected = scanned.search(query, maxCount);
+            assert(indexed.search(query, maxCount) == expected);
+            assert(substringOnly.search(query, maxCount) == expected);
+            assert(correctionOnly.search(query, maxCount) == expected);
+        }
+    }
+
+    // every item containing a substring is a candidate
+    const std::vector<std::string> items = { "abcd", "bcdx", "xabc", "abxbc", "", "ab", "abcabc" };
+    TrigramIndex index { items };
+    std::vector<TrigramIndex::Item> candidates;
+    index.forEachCandidate("abc", [&candidates](TrigramIndex::Item item) { candidates.push_back(item); return true; });
+    assert((candidates == std::vector<TrigramIndex::Item> { 0, 2, 6 }));
+
+    candidates.clear();
+    index.forEachCandidate("abcd", [&candidates](TrigramIndex::Item item) { candidates.push_back(item); return false; });
+    assert((candidates == std::vector<TrigramIndex::Item> { 0 }));
+    assert(!index.isSupported("ab") && !TrigramIndex().isSupported("abc"));
+
+    // compressed lists, including multi-byte deltas
+    std::vector<std::pair<PostingLists::Key, PostingLists::Item>> pairs = { { 2, 5 }, { 0, 100000 }, { 0, 3 }, { 2, 5 }, { 0, 130 }, { 2, 0 } };
+    PostingLists lists { pairs, 4 };
+
+    auto getItems = [&lists](PostingLists::Key key)
+    {
+        std::vector<PostingLists::Item> items;
+        for (PostingLists::Cursor cursor = lists.getItems(key); !cursor.isEnd(); cursor.next())
+            items.push_back(*cursor);
+
+        assert(items.size() == lists.getSize(key));
+        return items;
+    };
+
+    assert((getItems(0) == std::vector<PostingLists::Item> { 3, 130, 100000 }));
+    assert((getItems(1).empty() && getItems(3).empty()));
+    assert((getItems(2) == std::vector<PostingLists::Item> { 0, 5 }));
+}
+
+void testBatchDistance()
+{
+    std::mt19937 random(3);
+
+    for (const std::string alphabet : { "ab", "abcd", "abcdefghijklmnopqrstuvwxyz" })
+    {
+        std::vector<std::string> words;
+        for (int i = 0; i < 500; ++i)
+            words.push_back(randomWord(random, 12, alphabet));
+
+        BatchDistance batches { words };
+
+        for (int i = 0; i < 30; ++i)
+        {
+            std::string query    = randomWord(random, 14, alphabet);
+            unsigned maxDistance = std::uniform_int_distribution<unsigned>(0, 6)(random);
+
+            for (bool isIncremental : { false, true })
+            {
+                for (BatchDistance::Isa isa : { BatchDistance::Isa::eSCALAR, BatchDistance::Isa::eSSE42, BatchDistance::Isa::eAVX2 })
+                {
+                    if (isa > BatchDistance::getBestIsa())
+                        continue;
+
+                    size_t checked = 0;
+                    for (size_t b = 0; b < batches.size(); ++b)
+                    {
+                        const BatchDistance::Batch& batch = batches[b];
+                        unsigned distances[BatchDistance::k_lanes];
+
+                        for (unsigned limit : { SpellCheck::k_noLimit, maxDistance })
+                        {
+                            bool isIncrementalMatch = SpellCheck::isIncrementalMatch(batch.m_length, query.size(), isIncremental);
+                            batches.getDistances(batch, query.data(), query.size(), isIncrementalMatch, limit, distances, isa);
+
+                            for (size_t lane = 0; lane < batch.m_count; ++lane)
+                            {
+                                unsigned expected = SpellCheck::getSmartDistance(words[batch.m_words[lane]], query, isIncremental);
+                                assert(expected > limit ? distances[lane] > limit : distances[lane] == expected);
+                            }
+                        }
+
+                        checked += batch.m_count;
+                    }
+
+                    assert(checked == words.size());
+                }
+            }
+        }
+    }
+
+    // batched corrections are the same as scalar ones
+    SpellCheck::Options scalar;
+    scalar.m_batches = false;
+
+    std::vector<std::string> wikipedia = loadWikipedia();
+    SpellCheck batched   { wikipedia, &tolower };
+    SpellCheck unbatched { wikipedia, &tolower, scalar };
+
+    static const char* queries[] = { "earthqake", "revolutoin", "wrold", "the", "a", "", "1918", "qwertyuiop", "pandemicc" };
+    for (const char* query : queries)
+        for (bool isIncremental : { false, true })
+            assert(isSameCorrections(batched.getCorrections(query, 5, isIncremental), unbatched.getCorrections(query, 5, isIncremental)));
+}
+
+void testBkTree()
+{
+    SpellCheck::Options options;
+    options.m_bkTree = true;
+
+    std::vector<std::string> wikipedia = loadWikipedia();
+    SpellCheck linear  { wikipedia, &tolower };
+    SpellCheck indexed { wikipedia, &tolower, options };
+
+    static const char* queries[] = { "earthqake", "pandemic", "lisbon", "dalia", "xyz", "", "a", "wrold", "revolutoin", "1918", "qwertyuiop" };
+    for (const char* query : queries)
+        for (unsigned maxCount : { 1u, 5u, 20u })
+            assert(isSameCorrections(linear.getCorrections(query, maxCount), indexed.getCorrections(query, maxCount)));
+
+    // incremental lookup falls back to linear scan
+    assert(isSameCorrections(linear.getCorrections("earthq", 5, true), indexed.getCorrections("earthq", 5, true)));
+}
+
+void testTokenArena()
+{
+    const std::vector<std::string> tokens = { "a", "abc", "ac", "b", "bcd", "xyzw", "z" };
+    TokenArena arena { tokens };
+
+    assert(arena.size() == tokens.size() && arena.getBucketCount() == 4);
+    for (TokenArena::Id id = 0; id < tokens.size(); ++id)
+        assert(arena[id] == tokens[id] && arena.find(tokens[id]) == id);
+
+    assert(arena.find("") == TokenArena::k_none && arena.find("ab") == TokenArena::k_none && arena.find("zz") == TokenArena::k_none);
+
+    // buckets are sorted by length, tokens within a bucket are in vocabulary order
+    std::vector<std::string> stored;
+    for (size_t i = 0; i < arena.getBucketCount(); ++i)
+    {
+        const TokenArena::Bucket& bucket = arena.getBucket(i);
+        for (size_t position = bucket.m_first; position < bucket.m_last; ++position)
+        {
+            assert(arena.getBucketToken(bucket, position) == arena[arena.getStorageId(position)]);
+            stored.emplace_back(arena.getBucketToken(bucket, position));
+        }
+    }
+
+    assert((stored == std::vector<std::string> { "a", "b", "z", "ac", "abc", "bcd", "xyzw" }));
+}
 
-void unitTests();
-void interactive();
-void help();
-void profileOsa();
-void profileOsaIncremental();
+void testSnapshot()
+{
+    static const char* k_path = "test.snapshot";
 
-static const std::string s_help = "-h";
+    std::vector<std::string> wikipedia = loadWikipedia();
+    IncrementalSearch built { wikipedia, withTrie() };
+    assert(built.saveSnapshot(k_path));
 
-typedef void (*Callback)();
-typedef std::pair<Callback, const char*> CallbackInfo;
-typedef std::map<std::string, CallbackInfo> Handlers;
+    std::optional<IncrementalSearch> mapped = IncrementalSearch::loadSnapshot(k_path);
+    assert(mapped);
 
-static Handlers s_handlers =
+    // moved search keeps the mapping alive
+    IncrementalSearch loaded = std::move(*mapped);
+    mapped.reset();
+
+    IncrementalSearch::SearchSession builtSession  = built.startSession();
+    IncrementalSearch::SearchSession loadedSession = loaded.startSession();
+
+    const std::string queries[] = { "", "a", "Bulgaria", "bulgaia", "hystorical parliament", "of the", "zzzz", "kin", "1918" };
+    for (const std::string& query : queries)
+    {
+        assert(loaded.search(query, 50) == built.search(query, 50));
+
+        for (bool isIncremental : { false, true })
+            assert(isSameCorrections(loaded.getSpellCheck().getCorrections(query, 7, isIncremental), built.getSpellCheck().getCorrections(query, 7, isIncremental)));
+
+        builtSession.setQuery(query);
+        loadedSession.setQuery(query);
+        assert(loadedSession.search() == builtSession.search());
+    }
+
+    // BK-tree is stored too, and it is still extendable after loading
+    SpellCheck::Options options;
+    options.m_bkTree = true;
+
+    SpellCheck speller { wikipedia, &tolower, options };
+    {
+        SnapshotWriter writer(k_path);
+        speller.save(writer);
+        assert(writer.isGood());
+    }
+
+    {
+        MappedFile file(k_path);
+        SnapshotReader reader(file.data(), file.size());
+        SpellCheck loadedSpeller(reader);
+        assert(reader.isGood() && reader.isAtEnd());
+
+        for (const std::string& query : queries)
+            assert(isSameCorrections(loadedSpeller.getCorrections(query, 5), speller.getCorrections(query, 5)));
+    }
+
+    // missing, truncated and foreign files are rejected
+    assert(!IncrementalSearch::loadSnapshot("missing.snapshot"));
+
+    assert(built.saveSnapshot(k_path));
+    std::string bytes;
+    {
+        std::ifstream file(k_path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    auto isLoaded = [&bytes](size_t size)
+    {
+        std::ofstream(k_path, std::ios::binary | std::ios::trunc).write(bytes.data(), size);
+        return IncrementalSearch::loadSnapshot(k_path).has_value();
+    };
+
+    assert(isLoaded(bytes.size()));
+    assert(!isLoaded(0) && !isLoaded(10) && !isLoaded(bytes.size() / 2) && !isLoaded(bytes.size() - 1));
+
+    bytes[8] ^= 0xFF;     // version
+    assert(!isLoaded(bytes.size()));
+
+    std::remove(k_path);
+}
+
+void testParallelBuild()
 {
-    { "-u",       { &unitTests,             "unit test" } },
-    { "-i",       { &interactive,           "interactive" } },
-    { s_help,     { &help,                  "help" } },
-    { "-p_osa",   { &profileOsa,            "profile Optimal String Alignment code" } },
-    { "-p_osa_i", { &profileOsaIncremental, "profile Optimal String Alignment incremental code" } },
-};
+    // the same text multiple times is large enough to be split into shards, duplicates are merged
+    std::vector<std::string> wikipedia = loadWikipedia();
+    std::vector<std::string> text;
+    for (int i = 0; i < 4; ++i)
+        text.insert(text.end(), wikipedia.begin(), wikipedia.end());
 
-void help()
+    auto readFile = [](const char* path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    };
+
+    // indexes are byte-identical to the serial build
+    static const char* k_path = "test.snapshot";
+    std::string serial;
+
+    for (unsigned threads : { 1u, 0u, 3u, 8u })
+    {
+        IncrementalSearch::Options options;
+        options.m_buildThreads = threads;
+        options.m_bkTree = true;
+
+        IncrementalSearch search { text, options };
+        assert(search.saveSnapshot(k_path));
+
+        if (threads == 1)
+            serial = readFile(k_path);
+        else
+            assert(readFile(k_path) == serial);
+    }
+
+    std::remove(k_path);
+
+    // sorting of shards and their merge
+    std::mt19937 random(4);
+    std::vector<uint32_t> items(100000);
+    for (uint32_t& item : items)
+        item = std::uniform_int_distribution<uint32_t>(0, 50000)(random);
+
+    std::vector<uint32_t> expected = items;
+    std::sort(expected.begin(), expected.end());
+    expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+
+    for (unsigned threads : { 0u, 2u, 5u, 16u })
+    {
+        std::vector<uint32_t> sorted = items;
+        parallelBuild::sortUnique(sorted, threads);
+        assert(sorted == expected);
+    }
+}
+
+void testLiveSearch()
 {
-    std::cout << "Available options: " << std::endl;
-    for(const auto& optionHandlerPair : s_handlers)
-        std::cout << "  " << optionHandlerPair.first << "\t  : " << optionHandlerPair.second.second << std::endl;
+    std::vector<std::string> wikipedia = loadWikipedia();
+    std::vector<std::string> captions(wikipedia.begin(), wikipedia.begin() + 2000);
+
+    LiveSearch::Options options;
+    options.m_maxDeltaSize = 50;
+    LiveSearch live { captions, options };
+
+    // random writes, including duplicates and captions with new words; results are the same as of a rebuilt search
+    std::mt19937 random(5);
+    const std::string queries[] = { "bulgaria", "histori", "of the", "a", "zzzz", "quxxle", "paris", "earthqake", "war" };
+
+    for (int i = 0; i < 300; ++i)
+    {
+        size_t action = std::uniform_int_distribution<size_t>(0, 3)(random);
+        const std::string& existing = captions[std::uniform_int_distribution<size_t>(0, captions.size() - 1)(random)];
+
+        if (action == 0)
+        {
+            captions.push_back(wikipedia[std::uniform_int_distribution<size_t>(2000, wikipedia.size() - 1)(random)]);
+            live.insert(captions.back());
+        }
+        else if (action == 1)
+        {
+            captions.push_back(i % 2 == 0 ? existing : "Quxxle " + std::to_string(i));
+            live.insert(captions.back());
+        }
+        else
+        {
+            std::string caption = action == 2 ? existing : "Quxxle " + std::to_string(i - 1);
+            auto found = std::find(captions.begin(), captions.end(), caption);
+            assert(live.erase(caption) == (found != captions.end()));
+            if (found != captions.end())
+                captions.erase(found);
+        }
+
+        if (i % 20 != 0)
+            continue;
+
+        std::shared_ptr<const LiveSearch::Version> version = live.getVersion();
+        assert(version->getCaptions() == captions);
+
+        IncrementalSearch rebuilt { captions };
+        for (const std::string& query : queries)
+        {
+            assert(version->search(query, 30) == rebuilt.search(query, 30));
+
+            auto corrections = version->getCorrections(query);
+            auto expected    = rebuilt.getCorrections(query);
+            assert(std::equal(corrections.begin(), corrections.end(), expected.begin(), expected.end(), [](const SpellCheck::Correction& left, const SpellCheck::Correction& right)
+            {
+                return left.m_distance == right.m_distance && left.m_word == right.m_word;
+            }));
+        }
+
+        // positions are the ones in the rebuilt search
+        LiveSearch::Result results[10];
+        size_t count = version->search("the", results, 10);
+        for (size_t r = 0; r < count; ++r)
+            assert(results[r].m_text == captions[results[r].m_index]);
+    }
+
+    // readers keep their version during writes
+    std::shared_ptr<const LiveSearch::Version> before = live.getVersion();
+    LiveSearch::Strings expected = before->search("war", 100);
+
+    std::atomic<bool> isWriting(true);
+    std::thread reader([&]()
+    {
+        while (isWriting)
+        {
+            assert(before->search("war", 100) == expected);
+            live.search("war");
+        }
+    });
+
+    for (int i = 0; i < 200; ++i)
+        live.insert("War " + std::to_string(i));
+
+    live.compact();
+    isWriting = false;
+    reader.join();
+
+    assert(before->search("war", 100) == expected);
+    assert(live.getVersion()->size() == before->size() + 200);
+
+    // frequency order is cleared: base and delta frequencies differ, but corrections are unique and in vocabulary order
+    LiveSearch::Options frequencyOrder;
+    frequencyOrder.m_frequencyOrder = true;
+
+    const char* tied[] = { "bat bat hat hat hat", "cat" };
+    LiveSearch tiedLive { tied, frequencyOrder };
+    tiedLive.insert("cat cat cat cat");
+    tiedLive.insert("mat");
+
+    IncrementalSearch tiedRebuilt { tiedLive.getVersion()->getCaptions() };
+    auto tiedCorrections = tiedLive.getVersion()->getCorrections("fat");
+    auto tiedExpected    = tiedRebuilt.getCorrections("fat");
+    assert(tiedCorrections.size() == 4);
+    assert(std::equal(tiedCorrections.begin(), tiedCorrections.end(), tiedExpected.begin(), tiedExpected.end(), [](const SpellCheck::Correction& left, const SpellCheck::Correction& right)
+    {
+        return left.m_distance == right.m_distance && left.m_word == right.m_word;
+    }));
 }
 
-int main(int argc, char *argv[])
+void testPrefilter()
 {
-    std::vector<std::string> params;
-    for(int i = 1; i < argc; ++i)
-        params.push_back(argv[i]);
+    // bounds never exceed the distance
+    std::mt19937 random(6);
+    for (const std::string alphabet : { "ab", "abcdefgh", "abcdefghijklmnopqrstuvwxyz0123456789_ABCXYZ" })
+    {
+        std::vector<std::string> tokens;
+        for (int i = 0; i < 300; ++i)
+            tokens.push_back(randomWord(random, 12, alphabet));
 
-    if (params.empty())
-        params.push_back(s_help);
+        Prefilter prefilter { tokens, Prefilter::eALL };
+        for (int i = 0; i < 300; ++i)
+        {
+            std::string query = randomWord(random, 12, alphabet);
+            Prefilter::Signature signature = Prefilter::getSignature(query);
 
-    for(const std::string& mode : params)
+            for (size_t token = 0; token < tokens.size(); ++token)
+            {
+                for (bool isIncremental : { false, true })
+                {
+                    bool     isIncrementalMatch = SpellCheck::isIncrementalMatch(tokens[token].size(), query.size(), isIncremental);
+                    unsigned distance           = SpellCheck::getSmartDistance(tokens[token], query, isIncremental);
+
+                    assert(Prefilter::getLengthBound(tokens[token].size(), query.size(), isIncrementalMatch) <= distance);
+                    assert(prefilter.getCharBound(token, signature, isIncrementalMatch) <= distance);
+                }
+            }
+        }
+    }
+
+    // the same corrections with and without prefilters, every token is either filtered or evaluated
+    std::vector<std::string> wikipedia = loadWikipedia();
+    static const char* queries[] = { "earthqake", "revolutoin", "wrold", "the", "a", "", "1918", "qwertyuiop", "pandemicc" };
+
+    for (bool isBatched : { false, true })
     {
-        Callback handler = s_handlers[mode].first;
-        if (handler == nullptr)
+        SpellCheck::Options options;
+        options.m_batches = isBatched;
+
+        SpellCheck::Options unfiltered = options;
+        unfiltered.m_prefilters = Prefilter::eNONE;
+
+        SpellCheck filtering { wikipedia, &tolower, options };
+        SpellCheck plain     { wikipedia, &tolower, unfiltered };
+
+        for (const char* query : queries)
         {
-            help();
-            return 1;
+            for (bool isIncremental : { false, true })
+            {
+                filtering.resetPrefilterStats();
+                plain.resetPrefilterStats();
+                assert(isSameCorrections(filtering.getCorrections(query, 5, isIncremental), plain.getCorrections(query, 5, isIncremental)));
+
+                Prefilter::Stats stats = filtering.getPrefilterStats();
+                assert(stats.m_filtered + stats.m_evaluated == filtering.getVocabulary().size());
+                assert(plain.getPrefilterStats().m_filtered == 0 && plain.getPrefilterStats().m_evaluated == plain.getVocabulary().size());
+            }
         }
 
-        handler();
+        filtering.resetPrefilterStats();
+        filtering.getCorrections("revolutoin", 5);
+        assert(filtering.getPrefilterStats().m_filtered > 0);
     }
 
-    return 0;
+    SpellCheck::Options bkTree;
+    bkTree.m_bkTree = true;
+    SpellCheck indexed { wikipedia, &tolower, bkTree };
+    SpellCheck linear  { wikipedia, &tolower };
+    for (const char* query : queries)
+        assert(isSameCorrections(indexed.getCorrections(query, 5), linear.getCorrections(query, 5)));
 }
 
-IncrementalSearch load()
+void testDeletionIndex()
 {
-    std::ifstream articles = std::ifstream("../wikipedia.txt");
-    std::vector<std::string> wikipedia;
-    wikipedia.reserve(10000);
-    while (articles)
+    // every token within the index distance is a candidate
+    std::mt19937 random(8);
+    for (const std::string alphabet : { "ab", "abcd", "abcdefghijklmnopqrstuvwxyz" })
     {
-        std::string line;
-        std::getline(articles, line);
+        std::vector<std::string> tokens;
+        for (int i = 0; i < 300; ++i)
+            tokens.push_back(randomWord(random, 9, alphabet));
 
-        if (!line.empty())
-            wikipedia.emplace_back(std::move(line));
+        for (unsigned maxDistance : { 1u, 2u })
+        {
+            DeletionIndex index { tokens, maxDistance };
+            for (int i = 0; i < 100; ++i)
+            {
+                std::string query = randomWord(random, 9, alphabet);
+
+                std::vector<bool> isCandidate(tokens.size(), false);
+                index.forEachCandidate(query, [&isCandidate](DeletionIndex::Token token) { isCandidate[token] = true; });
+
+                for (size_t token = 0; token < tokens.size(); ++token)
+                    assert(isCandidate[token] || SpellCheck::getSmartDistance(tokens[token], query) > maxDistance);
+            }
+        }
+    }
+
+    // the same corrections as of the scan, including ones farther than the index distance
+    std::vector<std::string> wikipedia = loadWikipedia();
+    SpellCheck linear { wikipedia, &tolower };
+
+    static const char* queries[] = { "earthqake", "revolutoin", "wrold", "the", "a", "", "1918", "qwertyuiop", "pandemicc", "xz" };
+    for (unsigned maxDistance : { 1u, 2u })
+    {
+        SpellCheck::Options options;
+        options.m_deletionDistance = maxDistance;
+        SpellCheck indexed { wikipedia, &tolower, options };
+
+        options.m_bkTree = true;
+        SpellCheck indexedTree { wikipedia, &tolower, options };
+
+        for (const char* query : queries)
+        {
+            for (unsigned maxCount : { 0u, 1u, 5u, 40u })
+            {
+                auto expected = linear.getCorrections(query, maxCount);
+                assert(isSameCorrections(indexed.getCorrections(query, maxCount), expected));
+                assert(isSameCorrections(indexedTree.getCorrections(query, maxCount), expected));
+            }
+
+            assert(isSameCorrections(indexed.getCorrections(query, 5, true), linear.getCorrections(query, 5, true)));
+
+            // bounded engine misses only farther corrections
+            auto expected = linear.getCorrections(query, 5);
+            auto nearest  = indexed.getNearCorrections(query, 5);
+            expected.remove_if([maxDistance](const SpellCheck::Correction& correction) { return correction.m_distance > maxDistance; });
+            assert(isSameCorrections(nearest.size() > expected.size() ? std::list<SpellCheck::Correction>(nearest.begin(), std::next(nearest.begin(), expected.size())) : nearest, expected));
+        }
+    }
+}
+
+void testFrequencies()
+{
+    // token counts of the text, equal distances are ordered by them
+    const char* text[] = { "bat bat Bat hat", "cat hat" };
+    SpellCheck::Options frequencyOrder;
+    frequencyOrder.m_frequencyOrder = true;
+
+    SpellCheck plain  { text, &tolower };
+    SpellCheck likely { text, &tolower, frequencyOrder };
+    assert(plain.getFrequency(0) == 3 && plain.getFrequency(1) == 1 && plain.getFrequency(2) == 2);
+
+    auto getWords = [](const SpellCheck::Corrections& corrections)
+    {
+        std::vector<std::string_view> words;
+        for (const SpellCheck::Correction& correction : corrections)
+            words.push_back(correction.m_word);
+
+        return words;
+    };
+
+    assert((getWords(plain.getCorrections("fat", 3)) == std::vector<std::string_view> { "bat", "cat", "hat" }));
+    assert((getWords(likely.getCorrections("fat", 3)) == std::vector<std::string_view> { "bat", "hat", "cat" }));
+    assert((getWords(likely.getLikelyCorrections("fat", 2)) == std::vector<std::string_view> { "bat", "hat" }));
+
+    // without frequency order there is no early stop, the whole vocabulary is scanned
+    assert((getWords(plain.getLikelyCorrections("fat", 2)) == std::vector<std::string_view> { "bat", "cat" }));
+
+    // parallel build counts the same
+    std::vector<std::string> wikipedia = loadWikipedia();
+    SpellCheck::Options parallelOptions = frequencyOrder;
+    parallelOptions.m_buildThreads = 4;
+
+    SpellCheck linear   { wikipedia, &tolower, frequencyOrder };
+    SpellCheck parallel { wikipedia, &tolower, parallelOptions };
+    const TokenArena& vocabulary = linear.getVocabulary();
+    for (TokenArena::Id token = 0; token < vocabulary.size(); ++token)
+        assert(parallel.getFrequency(token) == linear.getFrequency(token) && linear.getFrequency(token) != 0);
+
+    // every engine keeps the frequency order, early termination within distance 1 doesn't change corrections
+    SpellCheck::Options bkTree = frequencyOrder, deletions = frequencyOrder, unbatched = frequencyOrder;
+    bkTree.m_bkTree              = true;
+    deletions.m_deletionDistance = 1;
+    deletions.m_trie             = true;
+    unbatched.m_batches          = false;
+
+    SpellCheck engines[] = { SpellCheck { wikipedia, &tolower, bkTree }, SpellCheck { wikipedia, &tolower, deletions }, SpellCheck { wikipedia, &tolower, unbatched } };
+    SpellCheck::Session session { engines[1] };
+
+    std::mt19937 random(23);
+    std::vector<std::string> queries = { "teh", "the", "a", "", "wrold", "revolutoin", "zzzzzz", "1918", "parliment", "yaer" };
+    for (int i = 0; i < 30; ++i)
+    {
+        std::string word(vocabulary[std::uniform_int_distribution<TokenArena::Id>(0, static_cast<TokenArena::Id>(vocabulary.size() - 1))(random)]);
+        word[std::uniform_int_distribution<size_t>(0, word.size() - 1)(random)] = 'q';
+        queries.push_back(word);
+    }
+
+    for (const std::string& query : queries)
+    {
+        for (bool isIncremental : { false, true })
+        {
+            SpellCheck::Corrections expected;
+            for (TokenArena::Id token = 0; token < vocabulary.size(); ++token)
+                expected.push_back({ SpellCheck::getSmartDistance(vocabulary[token], query, isIncremental), vocabulary[token], token });
+
+            expected.sort([&linear](const SpellCheck::Correction& left, const SpellCheck::Correction& right)
+            {
+                if (left.m_distance != right.m_distance)
+                    return left.m_distance < right.m_distance;
+
+                return linear.getFrequency(left.m_token) != linear.getFrequency(right.m_token) ? linear.getFrequency(left.m_token) > linear.getFrequency(right.m_token)
+                                                                                                : left.m_token < right.m_token;
+            });
+            expected.resize(10);
+
+            assert(isSameCorrections(linear.getCorrections(query, 10, isIncremental), expected));
+            assert(isSameCorrections(linear.getCorrectionsParallel(query, 10, isIncremental, 4), expected));
+            for (const SpellCheck& engine : engines)
+                assert(isSameCorrections(engine.getCorrections(query, 10, isIncremental), expected));
+
+            session.setQuery(query);
+            assert(isSameCorrections(session.getCorrections(10, isIncremental), expected));
+
+            for (unsigned stopDistance : { 0u, 1u })
+                assert(isSameCorrections(linear.getLikelyCorrections(query, 10, stopDistance, isIncremental), expected));
+
+            // farther stop finds the most frequent tokens within it, nearer rare ones may be missed
+            SpellCheck::Corrections approximate = linear.getLikelyCorrections(query, 10, 2, isIncremental);
+            assert(approximate.size() == expected.size() && approximate.back().m_distance <= std::max(2u, expected.back().m_distance));
+        }
+    }
+
+    // a common typo stops after a small part of vocabulary
+    linear.resetPrefilterStats();
+    SpellCheck::TopCorrections<5> top;
+    linear.getLikelyCorrections("teh", top);
+    assert(top.size() == 5 && top.front().m_word == "the");
+
+    Prefilter::Stats stats = linear.getPrefilterStats();
+    assert(stats.m_evaluated + stats.m_filtered < vocabulary.size() / 2);
+
+    // frequencies and their order are stored in the snapshot
+    static const char* k_path = "test.snapshot";
+    {
+        SnapshotWriter writer(k_path);
+        linear.save(writer);
+        assert(writer.isGood());
+    }
+
+    {
+        MappedFile file(k_path);
+        SnapshotReader reader(file.data(), file.size());
+        SpellCheck loaded(reader);
+        assert(reader.isGood() && reader.isAtEnd());
+
+        assert(loaded.getFrequency(vocabulary.size() / 2) == linear.getFrequency(vocabulary.size() / 2));
+        for (const std::string& query : queries)
+            assert(isSameCorrections(loaded.getLikelyCorrections(query, 5), linear.getCorrections(query, 5)));
+    }
+
+    std::remove(k_path);
+}
+
+void testQueryStats()
+{
+    IncrementalSearch search = load();
+    IncrementalSearch::Result results[10];
+
+    QueryStats stats;
+    QueryStats total = queryStats::getTotal();
+    search.search("hystorical", results, 10, stats);
+    QueryStats difference = queryStats::getTotal() - total;
+
+    if (!QueryStats::k_enabled)
+    {
+        assert(stats.m_dpCells == 0 && stats.m_allocations == 0 && difference.m_dpCells == 0);
+        return;
+    }
+
+    assert(stats.m_dpCells > 0 && stats.m_candidatesEvaluated > 0 && stats.m_candidatesPruned > 0);
+    assert(stats.m_correctionsNanoseconds > 0 && stats.m_startsWithNanoseconds > 0);
+
+    // the query is the only finished outermost scope in between
+    assert(difference.m_dpCells == stats.m_dpCells && difference.m_candidatesEvaluated == stats.m_candidatesEvaluated);
+
+    // nested scopes see their own part only
+    {
+        queryStats::Scope outer;
+        {
+            queryStats::Scope inner;
+            SpellCheck::Workspace workspace;
+            SpellCheck::backtraceIncrementalDistance("abcdefghijklmnopqrstuvwxyz", "abcdefghijklmnopqrst", SpellCheck::k_noLimit, workspace);
+            assert(inner.get().m_workspaceGrowths > 0 && inner.get().m_dpCells == 26 * 20);
+        }
+
+        size_t allocations = s_allocations;
+        auto strings = search.search("bulgaria");
+        assert(outer.get().m_allocations >= s_allocations - allocations && outer.get().m_dpCells > 26 * 20);
+    }
+
+    // every check of the items scan is timed
+    search.search("a", results, 10, stats);
+    assert(stats.m_containsNanoseconds > 0 || stats.m_startsWithNanoseconds > 0);
+}
+
+void testQueryCache()
+{
+    // least recently used entry is dropped
+    auto makeEntry = [](const char* query)
+    {
+        auto entry = std::make_shared<QueryCache::Entry>();
+        entry->m_query = query;
+        return entry;
+    };
+
+    QueryCache cache(2);
+    cache.insert(makeEntry("abc"));
+    cache.insert(makeEntry("abd"));
+    assert(cache.find("abc") != nullptr);
+    cache.insert(makeEntry("abe"));
+    assert(cache.size() == 2 && cache.find("abd") == nullptr && cache.find("abc") != nullptr && cache.find("abe") != nullptr);
+
+    cache.insert(makeEntry("abcd"));
+    assert(cache.findPrefix("abcde") == nullptr);   // no candidates are kept
+    assert(cache.find("abcd") != nullptr && cache.find("abc") == nullptr);     // "abe" was used later
+
+    // typing with backspaces ('\b'): the same results as without cache
+    std::vector<std::string> wikipedia = loadWikipedia();
+    IncrementalSearch::Options options;
+    options.m_queryCacheSize = 8;
+
+    IncrementalSearch cached { wikipedia, options };
+    IncrementalSearch plain  { wikipedia };
+
+    static const char* typed[] = { "The Hist\b\bistory of", "paRliament\b\b\b\bxx\b\bment", "hystorical\b\b\b\b\b", "a\bzz", "revolution in fr" };
+    IncrementalSearch::Result results[10];
+    for (const char* keys : typed)
+    {
+        std::string query;
+        for (const char* key = keys; *key != '\0'; ++key)
+        {
+            if (*key == '\b')
+                query.pop_back();
+            else
+                query += *key;
+
+            for (size_t maxCount : { size_t(10), size_t(3) })
+            {
+                auto expected = plain.search(query, maxCount);
+                size_t count  = cached.search(query, results, maxCount);
+
+                assert(count == expected.size());
+                for (size_t i = 0; i < count; ++i)
+                    assert(results[i].m_text == expected[i] && wikipedia[results[i].m_index] == expected[i]);
+
+                assert(cached.search(query, maxCount) == expected);
+            }
+        }
     }
 
-    return IncrementalSearch { wikipedia };
+    // repeated query is served from the cache without any work
+    cached.search("parliament", results, 10);
+    size_t allocations = s_allocations;
+    size_t count = cached.search("parliament", results, 10);
+    assert(s_allocations == allocations && count == plain.search("parliament").size());
 }
 
 #undef max
@@ -113,27 +1748,21 @@ void interactive()
                   << " ============== " << std::endl
                   << "Search: '" << substring << "'..." << std::endl;
 
-        clock_t start = clock();
+        auto start = std::chrono::steady_clock::now();
         auto results = search.search(substring);
-
-#ifdef WANT_PROFILING
-        for (int i = 0; i < 300; ++i)
-        {
-            auto results = search.search(substring);
-        }
-#endif
-
-        clock_t elapsedTime = clock() - start;
+        auto elapsedTime = std::chrono::steady_clock::now() - start;
 
         for (const std::string& result : results)
             std::cout << " > " << result << std::endl;
 
         std::cout << "Corrections: { ";
 
-        for (const SpellCheck::Correction& correction : search.getCorrections(substring))
-            std::cout << correction.m_distance << ": " << *correction.m_word << "; ";
+        std::string lowercase = substring;
+        utf8::lowercase(lowercase);
+        for (const SpellCheck::Correction& correction : search.getCorrections(lowercase))
+            std::cout << correction.m_distance << ": " << correction.m_word << "; ";
 
-        std::cout << "} (" << static_cast<int>((double)elapsedTime/CLOCKS_PER_SEC * 1000) << "ms)" << std::endl;
+        std::cout << "} (" << std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime).count() << "us)" << std::endl;
     }
 }
 
@@ -193,6 +1822,44 @@ void unitTests()
 
     assert(SpellCheck::getSmartDistance("1234567890qwertyuiopasdfghjklzxcvbnm", "____1234567890zxcvbnm____", true) == 27);  // long strings
 
+    // Damerau-Levenshtein distance is a metric, in contrast to OSA
+    assert(SpellCheck::damerauLevenshteinDistance("ca", "abc") == 2);
+    assert(SpellCheck::damerauLevenshteinDistance("abc", "ca") == 2);
+    assert(SpellCheck::damerauLevenshteinDistance("abc", "acb") == 1);
+    assert(SpellCheck::damerauLevenshteinDistance("abc", "") == 3);
+    assert(SpellCheck::damerauLevenshteinDistance("", "abc") == 3);
+    assert(SpellCheck::damerauLevenshteinDistance("kitten", "sitting") == 3);
+
+    // corrections are sorted by distance, then by vocabulary order
+    const char* vocabulary[] = { "bbb abd", "abc xyz abx" };
+    SpellCheck smallSpeller { vocabulary };
+    auto corrections = smallSpeller.getCorrections("abb", 3);
+    assert(corrections.size() == 3 && corrections.front().m_word == "abc" && corrections.back().m_word == "abx");
+    assert(smallSpeller.getCorrections("abb", 0).empty());
+
+    testBitParallel();
+    testBoundedDistance();
+    testIncrementalDistance();
+    testBatchDistance();
+    testBkTree();
+    testPrefilter();
+    testDeletionIndex();
+    testFrequencies();
+    testQueryStats();
+    testQueryCache();
+    testAsyncSearch();
+    testSearchServer();
+    testDocumentCheck();
+    testUtf8();
+    testTokenArena();
+    testSearchSession();
+    testAllocationFreeSearch();
+    testSearchIndexes();
+    testSnapshot();
+    testParallelBuild();
+    testLiveSearch();
+    testParallelCorrections();
+
     const char* rawArray[] = { "one two", "Three" };
     SpellCheck fromRawArray { rawArray };
 
@@ -200,52 +1867,98 @@ void unitTests()
 }
 
 
-void profileSpellCheck(bool isIncremental)
+void profileSnapshot()
 {
-    int doNotOptimize = 0;
+    static const char* k_path = "profile.snapshot";
 
-    static const std::string words[] =
-    {
-        "abcdefghig",         "1_abcdefghig",         "2_abcdefghig",         "3_abcdefghig",         "4_defghig",
-        "bace",               "1_bace",               "2_bace",               "3_bace",               "4_e",
-        "abace",              "1_abace",              "2_abace",              "3_abace",              "4_ce",
-        "qwertyui",           "1_qwertyui",           "2_qwertyui",           "3_qwertyui",           "4_rtyui",
-        "zxcvbnm",            "1_zxcvbnm",            "2_zxcvbnm",            "3_zxcvbnm",            "4_vbnm",
-        "poiuytrewq",         "1_poiuytrewq",         "2_poiuytrewq",         "3_poiuytrewq",         "4_uytrewq",
-        "qazwsx",             "1_qazwsx",             "2_qazwsx",             "3_qazwsx",             "4_wsx",
-        "qazwsxedc",          "1_qazwsxedc",          "2_qazwsxedc",          "3_qazwsxedc",          "4_wsxedc",
-        "",                   "1_",                   "2_",                   "3_",                   "4_",
-        "abcdefghiabcdefghi", "1_abcdefghiabcdefghi", "2_abcdefghiabcdefghi", "3_abcdefghiabcdefghi", "4_defghiabcdefghi",
-        "defgh",              "1_defgh",              "2_defgh",              "3_defgh",              "4_gh",
-        "___defghi",          "1____defghi",          "2____defghi",          "3____defghi",          "4_defghi",
-        "_b_d_f_h_g",         "1__b_d_f_h_g",         "2__b_d_f_h_g",         "3__b_d_f_h_g",         "4_d_f_h_g",
-        "a_c_e_g_i_",         "1_a_c_e_g_i_",         "2_a_c_e_g_i_",         "3_a_c_e_g_i_",         "4__e_g_i_",
-        "acegi",              "1_acegi",              "2_acegi",              "3_acegi",              "4_gi",
-        "bacdfeghgi",         "1_bacdfeghgi",         "2_bacdfeghgi",         "3_bacdfeghgi",         "4_dfeghgi",
-        "gihgfedcba",         "1_gihgfedcba",         "2_gihgfedcba",         "3_gihgfedcba",         "4_gfedcba",
-    };
+    auto start = std::chrono::steady_clock::now();
+    IncrementalSearch built = load();
+    auto buildTime = std::chrono::steady_clock::now() - start;
 
-    clock_t start = clock();
+    built.saveSnapshot(k_path);
 
-    for (int i = 0; i < 10000; ++i)
-    {
-        for (const std::string& s1 : words)
-            for (const std::string& s2 : words)
-                doNotOptimize += SpellCheck::getSmartDistance(s1, s2, isIncremental);
-    }
+    start = std::chrono::steady_clock::now();
+    std::optional<IncrementalSearch> loaded = IncrementalSearch::loadSnapshot(k_path);
+    auto loadTime = std::chrono::steady_clock::now() - start;
 
-    clock_t end = clock() - start;
+    // the first queries touch mapped pages
+    start = std::chrono::steady_clock::now();
+    size_t doNotOptimize = loaded->search("hystorical parliament").size();
+    auto firstQueryTime = std::chrono::steady_clock::now() - start;
 
-    std::cout << doNotOptimize << ": " << end;
-}
+    typedef std::chrono::microseconds us;
+    std::cout << doNotOptimize << ": build " << std::chrono::duration_cast<us>(buildTime).count() << "us, load "
+              << std::chrono::duration_cast<us>(loadTime).count() << "us, first query " << std::chrono::duration_cast<us>(firstQueryTime).count() << "us" << std::endl;
 
-void profileOsa()
-{
-    profileSpellCheck(false);
+    std::remove(k_path);
 }
 
-void profileOsaIncremental()
+void profileDeletionIndex()
 {
-    profileSpellCheck(true);
-}
+    // misprinted words of the vocabulary: one or two random edits
+    auto getQueries = [](const TokenArena& vocabulary, std::mt19937& random)
+    {
+        std::vector<std::string> queries;
+        for (int i = 0; i < 2000; ++i)
+        {
+            std::string word(vocabulary[std::uniform_int_distribution<TokenArena::Id>(0, static_cast<TokenArena::Id>(vocabulary.size() - 1))(random)]);
+            for (int edit = i % 2; edit < 2 && !word.empty(); ++edit)
+                word[std::uniform_int_distribution<size_t>(0, word.size() - 1)(random)] = 'a' + std::uniform_int_distribution<int>(0, 25)(random);
+
+            queries.push_back(word);
+        }
+
+        return queries;
+    };
+
+    auto profile = [&getQueries](const char* name, const std::vector<std::string>& text)
+    {
+        std::mt19937 random(9);
+        for (unsigned maxDistance : { 0u, 1u, 2u })
+        {
+            SpellCheck::Options options;
+            options.m_deletionDistance = maxDistance;
+
+            auto start = std::chrono::steady_clock::now();
+            SpellCheck speller { text, &tolower, options };
+            auto buildTime = std::chrono::steady_clock::now() - start;
+
+            std::vector<std::string> queries = getQueries(speller.getVocabulary(), random);
+            SpellCheck::TopCorrections<5> corrections;
+
+            start = std::chrono::steady_clock::now();
+            for (const std::string& query : queries)
+                speller.getCorrections(query, corrections);
+
+            auto queryTime = std::chrono::steady_clock::now() - start;
 
+            // bounded lookup doesn't fall back to the scan if there are not enough near corrections
+            auto nearTime = queryTime;
+            if (maxDistance != 0)
+            {
+                start = std::chrono::steady_clock::now();
+                for (const std::string& query : queries)
+                    speller.getNearCorrections(query, corrections);
+
+                nearTime = std::chrono::steady_clock::now() - start;
+            }
+
+            typedef std::chrono::microseconds us;
+            std::cout << name << ", " << speller.getVocabulary().size() << " tokens, deletion distance " << maxDistance
+                      << ": build " << std::chrono::duration_cast<us>(buildTime).count() / 1000 << "ms"
+                      << ", index " << speller.getDeletionIndex().getMemoryUsage() / 1024 << "KB"
+                      << ", vocabulary " << speller.getVocabulary().getMemoryUsage() / 1024 << "KB"
+                      << ", query " << std::chrono::duration_cast<us>(queryTime).count() / queries.size() << "us"
+                      << ", near query " << std::chrono::duration_cast<std::chrono::nanoseconds>(nearTime).count() / queries.size() << "ns" << std::endl;
+        }
+    };
+
+    profile("wikipedia", loadWikipedia());
+
+    std::mt19937 random(10);
+    std::vector<std::string> words;
+    for (int i = 0; i < 1000000; ++i)
+        words.push_back(randomWord(random, 12, "etaoinshrdlucmfwypvbgkqjxz"));
+
+    profile("random words", words);
+}
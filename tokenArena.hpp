@@ -0,0 +1,137 @@
+#pragma once
+#include <vector>
+#include <numeric>
+#include <string_view>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cassert>
+
+#include "snapshot.hpp"
+
+// Vocabulary storage: chars of all tokens are packed into a single arena and grouped into buckets of equal length,
+// so a scan over a bucket reads memory sequentially and doesn't need per-token lookups.
+// Token is identified by its position in sorted order (id), which is independent from the storage order.
+class TokenArena
+{
+public:
+    typedef uint32_t Id;
+
+    static const Id k_none = std::numeric_limits<Id>::max();
+
+    // tokens of equal length, placed one by one in storage order
+    struct Bucket
+    {
+        uint32_t m_length;
+        uint32_t m_first;       // storage positions range
+        uint32_t m_last;
+        uint32_t m_chars;       // arena offset of the first token
+    };
+
+    TokenArena() = default;
+
+    // 'tokens' must be sorted and unique
+    template <typename Tokens>
+    explicit TokenArena(const Tokens& tokens)
+    {
+        std::vector<Id> storage(tokens.size());
+        std::iota(storage.begin(), storage.end(), Id(0));
+        std::stable_sort(storage.begin(), storage.end(), [&tokens](Id left, Id right) { return tokens[left].size() < tokens[right].size(); });
+
+        size_t charsSize = 0;
+        for (const auto& token : tokens)
+            charsSize += token.size();
+
+        assert(charsSize <= std::numeric_limits<uint32_t>::max() && "token offsets are 32-bit");
+
+        std::vector<char>   chars;
+        std::vector<Token>  tokenInfos(tokens.size());
+        std::vector<Bucket> buckets;
+        chars.reserve(charsSize);
+
+        for (uint32_t position = 0; position < storage.size(); ++position)
+        {
+            const auto& token = tokens[storage[position]];
+            uint32_t    size  = static_cast<uint32_t>(token.size());
+
+            if (buckets.empty() || buckets.back().m_length != size)
+                buckets.push_back(Bucket { size, position, position, static_cast<uint32_t>(chars.size()) });
+
+            ++buckets.back().m_last;
+            tokenInfos[storage[position]] = Token { static_cast<uint32_t>(chars.size()), size };
+            chars.insert(chars.end(), token.data(), token.data() + size);
+        }
+
+        m_chars   = std::move(chars);
+        m_tokens  = std::move(tokenInfos);
+        m_storage = std::move(storage);
+        m_buckets = std::move(buckets);
+    }
+
+    explicit TokenArena(SnapshotReader& reader)
+        : m_chars(reader.read<char>())
+        , m_tokens(reader.read<Token>())
+        , m_storage(reader.read<Id>())
+        , m_buckets(reader.read<Bucket>())
+    {}
+
+    void save(SnapshotWriter& writer) const
+    {
+        writer.write(m_chars);
+        writer.write(m_tokens);
+        writer.write(m_storage);
+        writer.write(m_buckets);
+    }
+
+    bool   empty() const { return m_tokens.empty(); }
+    size_t size() const  { return m_tokens.size(); }
+
+    std::string_view operator[](Id id) const
+    {
+        return std::string_view(m_chars.data() + m_tokens[id].m_offset, m_tokens[id].m_size);
+    }
+
+    // id of 'token' or k_none
+    Id find(std::string_view token) const
+    {
+        Id first = 0;
+        Id last  = static_cast<Id>(size());
+        while (first < last)
+        {
+            Id middle = first + (last - first) / 2;
+            if ((*this)[middle] < token)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+
+        return first < size() && (*this)[first] == token ? first : k_none;
+    }
+
+    size_t        getBucketCount() const              { return m_buckets.size(); }
+    const Bucket& getBucket(size_t bucket) const      { return m_buckets[bucket]; }
+    Id            getStorageId(size_t position) const { return m_storage[position]; }
+
+    // token at storage 'position' within 'bucket'
+    std::string_view getBucketToken(const Bucket& bucket, size_t position) const
+    {
+        return std::string_view(m_chars.data() + bucket.m_chars + (position - bucket.m_first) * bucket.m_length, bucket.m_length);
+    }
+
+    size_t getMemoryUsage() const
+    {
+        return m_chars.size() + m_tokens.size() * sizeof(Token) + m_storage.size() * sizeof(Id) + m_buckets.size() * sizeof(Bucket);
+    }
+
+private:
+    struct Token
+    {
+        uint32_t m_offset;
+        uint32_t m_size;
+    };
+
+    MappedArray<char>   m_chars;
+    MappedArray<Token>  m_tokens;       // by id
+    MappedArray<Id>     m_storage;      // ids in storage order
+    MappedArray<Bucket> m_buckets;
+};
@@ -0,0 +1,89 @@
+#pragma once
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+
+#include "snapshot.hpp"
+
+// Prefix tree over sorted vocabulary. Nodes are stored in preorder, so parent is always placed before its children
+// and DP over all vocabulary prefixes is a single pass over the node array.
+// Node is identified by its index, root (empty prefix) is node 0, node N is the prefix of depth getDepth(N).
+class TokenTrie
+{
+public:
+    typedef uint32_t Node;
+
+    static const Node k_root = 0;
+
+    TokenTrie() = default;
+
+    // 'tokens' must be sorted and unique, e.g. SpellCheck vocabulary
+    template <typename Tokens>
+    explicit TokenTrie(const Tokens& tokens)
+    {
+        std::vector<NodeInfo> nodes { NodeInfo { k_root, 0, '\0' } };
+        std::vector<Node>     tokenNodes;
+        tokenNodes.reserve(tokens.size());
+
+        std::vector<Node> path { k_root };     // nodes of the previous token
+        const char* previous = "";
+        size_t previousSize  = 0;
+
+        for (size_t t = 0; t < tokens.size(); ++t)
+        {
+            const auto& token = tokens[t];
+            size_t size   = token.size();
+            size_t common = 0;
+            while (common < size && common < previousSize && token[common] == previous[common])
+                ++common;
+
+            path.resize(common + 1);
+            for (size_t i = common; i < size; ++i)
+            {
+                path.push_back(static_cast<Node>(nodes.size()));
+                nodes.push_back(NodeInfo { path[i], static_cast<uint32_t>(i + 1), token[i] });
+            }
+
+            tokenNodes.push_back(path.back());
+            previous     = token.data();
+            previousSize = size;
+        }
+
+        m_nodes      = std::move(nodes);
+        m_tokenNodes = std::move(tokenNodes);
+    }
+
+    explicit TokenTrie(SnapshotReader& reader)
+        : m_nodes(reader.read<NodeInfo>())
+        , m_tokenNodes(reader.read<Node>())
+    {}
+
+    void save(SnapshotWriter& writer) const
+    {
+        writer.write(m_nodes);
+        writer.write(m_tokenNodes);
+    }
+
+    bool   empty() const { return m_nodes.empty(); }
+    size_t size() const  { return m_nodes.size(); }
+
+    Node     getParent(Node node) const { return m_nodes[node].m_parent; }
+    unsigned getDepth(Node node) const  { return m_nodes[node].m_depth; }
+    char     getChar(Node node) const   { return m_nodes[node].m_char; }     // last char of the prefix
+
+    // node of the whole token, tokens are numbered in order of construction
+    Node getTokenNode(size_t token) const { return m_tokenNodes[token]; }
+
+private:
+    struct NodeInfo
+    {
+        Node     m_parent;
+        uint32_t m_depth;
+        char     m_char;
+        char     m_padding[3];  // zeroed, so snapshot bytes are defined
+    };
+
+    MappedArray<NodeInfo> m_nodes;
+    MappedArray<Node>     m_tokenNodes;
+};
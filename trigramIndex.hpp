@@ -0,0 +1,167 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <string_view>
+#include <algorithm>
+#include <cstdint>
+
+#include "snapshot.hpp"
+#include "parallelBuild.hpp"
+
+// Inverted index from every 3-char substring (trigram) to the sorted list of items containing it.
+// An item containing a substring contains all trigrams of the substring, so only items which are in all of these lists
+// are candidates. Candidates still have to be verified: trigrams may be placed in other order or far from each other.
+class TrigramIndex
+{
+public:
+    typedef uint32_t Item;
+
+    static const size_t k_gramSize = 3;
+
+    TrigramIndex() = default;
+
+    // Items are numbered in order of 'strings'. 'threads' are used to collect and sort trigrams, see parallelBuild.hpp
+    template <typename Strings>
+    explicit TrigramIndex(const Strings& strings, unsigned threads = 1)
+    {
+        // trigram is in the high half and item is in the low one, so sorting groups items by trigram
+        size_t shardCount = parallelBuild::getShardCount(threads, strings.size());
+        std::vector<std::vector<uint64_t>> shards(shardCount);
+        AsyncExecutor()(shardCount, [&strings, &shards, shardCount](size_t shard)
+        {
+            size_t last = parallelBuild::getShardBegin(strings.size(), shardCount, shard + 1);
+            for (size_t item = parallelBuild::getShardBegin(strings.size(), shardCount, shard); item < last; ++item)
+            {
+                std::string_view string = strings[item];
+                for (size_t i = 0; i + k_gramSize <= string.size(); ++i)
+                    shards[shard].push_back(uint64_t(getGram(string, i)) << 32 | item);
+            }
+        });
+
+        std::vector<uint64_t> pairs = std::move(shards[0]);
+        for (size_t shard = 1; shard < shardCount; ++shard)
+            pairs.insert(pairs.end(), shards[shard].begin(), shards[shard].end());
+
+        parallelBuild::sortUnique(pairs, threads);
+
+        std::vector<Gram>     grams;
+        std::vector<uint32_t> offsets;
+        std::vector<Item>     items;
+        items.reserve(pairs.size());
+
+        for (uint64_t pair : pairs)
+        {
+            Gram gram = static_cast<Gram>(pair >> 32);
+            if (grams.empty() || grams.back() != gram)
+            {
+                grams.push_back(gram);
+                offsets.push_back(static_cast<uint32_t>(items.size()));
+            }
+
+            items.push_back(static_cast<Item>(pair));
+        }
+
+        offsets.push_back(static_cast<uint32_t>(items.size()));
+
+        m_grams   = std::move(grams);
+        m_offsets = std::move(offsets);
+        m_items   = std::move(items);
+    }
+
+    explicit TrigramIndex(SnapshotReader& reader)
+        : m_grams(reader.read<Gram>())
+        , m_offsets(reader.read<uint32_t>())
+        , m_items(reader.read<Item>())
+    {}
+
+    void save(SnapshotWriter& writer) const
+    {
+        writer.write(m_grams);
+        writer.write(m_offsets);
+        writer.write(m_items);
+    }
+
+    // shorter substrings have no trigrams, so every item is a candidate
+    bool isSupported(std::string_view substring) const
+    {
+        return !m_offsets.empty() && substring.size() >= k_gramSize;
+    }
+
+    // Calls 'visit(item)' for every candidate in ascending order while it returns true.
+    // Requires isSupported(substring)
+    template <typename Visitor>
+    void forEachCandidate(std::string_view substring, Visitor visit) const
+    {
+        // only the rarest trigrams are intersected: any subset of trigrams still gives a superset of matching items
+        std::array<Range, k_maxRanges> ranges;
+        size_t rangeCount = 0;
+
+        for (size_t i = 0; i + k_gramSize <= substring.size(); ++i)
+        {
+            Range range = getRange(getGram(substring, i));
+            if (range.m_first == range.m_last)
+                return;     // no item contains this trigram
+
+            size_t position = std::min(rangeCount, k_maxRanges - 1);
+            if (rangeCount == k_maxRanges && ranges[position].getSize() <= range.getSize())
+                continue;
+
+            for (; position > 0 && ranges[position - 1].getSize() > range.getSize(); --position)
+                ranges[position] = ranges[position - 1];
+
+            ranges[position] = range;
+            rangeCount = std::min(rangeCount + 1, k_maxRanges);
+        }
+
+        // the shortest list drives the intersection, the others are only advanced
+        for (const Item* item = ranges[0].m_first; item != ranges[0].m_last; ++item)
+        {
+            bool isCandidate = true;
+            for (size_t i = 1; i < rangeCount && isCandidate; ++i)
+            {
+                ranges[i].m_first = std::lower_bound(ranges[i].m_first, ranges[i].m_last, *item);
+                if (ranges[i].m_first == ranges[i].m_last)
+                    return;
+
+                isCandidate = *ranges[i].m_first == *item;
+            }
+
+            if (isCandidate && !visit(*item))
+                return;
+        }
+    }
+
+private:
+    typedef uint32_t Gram;
+
+    static constexpr size_t k_maxRanges = 8;
+
+    struct Range
+    {
+        const Item* m_first;
+        const Item* m_last;
+
+        size_t getSize() const { return m_last - m_first; }
+    };
+
+    MappedArray<Gram>     m_grams;      // sorted
+    MappedArray<uint32_t> m_offsets;    // items of m_grams[i] are [m_offsets[i], m_offsets[i + 1])
+    MappedArray<Item>     m_items;
+
+    static Gram getGram(std::string_view string, size_t position)
+    {
+        return Gram(static_cast<unsigned char>(string[position])) << 16
+             | Gram(static_cast<unsigned char>(string[position + 1])) << 8
+             | Gram(static_cast<unsigned char>(string[position + 2]));
+    }
+
+    Range getRange(Gram gram) const
+    {
+        auto found = std::lower_bound(m_grams.begin(), m_grams.end(), gram);
+        if (found == m_grams.end() || *found != gram)
+            return Range { nullptr, nullptr };
+
+        size_t index = found - m_grams.begin();
+        return Range { m_items.data() + m_offsets[index], m_items.data() + m_offsets[index + 1] };
+    }
+};
@@ -0,0 +1,386 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined __AVX2__
+#include <immintrin.h>
+#define UTF8_SIMD_WIDTH 32
+#elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UTF8_SIMD_WIDTH 16
+#endif
+
+// UTF-8 text scanning for tokenization and case folding.
+//
+// Most text is ASCII, so blocks of 16 (SSE2) or 32 (AVX2) bytes are classified and lowercased by a few vector instructions,
+// and only blocks with non-ASCII bytes take the codepoint path. Token chars are ASCII letters and digits, and letters
+// and digits of common scripts. Their case folding is simple and keeps the UTF-8 length, so lowercase text has the same
+// offsets as the original one, and tokens of lowercase text are lowercase tokens of the original text.
+// Bytes of invalid sequences are separators, they are kept as is and are decoded to U+DC80..U+DCFF.
+// Rules don't depend on the C locale.
+namespace utf8
+{
+    // decoded invalid byte is this plus the byte: lone surrogates never come from valid UTF-8
+    static const char32_t k_invalid = 0xDC00;
+
+    inline bool isAsciiAlnum(unsigned char c)
+    {
+        return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+    }
+
+    // ASCII chars which are never a part of a token: a token can't span them, whatever the bytes around are
+    inline bool isSeparator(char c)
+    {
+        unsigned char code = static_cast<unsigned char>(c);
+        return code < 0x80 && !isAsciiAlnum(code);
+    }
+
+    inline char lowercase(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+    }
+
+    // Case convertor of SpellCheck::tokenize(): tokens are folded by lowercase(std::string&), not char by char
+    struct Lowercase
+    {
+        char operator()(char c) const { return lowercase(c); }
+    };
+
+    // codepoint at 'position', which is moved past its sequence
+    inline char32_t decode(std::string_view text, size_t& position)
+    {
+        unsigned char lead = static_cast<unsigned char>(text[position]);
+        if (lead < 0x80)
+        {
+            ++position;
+            return lead;
+        }
+
+        // 0xC0 and 0xC1 are overlong leads of ASCII, leads past 0xF4 are beyond U+10FFFF
+        size_t length = lead >= 0xF5 ? 0 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC2 ? 2 : 0;
+        if (length == 0 || text.size() - position < length)
+        {
+            ++position;
+            return k_invalid + lead;
+        }
+
+        char32_t codepoint = lead & (0x7F >> length);
+        for (size_t i = 1; i < length; ++i)
+        {
+            unsigned char next = static_cast<unsigned char>(text[position + i]);
+            if ((next & 0xC0) != 0x80)
+            {
+                ++position;
+                return k_invalid + lead;
+            }
+
+            codepoint = (codepoint << 6) | (next & 0x3F);
+        }
+
+        bool isOverlong = (length == 3 && codepoint < 0x800) || (length == 4 && codepoint < 0x10000);
+        if (isOverlong || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF))
+        {
+            ++position;
+            return k_invalid + lead;
+        }
+
+        position += length;
+        return codepoint;
+    }
+
+    // replaces 'length' bytes at 'out' by the sequence of 'codepoint', which must have this length
+    inline void encode(char32_t codepoint, char* out, size_t length)
+    {
+        if (length == 1)
+        {
+            out[0] = static_cast<char>(codepoint);
+            return;
+        }
+
+        static const unsigned char k_leads[] = { 0, 0, 0xC0, 0xE0, 0xF0 };
+        for (size_t i = length - 1; i > 0; --i, codepoint >>= 6)
+            out[i] = static_cast<char>(0x80 | (codepoint & 0x3F));
+
+        out[0] = static_cast<char>(k_leads[length] | codepoint);
+    }
+
+    // letters and digits of Latin, Greek, Cyrillic, Armenian, Hebrew, Arabic, Devanagari, Thai, Kana, CJK and Hangul
+    inline bool isAlnum(char32_t c)
+    {
+        if (c < 0x80)
+            return isAsciiAlnum(static_cast<unsigned char>(c));
+
+        static const char32_t k_ranges[][2] =
+        {
+            { 0x00AA, 0x00AA }, { 0x00B5, 0x00B5 }, { 0x00BA, 0x00BA }, { 0x00C0, 0x00D6 }, { 0x00D8, 0x00F6 },
+            { 0x00F8, 0x02AF }, { 0x0386, 0x0386 }, { 0x0388, 0x03FF }, { 0x0400, 0x0481 }, { 0x048A, 0x052F },
+            { 0x0531, 0x0556 }, { 0x0561, 0x0587 }, { 0x05D0, 0x05EA }, { 0x0620, 0x064A }, { 0x0660, 0x0669 },
+            { 0x0671, 0x06D3 }, { 0x0900, 0x0963 }, { 0x0966, 0x097F }, { 0x0E01, 0x0E3A }, { 0x0E40, 0x0E4E },
+            { 0x0E50, 0x0E59 }, { 0x1E00, 0x1EFF }, { 0x3041, 0x3096 }, { 0x30A1, 0x30FA }, { 0x30FC, 0x30FC },
+            { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xAC00, 0xD7A3 }, { 0xFF10, 0xFF19 }, { 0xFF21, 0xFF3A },
+            { 0xFF41, 0xFF5A },
+        };
+
+        auto range = std::lower_bound(std::begin(k_ranges), std::end(k_ranges), c, [](const char32_t (&range)[2], char32_t c) { return range[1] < c; });
+        return range != std::end(k_ranges) && (*range)[0] <= c;
+    }
+
+    // Simple case folding of the scripts above, which keeps UTF-8 length. Special cases like U+0130 are kept as is
+    inline char32_t lowercase(char32_t c)
+    {
+        auto isEven = [c]() { return c % 2 == 0; };
+
+        if (c < 0x80)
+            return c >= 'A' && c <= 'Z' ? c + 0x20 : c;
+
+        if (c >= 0x00C0 && c <= 0x00DE && c != 0x00D7)                           // Latin-1
+            return c + 0x20;
+
+        if ((c >= 0x0100 && c <= 0x012F) || (c >= 0x0132 && c <= 0x0137) || (c >= 0x014A && c <= 0x0177))
+            return isEven() ? c + 1 : c;                                          // Latin Extended-A pairs
+
+        if ((c >= 0x0139 && c <= 0x0148) || (c >= 0x0179 && c <= 0x017E))
+            return isEven() ? c : c + 1;
+
+        if (c == 0x0178)
+            return 0x00FF;
+
+        if ((c >= 0x0391 && c <= 0x03A9 && c != 0x03A2) || (c >= 0x0410 && c <= 0x042F))
+            return c + 0x20;                                                      // Greek, Cyrillic
+
+        if (c == 0x0386)
+            return 0x03AC;
+
+        if (c >= 0x0388 && c <= 0x038A)
+            return c + 0x25;
+
+        if (c == 0x038C)
+            return 0x03CC;
+
+        if (c == 0x038E || c == 0x038F)
+            return c + 0x3F;
+
+        if (c >= 0x0400 && c <= 0x040F)
+            return c + 0x50;
+
+        if ((c >= 0x0460 && c <= 0x0481) || (c >= 0x048A && c <= 0x04BF) || (c >= 0x04D0 && c <= 0x052F))
+            return isEven() ? c + 1 : c;
+
+        if (c == 0x04C0)
+            return 0x04CF;
+
+        if (c >= 0x04C1 && c <= 0x04CE)
+            return isEven() ? c : c + 1;
+
+        if (c >= 0x0531 && c <= 0x0556)                                           // Armenian
+            return c + 0x30;
+
+        if ((c >= 0x1E00 && c <= 0x1E95) || (c >= 0x1EA0 && c <= 0x1EFF))        // Latin Extended Additional
+            return isEven() ? c + 1 : c;
+
+        if (c >= 0xFF21 && c <= 0xFF3A)                                           // fullwidth Latin
+            return c + 0x20;
+
+        return c;
+    }
+
+#if defined UTF8_SIMD_WIDTH
+    // SIMD block of ASCII bytes: classification and folding work on all its bytes at once
+    struct Block
+    {
+#if UTF8_SIMD_WIDTH == 32
+        typedef __m256i Vector;
+
+        static Vector   load(const char* data)                { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)); }
+        static void     store(char* data, Vector vector)      { _mm256_storeu_si256(reinterpret_cast<__m256i*>(data), vector); }
+        static uint32_t getHighBits(Vector vector)            { return static_cast<uint32_t>(_mm256_movemask_epi8(vector)); }
+        static Vector   set(char c)                           { return _mm256_set1_epi8(c); }
+        static Vector   greater(Vector left, Vector right)    { return _mm256_cmpgt_epi8(left, right); }
+        static Vector   bitAnd(Vector left, Vector right)     { return _mm256_and_si256(left, right); }
+        static Vector   bitOr(Vector left, Vector right)      { return _mm256_or_si256(left, right); }
+#else
+        typedef __m128i Vector;
+
+        static Vector   load(const char* data)                { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)); }
+        static void     store(char* data, Vector vector)      { _mm_storeu_si128(reinterpret_cast<__m128i*>(data), vector); }
+        static uint32_t getHighBits(Vector vector)            { return static_cast<uint32_t>(_mm_movemask_epi8(vector)); }
+        static Vector   set(char c)                           { return _mm_set1_epi8(c); }
+        static Vector   greater(Vector left, Vector right)    { return _mm_cmpgt_epi8(left, right); }
+        static Vector   bitAnd(Vector left, Vector right)     { return _mm_and_si128(left, right); }
+        static Vector   bitOr(Vector left, Vector right)      { return _mm_or_si128(left, right); }
+#endif
+        static constexpr size_t   k_size = UTF8_SIMD_WIDTH;
+        static constexpr uint32_t k_all  = UTF8_SIMD_WIDTH == 32 ? 0xFFFFFFFFu : 0xFFFFu;
+
+        // block at 'data' of 'size' bytes, a partial one is copied to 'tail' of k_size bytes and padded with zeros first
+        static Vector load(const char* data, size_t size, char* tail)
+        {
+            if (size == k_size)
+                return load(data);
+
+            memcpy(tail, data, size);
+            memset(tail + size, 0, k_size - size);
+            return load(tail);
+        }
+
+        // bytes are ASCII, so signed comparison is fine
+        static Vector isInRange(Vector bytes, char first, char last)
+        {
+            return bitAnd(greater(bytes, set(static_cast<char>(first - 1))), greater(set(static_cast<char>(last + 1)), bytes));
+        }
+
+        static uint32_t getAlnumBits(Vector bytes)
+        {
+            Vector letters = bitOr(bytes, set(0x20));
+            return getHighBits(bitOr(isInRange(bytes, '0', '9'), isInRange(letters, 'a', 'z')));
+        }
+
+        static Vector lowercase(Vector bytes)
+        {
+            return bitOr(bytes, bitAnd(isInRange(bytes, 'A', 'Z'), set(0x20)));
+        }
+    };
+
+    inline unsigned countTrailingZeros(uint32_t bits)
+    {
+#if defined __GNUC__
+        return static_cast<unsigned>(__builtin_ctz(bits));
+#else
+        unsigned count = 0;
+        for (; (bits & 1) == 0; bits >>= 1)
+            ++count;
+
+        return count;
+#endif
+    }
+#endif
+
+    inline bool isAscii(std::string_view text)
+    {
+        size_t i = 0;
+#if defined UTF8_SIMD_WIDTH
+        for (; i + Block::k_size <= text.size(); i += Block::k_size)
+            if (Block::getHighBits(Block::load(text.data() + i)) != 0)
+                return false;
+#endif
+        for (; i < text.size(); ++i)
+            if (static_cast<unsigned char>(text[i]) >= 0x80)
+                return false;
+
+        return true;
+    }
+
+    inline void decode(std::string_view text, std::u32string& codepoints)
+    {
+        codepoints.clear();
+        for (size_t position = 0; position < text.size(); )
+            codepoints += decode(text, position);
+    }
+
+    // In place, see lowercase(char32_t)
+    inline void lowercase(char* data, size_t size)
+    {
+        std::string_view text(data, size);
+        for (size_t i = 0; i < size; )
+        {
+#if defined UTF8_SIMD_WIDTH
+            // the tail is folded in a padded copy: short strings like words and queries are common
+            char          tail[Block::k_size];
+            size_t        blockSize = std::min(Block::k_size, size - i);
+            Block::Vector bytes     = Block::load(data + i, blockSize, tail);
+            if (Block::getHighBits(bytes) == 0)
+            {
+                if (blockSize == Block::k_size)
+                {
+                    Block::store(data + i, Block::lowercase(bytes));
+                }
+                else
+                {
+                    Block::store(tail, Block::lowercase(bytes));
+                    memcpy(data + i, tail, blockSize);
+                }
+
+                i += blockSize;
+                continue;
+            }
+#endif
+            // till the end of the block with non-ASCII bytes, a char may end past it
+            size_t blockEnd = std::min(size, i + 16);
+            while (i < blockEnd)
+            {
+                size_t   start     = i;
+                char32_t codepoint = decode(text, i);
+                char32_t lower     = lowercase(codepoint);
+                if (lower != codepoint)
+                    encode(lower, data + start, i - start);
+            }
+        }
+    }
+
+    inline void lowercase(std::string& text)
+    {
+        if (!text.empty())
+            lowercase(&text[0], text.size());
+    }
+
+    // Calls 'visit(begin, end)' for byte ranges of tokens of 'text': runs of isAlnum() codepoints
+    template <typename Visitor>
+    void forEachToken(std::string_view text, Visitor visit)
+    {
+        bool   isInToken = false;
+        size_t begin     = 0;
+
+        for (size_t i = 0; i < text.size(); )
+        {
+#if defined UTF8_SIMD_WIDTH
+            // zero padding of the tail is separators, so the last token ends at the end of text
+            char          tail[Block::k_size];
+            size_t        blockSize = std::min(Block::k_size, text.size() - i);
+            Block::Vector bytes     = Block::load(text.data() + i, blockSize, tail);
+            if (Block::getHighBits(bytes) == 0)
+            {
+                // every change of the state is the lowest bit of token bytes, or of separators in a token
+                uint32_t alnum = Block::getAlnumBits(bytes);
+                for (unsigned position = 0; position < Block::k_size; )
+                {
+                    uint32_t changes = ((isInToken ? ~alnum : alnum) & Block::k_all) >> position;
+                    if (changes == 0)
+                        break;
+
+                    position += countTrailingZeros(changes);
+                    if (isInToken)
+                        visit(begin, i + position);
+                    else
+                        begin = i + position;
+
+                    isInToken = !isInToken;
+                }
+
+                i += blockSize;
+                continue;
+            }
+#endif
+            size_t blockEnd = std::min(text.size(), i + 16);
+            while (i < blockEnd)
+            {
+                size_t start   = i;
+                bool   isToken = static_cast<unsigned char>(text[i]) < 0x80 ? isAsciiAlnum(static_cast<unsigned char>(text[i++])) : isAlnum(decode(text, i));
+                if (isToken != isInToken)
+                {
+                    if (isInToken)
+                        visit(begin, start);
+                    else
+                        begin = start;
+
+                    isInToken = isToken;
+                }
+            }
+        }
+
+        if (isInToken)
+            visit(begin, text.size());
+    }
+}